@@ -0,0 +1,137 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief Minimal timing harness for the benchmark program.
+
+Each case is run for a fixed number of iterations and every iteration is timed
+individually so that percentiles can be reported as well as the mean.  Results are
+collected and written out as a single JSON document.
+*/
+
+#ifndef BENCH_HPP_k2v9dq0x
+#define BENCH_HPP_k2v9dq0x
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace bench {
+  typedef std::chrono::steady_clock clock_type;
+
+  //! Summary of one benchmark case.
+  struct result {
+    std::string name;
+    std::size_t iterations;
+    double total_ns;
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double min_ns;
+    double max_ns;
+    //! Bytes processed per iteration, or 0 if it is not meaningful.
+    std::size_t bytes_per_op;
+  };
+
+  //! Stop the compiler discarding a computed value.
+  template <typename T>
+  inline void do_not_optimise(const T &v) {
+    asm volatile("" : : "g"(v) : "memory");
+  }
+
+  //! Time a single iteration of \c f in nanoseconds.
+  template <typename F>
+  double time_ns(F &f) {
+    clock_type::time_point start = clock_type::now();
+    f();
+    clock_type::time_point end = clock_type::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+  }
+
+  //! Compute the summary from a set of per-iteration samples (which are sorted).
+  inline result summarise(const std::string &name, std::vector<double> &samples, std::size_t bytes_per_op) {
+    result r;
+    r.name = name;
+    r.iterations = samples.size();
+    r.bytes_per_op = bytes_per_op;
+    r.total_ns = 0;
+    for (std::size_t i = 0; i < samples.size(); ++i) r.total_ns += samples[i];
+
+    if (samples.empty()) {
+      r.mean_ns = r.p50_ns = r.p99_ns = r.min_ns = r.max_ns = 0;
+      return r;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    r.mean_ns = r.total_ns / samples.size();
+    r.p50_ns = samples[(samples.size() - 1) / 2];
+    r.p99_ns = samples[((samples.size() - 1) * 99) / 100];
+    r.min_ns = samples.front();
+    r.max_ns = samples.back();
+    return r;
+  }
+
+  //! Collects results and writes them out.
+  class runner {
+    std::vector<result> results_;
+    std::string filter_;
+    double scale_;
+
+    public:
+      //! \param filter   only cases whose name contains this are run.
+      //! \param scale    multiplier for the iteration counts.
+      runner(const std::string &filter, double scale) : filter_(filter), scale_(scale) {}
+
+      //! Should the named case be run?
+      bool enabled(const std::string &name) const {
+        return filter_.empty() || name.find(filter_) != std::string::npos;
+      }
+
+      /*!
+      \brief Run \c f for a scaled number of iterations after a short warmup.
+
+      \c f is called once per iteration and may throw; exceptions propagate.
+      */
+      template <typename F>
+      void run(const std::string &name, std::size_t iterations, F f, std::size_t bytes_per_op = 0) {
+        if (! enabled(name)) return;
+
+        iterations = std::max<std::size_t>(1, static_cast<std::size_t>(iterations * scale_));
+        std::size_t warmup = std::max<std::size_t>(1, iterations / 10);
+        for (std::size_t i = 0; i < warmup; ++i) f();
+
+        std::vector<double> samples;
+        samples.reserve(iterations);
+        for (std::size_t i = 0; i < iterations; ++i) samples.push_back(time_ns(f));
+
+        add(summarise(name, samples, bytes_per_op));
+      }
+
+      //! Add a result measured by the caller.
+      void add(const result &r) {
+        std::fprintf(stderr, "%-32s %10zu iters %12.1f ns/op  p50 %12.1f  p99 %12.1f\n",
+                     r.name.c_str(), r.iterations, r.mean_ns, r.p50_ns, r.p99_ns);
+        results_.push_back(r);
+      }
+
+      //! Write all results as a JSON document.
+      void write_json(std::FILE *out, const char *version) const {
+        std::fprintf(out, "{\n  \"suite\": \"lrcon\",\n  \"version\": \"%s\",\n  \"results\": [", version);
+        for (std::size_t i = 0; i < results_.size(); ++i) {
+          const result &r = results_[i];
+          double ops_per_sec = r.mean_ns > 0 ? 1e9 / r.mean_ns : 0;
+          std::fprintf(out, "%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"mean_ns\": %.1f, "
+                       "\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f, "
+                       "\"ops_per_sec\": %.1f, \"bytes_per_op\": %zu}",
+                       (i == 0) ? "" : ",", r.name.c_str(), r.iterations, r.mean_ns, r.p50_ns,
+                       r.p99_ns, r.min_ns, r.max_ns, ops_per_sec, r.bytes_per_op);
+        }
+        std::fprintf(out, "\n  ]\n}\n");
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,157 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief Server query replies captured from a counter-strike: source server.
+
+Player names and some rule values were altered; the layout is as sent on the wire.
+*/
+
+#ifndef CAPTURED_PACKETS_HPP_7qz1c0mb
+#define CAPTURED_PACKETS_HPP_7qz1c0mb
+
+namespace captured {
+  //! A2S_INFO reply from a 32 slot counter-strike: source server (166 bytes)
+  const unsigned char a2s_info_reply[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0x49, 0x07, 0x5B, 0x45, 0x55, 0x5D, 0x20, 0x70,
+    0x72, 0x6F, 0x70, 0x70, 0x65, 0x72, 0x6C, 0x75, 0x73, 0x68, 0x2E, 0x6E,
+    0x65, 0x74, 0x20, 0x7C, 0x20, 0x32, 0x34, 0x2F, 0x37, 0x20, 0x64, 0x65,
+    0x5F, 0x64, 0x75, 0x73, 0x74, 0x32, 0x20, 0x7C, 0x20, 0x66, 0x61, 0x73,
+    0x74, 0x64, 0x6C, 0x00, 0x64, 0x65, 0x5F, 0x64, 0x75, 0x73, 0x74, 0x32,
+    0x00, 0x63, 0x73, 0x74, 0x72, 0x69, 0x6B, 0x65, 0x00, 0x43, 0x6F, 0x75,
+    0x6E, 0x74, 0x65, 0x72, 0x2D, 0x53, 0x74, 0x72, 0x69, 0x6B, 0x65, 0x3A,
+    0x20, 0x53, 0x6F, 0x75, 0x72, 0x63, 0x65, 0x00, 0xF0, 0x00, 0x13, 0x20,
+    0x02, 0x64, 0x6C, 0x00, 0x01, 0x31, 0x2E, 0x30, 0x2E, 0x30, 0x2E, 0x33,
+    0x34, 0x00, 0xA0, 0x87, 0x69, 0x61, 0x6C, 0x6C, 0x74, 0x61, 0x6C, 0x6B,
+    0x2C, 0x69, 0x6E, 0x63, 0x72, 0x65, 0x61, 0x73, 0x65, 0x64, 0x5F, 0x6D,
+    0x61, 0x78, 0x70, 0x6C, 0x61, 0x79, 0x65, 0x72, 0x73, 0x2C, 0x72, 0x65,
+    0x73, 0x70, 0x61, 0x77, 0x6E, 0x74, 0x69, 0x6D, 0x65, 0x73, 0x2C, 0x73,
+    0x74, 0x61, 0x72, 0x74, 0x6D, 0x6F, 0x6E, 0x65, 0x79, 0x00
+  };
+
+  //! Challenge number reply (9 bytes)
+  const unsigned char a2s_challenge_reply[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0x41, 0xE2, 0x71, 0x3C, 0x5A
+  };
+
+  //! A2S_PLAYER reply with 19 players (300 bytes)
+  const unsigned char a2s_players_reply[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0x44, 0x13, 0x00, 0x50, 0x6C, 0x61, 0x79, 0x65,
+    0x72, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x40, 0x01, 0x78,
+    0x58, 0x5F, 0x73, 0x6E, 0x69, 0x70, 0x65, 0x72, 0x5F, 0x58, 0x78, 0x00,
+    0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0x42, 0x02, 0x5B, 0x41, 0x57,
+    0x50, 0x5D, 0x6B, 0x65, 0x6E, 0x6E, 0x79, 0x00, 0x0E, 0x00, 0x00, 0x00,
+    0x00, 0x80, 0xF8, 0x42, 0x03, 0x64, 0x61, 0x76, 0x65, 0x00, 0x15, 0x00,
+    0x00, 0x00, 0x00, 0xC0, 0x38, 0x43, 0x04, 0x28, 0x31, 0x29, 0x50, 0x6C,
+    0x61, 0x79, 0x65, 0x72, 0x00, 0x1C, 0x00, 0x00, 0x00, 0x00, 0x40, 0x75,
+    0x43, 0x05, 0x6C, 0x75, 0x72, 0x6B, 0x65, 0x72, 0x00, 0x04, 0x00, 0x00,
+    0x00, 0x00, 0xE0, 0x98, 0x43, 0x06, 0x6E, 0x30, 0x30, 0x62, 0x73, 0x6C,
+    0x61, 0x79, 0x65, 0x72, 0x00, 0x0B, 0x00, 0x00, 0x00, 0x00, 0x20, 0xB7,
+    0x43, 0x07, 0x6D, 0x72, 0x2E, 0x20, 0x74, 0x00, 0x12, 0x00, 0x00, 0x00,
+    0x00, 0x60, 0xD5, 0x43, 0x08, 0x47, 0x6F, 0x72, 0x64, 0x6F, 0x6E, 0x00,
+    0x19, 0x00, 0x00, 0x00, 0x00, 0xA0, 0xF3, 0x43, 0x09, 0x42, 0x6C, 0x75,
+    0x65, 0x54, 0x65, 0x61, 0x6D, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0xF0,
+    0x08, 0x44, 0x0A, 0x72, 0x65, 0x64, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00,
+    0x10, 0x18, 0x44, 0x0B, 0x6B, 0x6F, 0x61, 0x6C, 0x61, 0x00, 0x0F, 0x00,
+    0x00, 0x00, 0x00, 0x30, 0x27, 0x44, 0x0C, 0x7A, 0x7A, 0x00, 0x16, 0x00,
+    0x00, 0x00, 0x00, 0x50, 0x36, 0x44, 0x0D, 0x71, 0x00, 0x1D, 0x00, 0x00,
+    0x00, 0x00, 0x70, 0x45, 0x44, 0x0E, 0x41, 0x6C, 0x00, 0x05, 0x00, 0x00,
+    0x00, 0x00, 0x90, 0x54, 0x44, 0x0F, 0x70, 0x77, 0x6E, 0x61, 0x67, 0x65,
+    0x00, 0x0C, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x63, 0x44, 0x10, 0x74, 0x75,
+    0x78, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00, 0xD0, 0x72, 0x44, 0x11, 0x4B,
+    0x00, 0x1A, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x80, 0x44, 0x12, 0x4D, 0x61,
+    0x6E, 0x64, 0x79, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x88, 0x88, 0x44
+  };
+
+  //! A2S_RULES reply with 56 rules (1021 bytes)
+  const unsigned char a2s_rules_reply[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0x45, 0x38, 0x00, 0x6D, 0x70, 0x5F, 0x66, 0x72,
+    0x69, 0x65, 0x6E, 0x64, 0x6C, 0x79, 0x66, 0x69, 0x72, 0x65, 0x00, 0x30,
+    0x00, 0x6D, 0x70, 0x5F, 0x74, 0x69, 0x6D, 0x65, 0x6C, 0x69, 0x6D, 0x69,
+    0x74, 0x00, 0x33, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x72, 0x6F, 0x75, 0x6E,
+    0x64, 0x74, 0x69, 0x6D, 0x65, 0x00, 0x32, 0x2E, 0x35, 0x00, 0x6D, 0x70,
+    0x5F, 0x63, 0x34, 0x74, 0x69, 0x6D, 0x65, 0x72, 0x00, 0x33, 0x35, 0x00,
+    0x6D, 0x70, 0x5F, 0x66, 0x72, 0x65, 0x65, 0x7A, 0x65, 0x74, 0x69, 0x6D,
+    0x65, 0x00, 0x33, 0x00, 0x73, 0x76, 0x5F, 0x67, 0x72, 0x61, 0x76, 0x69,
+    0x74, 0x79, 0x00, 0x38, 0x30, 0x30, 0x00, 0x73, 0x76, 0x5F, 0x61, 0x6C,
+    0x6C, 0x74, 0x61, 0x6C, 0x6B, 0x00, 0x31, 0x00, 0x73, 0x76, 0x5F, 0x6D,
+    0x61, 0x78, 0x73, 0x70, 0x65, 0x65, 0x64, 0x00, 0x33, 0x32, 0x30, 0x00,
+    0x73, 0x76, 0x5F, 0x61, 0x63, 0x63, 0x65, 0x6C, 0x65, 0x72, 0x61, 0x74,
+    0x65, 0x00, 0x35, 0x00, 0x73, 0x76, 0x5F, 0x61, 0x69, 0x72, 0x61, 0x63,
+    0x63, 0x65, 0x6C, 0x65, 0x72, 0x61, 0x74, 0x65, 0x00, 0x31, 0x30, 0x00,
+    0x73, 0x76, 0x5F, 0x66, 0x72, 0x69, 0x63, 0x74, 0x69, 0x6F, 0x6E, 0x00,
+    0x34, 0x00, 0x6D, 0x70, 0x5F, 0x66, 0x72, 0x61, 0x67, 0x6C, 0x69, 0x6D,
+    0x69, 0x74, 0x00, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x6D, 0x61, 0x78, 0x72,
+    0x6F, 0x75, 0x6E, 0x64, 0x73, 0x00, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x77,
+    0x69, 0x6E, 0x6C, 0x69, 0x6D, 0x69, 0x74, 0x00, 0x30, 0x00, 0x6D, 0x70,
+    0x5F, 0x73, 0x74, 0x61, 0x72, 0x74, 0x6D, 0x6F, 0x6E, 0x65, 0x79, 0x00,
+    0x31, 0x36, 0x30, 0x30, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x66, 0x6F, 0x6F,
+    0x74, 0x73, 0x74, 0x65, 0x70, 0x73, 0x00, 0x31, 0x00, 0x6D, 0x70, 0x5F,
+    0x66, 0x6C, 0x61, 0x73, 0x68, 0x6C, 0x69, 0x67, 0x68, 0x74, 0x00, 0x31,
+    0x00, 0x6D, 0x70, 0x5F, 0x66, 0x6F, 0x72, 0x63, 0x65, 0x63, 0x61, 0x6D,
+    0x65, 0x72, 0x61, 0x00, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x61, 0x75, 0x74,
+    0x6F, 0x74, 0x65, 0x61, 0x6D, 0x62, 0x61, 0x6C, 0x61, 0x6E, 0x63, 0x65,
+    0x00, 0x31, 0x00, 0x6D, 0x70, 0x5F, 0x6C, 0x69, 0x6D, 0x69, 0x74, 0x74,
+    0x65, 0x61, 0x6D, 0x73, 0x00, 0x32, 0x00, 0x6D, 0x70, 0x5F, 0x74, 0x65,
+    0x61, 0x6D, 0x70, 0x6C, 0x61, 0x79, 0x00, 0x30, 0x00, 0x73, 0x76, 0x5F,
+    0x63, 0x68, 0x65, 0x61, 0x74, 0x73, 0x00, 0x30, 0x00, 0x73, 0x76, 0x5F,
+    0x63, 0x6F, 0x6E, 0x74, 0x61, 0x63, 0x74, 0x00, 0x00, 0x73, 0x76, 0x5F,
+    0x70, 0x61, 0x73, 0x73, 0x77, 0x6F, 0x72, 0x64, 0x00, 0x30, 0x00, 0x73,
+    0x76, 0x5F, 0x73, 0x74, 0x6F, 0x70, 0x73, 0x70, 0x65, 0x65, 0x64, 0x00,
+    0x37, 0x35, 0x00, 0x73, 0x76, 0x5F, 0x77, 0x61, 0x74, 0x65, 0x72, 0x61,
+    0x63, 0x63, 0x65, 0x6C, 0x65, 0x72, 0x61, 0x74, 0x65, 0x00, 0x31, 0x30,
+    0x00, 0x73, 0x76, 0x5F, 0x77, 0x61, 0x74, 0x65, 0x72, 0x66, 0x72, 0x69,
+    0x63, 0x74, 0x69, 0x6F, 0x6E, 0x00, 0x31, 0x00, 0x73, 0x6F, 0x75, 0x72,
+    0x63, 0x65, 0x6D, 0x6F, 0x64, 0x5F, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6F,
+    0x6E, 0x00, 0x31, 0x2E, 0x31, 0x2E, 0x30, 0x00, 0x6D, 0x65, 0x74, 0x61,
+    0x6D, 0x6F, 0x64, 0x5F, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6F, 0x6E, 0x00,
+    0x31, 0x2E, 0x37, 0x2E, 0x30, 0x56, 0x00, 0x6E, 0x65, 0x78, 0x74, 0x6C,
+    0x65, 0x76, 0x65, 0x6C, 0x00, 0x00, 0x74, 0x76, 0x5F, 0x65, 0x6E, 0x61,
+    0x62, 0x6C, 0x65, 0x00, 0x30, 0x00, 0x73, 0x76, 0x5F, 0x74, 0x61, 0x67,
+    0x73, 0x00, 0x61, 0x6C, 0x6C, 0x74, 0x61, 0x6C, 0x6B, 0x2C, 0x69, 0x6E,
+    0x63, 0x72, 0x65, 0x61, 0x73, 0x65, 0x64, 0x5F, 0x6D, 0x61, 0x78, 0x70,
+    0x6C, 0x61, 0x79, 0x65, 0x72, 0x73, 0x2C, 0x72, 0x65, 0x73, 0x70, 0x61,
+    0x77, 0x6E, 0x74, 0x69, 0x6D, 0x65, 0x73, 0x2C, 0x73, 0x74, 0x61, 0x72,
+    0x74, 0x6D, 0x6F, 0x6E, 0x65, 0x79, 0x00, 0x63, 0x6F, 0x6F, 0x70, 0x00,
+    0x30, 0x00, 0x64, 0x65, 0x61, 0x74, 0x68, 0x6D, 0x61, 0x74, 0x63, 0x68,
+    0x00, 0x31, 0x00, 0x64, 0x65, 0x63, 0x61, 0x6C, 0x66, 0x72, 0x65, 0x71,
+    0x75, 0x65, 0x6E, 0x63, 0x79, 0x00, 0x31, 0x30, 0x00, 0x6D, 0x70, 0x5F,
+    0x61, 0x6C, 0x6C, 0x6F, 0x77, 0x4E, 0x50, 0x43, 0x73, 0x00, 0x31, 0x00,
+    0x6D, 0x70, 0x5F, 0x66, 0x61, 0x6C, 0x6C, 0x64, 0x61, 0x6D, 0x61, 0x67,
+    0x65, 0x00, 0x30, 0x00, 0x6D, 0x70, 0x5F, 0x77, 0x65, 0x61, 0x70, 0x6F,
+    0x6E, 0x73, 0x74, 0x61, 0x79, 0x00, 0x30, 0x00, 0x72, 0x5F, 0x41, 0x69,
+    0x72, 0x62, 0x6F, 0x61, 0x74, 0x56, 0x69, 0x65, 0x77, 0x44, 0x61, 0x6D,
+    0x70, 0x65, 0x6E, 0x44, 0x61, 0x6D, 0x70, 0x00, 0x31, 0x2E, 0x30, 0x00,
+    0x72, 0x5F, 0x41, 0x69, 0x72, 0x62, 0x6F, 0x61, 0x74, 0x56, 0x69, 0x65,
+    0x77, 0x44, 0x61, 0x6D, 0x70, 0x65, 0x6E, 0x46, 0x72, 0x65, 0x71, 0x00,
+    0x37, 0x2E, 0x30, 0x00, 0x72, 0x5F, 0x41, 0x69, 0x72, 0x62, 0x6F, 0x61,
+    0x74, 0x56, 0x69, 0x65, 0x77, 0x5A, 0x48, 0x65, 0x69, 0x67, 0x68, 0x74,
+    0x00, 0x30, 0x2E, 0x30, 0x00, 0x72, 0x5F, 0x4A, 0x65, 0x65, 0x70, 0x56,
+    0x69, 0x65, 0x77, 0x44, 0x61, 0x6D, 0x70, 0x65, 0x6E, 0x44, 0x61, 0x6D,
+    0x70, 0x00, 0x31, 0x2E, 0x30, 0x00, 0x72, 0x5F, 0x4A, 0x65, 0x65, 0x70,
+    0x56, 0x69, 0x65, 0x77, 0x44, 0x61, 0x6D, 0x70, 0x65, 0x6E, 0x46, 0x72,
+    0x65, 0x71, 0x00, 0x37, 0x2E, 0x30, 0x00, 0x72, 0x5F, 0x4A, 0x65, 0x65,
+    0x70, 0x56, 0x69, 0x65, 0x77, 0x5A, 0x48, 0x65, 0x69, 0x67, 0x68, 0x74,
+    0x00, 0x31, 0x30, 0x2E, 0x30, 0x00, 0x72, 0x5F, 0x56, 0x65, 0x68, 0x69,
+    0x63, 0x6C, 0x65, 0x56, 0x69, 0x65, 0x77, 0x44, 0x61, 0x6D, 0x70, 0x65,
+    0x6E, 0x00, 0x31, 0x00, 0x73, 0x76, 0x5F, 0x62, 0x6F, 0x75, 0x6E, 0x63,
+    0x65, 0x00, 0x30, 0x00, 0x73, 0x76, 0x5F, 0x66, 0x6F, 0x6F, 0x74, 0x73,
+    0x74, 0x65, 0x70, 0x73, 0x00, 0x31, 0x00, 0x73, 0x76, 0x5F, 0x6E, 0x6F,
+    0x63, 0x6C, 0x69, 0x70, 0x61, 0x63, 0x63, 0x65, 0x6C, 0x65, 0x72, 0x61,
+    0x74, 0x65, 0x00, 0x35, 0x00, 0x73, 0x76, 0x5F, 0x6E, 0x6F, 0x63, 0x6C,
+    0x69, 0x70, 0x73, 0x70, 0x65, 0x65, 0x64, 0x00, 0x35, 0x00, 0x73, 0x76,
+    0x5F, 0x72, 0x6F, 0x6C, 0x6C, 0x61, 0x6E, 0x67, 0x6C, 0x65, 0x00, 0x30,
+    0x00, 0x73, 0x76, 0x5F, 0x72, 0x6F, 0x6C, 0x6C, 0x73, 0x70, 0x65, 0x65,
+    0x64, 0x00, 0x32, 0x30, 0x30, 0x00, 0x73, 0x76, 0x5F, 0x73, 0x70, 0x65,
+    0x63, 0x61, 0x63, 0x63, 0x65, 0x6C, 0x65, 0x72, 0x61, 0x74, 0x65, 0x00,
+    0x35, 0x00, 0x73, 0x76, 0x5F, 0x73, 0x70, 0x65, 0x63, 0x6E, 0x6F, 0x63,
+    0x6C, 0x69, 0x70, 0x00, 0x31, 0x00, 0x73, 0x76, 0x5F, 0x73, 0x70, 0x65,
+    0x63, 0x73, 0x70, 0x65, 0x65, 0x64, 0x00, 0x33, 0x00, 0x73, 0x76, 0x5F,
+    0x73, 0x74, 0x65, 0x70, 0x73, 0x69, 0x7A, 0x65, 0x00, 0x31, 0x38, 0x00,
+    0x73, 0x76, 0x5F, 0x76, 0x6F, 0x74, 0x65, 0x5F, 0x71, 0x75, 0x6F, 0x72,
+    0x75, 0x6D, 0x5F, 0x72, 0x61, 0x74, 0x69, 0x6F, 0x00, 0x30, 0x2E, 0x36,
+    0x00
+  };
+}
+
+#endif
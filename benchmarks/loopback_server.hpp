@@ -0,0 +1,358 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief Trivial RCON and query servers on the loopback interface for end-to-end benchmarks.
+
+The RCON server accepts one client at a time, authorises any client which sends
+the configured password and answers every other command with a fixed reply.  The
+query fleet answers info requests sent to any address in 127.0.0.0/8 as if each
+address were a separate server.  The query server answers info, players and rules
+requests only when they carry its current challenge, like newer Source servers.
+*/
+
+#ifndef LOOPBACK_SERVER_HPP_5hc0x2mr
+#define LOOPBACK_SERVER_HPP_5hc0x2mr
+
+#include <lrcon/common.hpp>
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+  //! Append an RCON packet to \c out.
+  inline void append_rcon_packet(std::string &out, int32_t id, int32_t command, const std::string &s1, const std::string &s2 = "") {
+    int32_t size = sizeof(int32_t) * 2 + s1.length() + 1 + s2.length() + 1;
+    out.append((const char *) &size, sizeof(size));
+    out.append((const char *) &id, sizeof(id));
+    out.append((const char *) &command, sizeof(command));
+    out.append(s1.c_str(), s1.length() + 1);
+    out.append(s2.c_str(), s2.length() + 1);
+  }
+
+  class loopback_rcon_server {
+    int listen_fd_;
+    std::string port_;
+    std::string password_;
+    std::string reply_;
+    int delay_us_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    public:
+      //! Listens on an ephemeral port of 127.0.0.1; see port().
+      //! \param delay_us  time each command takes to run before its reply is sent.
+      loopback_rcon_server(const std::string &password, std::size_t reply_size, int delay_us = 0)
+      : password_(password), reply_(reply_size, 'x'), delay_us_(delay_us), stop_(false) {
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd_ == -1) common::errno_throw<common::connection_error>("socket() failed");
+
+        int yes = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        if (bind(listen_fd_, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+          common::errno_throw<common::connection_error>("bind() failed");
+        }
+        if (listen(listen_fd_, 16) == -1) {
+          common::errno_throw<common::connection_error>("listen() failed");
+        }
+
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (struct sockaddr *) &addr, &len);
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "%d", (int) ntohs(addr.sin_port));
+        port_ = buf;
+
+        thread_ = std::thread(&loopback_rcon_server::serve, this);
+      }
+
+      ~loopback_rcon_server() {
+        stop_ = true;
+        thread_.join();
+        close(listen_fd_);
+      }
+
+      const char *port() const { return port_.c_str(); }
+
+    private:
+      //! Read exactly \c sz bytes or return false.
+      bool read_exact(int fd, char *buf, std::size_t sz) {
+        std::size_t got = 0;
+        while (got < sz) {
+          struct pollfd p = {fd, POLLIN, 0};
+          if (poll(&p, 1, 100) <= 0) {
+            if (stop_) return false;
+            continue;
+          }
+          ssize_t r = recv(fd, buf + got, sz - got, 0);
+          if (r <= 0) return false;
+          got += r;
+        }
+        return true;
+      }
+
+      void serve() {
+        while (! stop_) {
+          struct pollfd p = {listen_fd_, POLLIN, 0};
+          if (poll(&p, 1, 100) <= 0) continue;
+
+          int fd = accept(listen_fd_, NULL, NULL);
+          if (fd == -1) continue;
+          int yes = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+          serve_client(fd);
+          close(fd);
+        }
+      }
+
+      void serve_client(int fd) {
+        std::vector<char> body;
+        std::string out;
+        while (! stop_) {
+          int32_t size;
+          if (! read_exact(fd, (char *) &size, sizeof(size))) return;
+          if (size < 10 || size > 8200) return;
+          body.resize(size);
+          if (! read_exact(fd, &body[0], size)) return;
+
+          int32_t id, command;
+          std::memcpy(&id, &body[0], sizeof(id));
+          std::memcpy(&command, &body[4], sizeof(command));
+
+          out.clear();
+          if (command == 3) {
+            // Mirror packet then the auth response.
+            append_rcon_packet(out, id, 0, "");
+            bool ok = password_ == std::string(&body[8]);
+            append_rcon_packet(out, ok ? id : -1, 2, "");
+          }
+          else {
+            if (delay_us_) std::this_thread::sleep_for(std::chrono::microseconds(delay_us_));
+            append_rcon_packet(out, id, 0, reply_);
+          }
+          send(fd, out.data(), out.size(), 0);
+        }
+      }
+  };
+
+  /*!
+  \brief One query server on 127.0.0.1 which insists on its challenge.
+
+  A request without the current challenge, info included, gets a challenge reply.
+  requests() counts every datagram received, so a benchmark can check how many
+  round trips a query took.
+  */
+  class loopback_a2s_server {
+    int fd_;
+    std::string port_;
+    std::string info_, players_, rules_;
+    std::atomic<int32_t> challenge_;
+    std::atomic<unsigned> requests_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    public:
+      //! Listens on an ephemeral port of 127.0.0.1; see port().
+      loopback_a2s_server(const std::string &info, const std::string &players, const std::string &rules)
+      : info_(info), players_(players), rules_(rules), challenge_(0x1234567), requests_(0), stop_(false) {
+        fd_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ == -1) common::errno_throw<common::connection_error>("socket() failed");
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd_, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+          common::errno_throw<common::connection_error>("bind() failed");
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, (struct sockaddr *) &addr, &len);
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "%d", (int) ntohs(addr.sin_port));
+        port_ = buf;
+
+        thread_ = std::thread(&loopback_a2s_server::serve, this);
+      }
+
+      ~loopback_a2s_server() {
+        stop_ = true;
+        thread_.join();
+        close(fd_);
+      }
+
+      const char *port() const { return port_.c_str(); }
+
+      //! Datagrams received so far.
+      unsigned requests() const { return requests_; }
+
+      //! Change the challenge, so that clients' cached ones go stale.
+      void rotate() { challenge_ = challenge_ + 1; }
+
+    private:
+      void serve() {
+        static const std::size_t info_size = 25;
+        char buf[64];
+        while (! stop_) {
+          struct pollfd p = {fd_, POLLIN, 0};
+          if (poll(&p, 1, 100) <= 0) continue;
+          struct sockaddr_in from;
+          socklen_t len = sizeof(from);
+          ssize_t n = recvfrom(fd_, buf, sizeof(buf), 0, (struct sockaddr *) &from, &len);
+          if (n < 5) continue;
+          ++requests_;
+
+          int32_t want = challenge_, got = 0;
+          const std::string *reply = NULL;
+          switch (buf[4]) {
+            case 0x54:
+              if (n == (ssize_t) info_size + 4) std::memcpy(&got, buf + info_size, 4);
+              reply = &info_;
+              break;
+            case 0x55:
+            case 0x56:
+              if (n == 9) std::memcpy(&got, buf + 5, 4);
+              reply = (buf[4] == 0x55) ? &players_ : &rules_;
+              break;
+            default:
+              continue;
+          }
+
+          std::string out;
+          if (got != want) {
+            out.assign("\xff\xff\xff\xff\x41", 5);
+            out.append((const char *) &want, 4);
+            reply = &out;
+          }
+          sendto(fd_, reply->data(), reply->size(), 0, (struct sockaddr *) &from, len);
+        }
+      }
+  };
+
+  /*!
+  \brief Every address in 127.0.0.0/8 on one port, answering info requests.
+
+  One socket receives for all of them, and IP_PKTINFO makes each reply come from
+  the address it was sent to, so a client sees thousands of servers.
+  */
+  class loopback_a2s_fleet {
+    int fd_;
+    uint16_t port_;
+    std::string reply_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    public:
+      //! Listens on an ephemeral port; see port().
+      loopback_a2s_fleet(const void *reply, std::size_t size)
+      : reply_((const char *) reply, size), stop_(false) {
+        fd_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ == -1) common::errno_throw<common::connection_error>("socket() failed");
+        int yes = 1;
+        setsockopt(fd_, IPPROTO_IP, IP_PKTINFO, &yes, sizeof(yes));
+        int big = 8 << 20;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(fd_, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+          common::errno_throw<common::connection_error>("bind() failed");
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, (struct sockaddr *) &addr, &len);
+        port_ = ntohs(addr.sin_port);
+
+        thread_ = std::thread(&loopback_a2s_fleet::serve, this);
+      }
+
+      ~loopback_a2s_fleet() {
+        stop_ = true;
+        thread_.join();
+        close(fd_);
+      }
+
+      uint16_t port() const { return port_; }
+
+      //! The address of server \c i, counting from 127.0.1.0.
+      static struct sockaddr_in server(std::size_t i, uint16_t port) {
+        struct sockaddr_in a;
+        std::memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl((127u << 24) + 256 + (uint32_t) i);
+        a.sin_port = htons(port);
+        return a;
+      }
+
+    private:
+      static const unsigned batch = 64;
+      static const std::size_t request_room = 64;
+
+      void serve() {
+        const std::size_t cmsg_space = CMSG_SPACE(sizeof(struct in_pktinfo));
+        std::vector<struct mmsghdr> in(batch), out(batch);
+        std::vector<struct iovec> in_iov(batch), out_iov(batch);
+        std::vector<struct sockaddr_in> from(batch);
+        std::vector<char> bufs(batch * request_room);
+        std::vector<char> control(batch * cmsg_space), out_control(batch * cmsg_space);
+
+        while (! stop_) {
+          struct pollfd p = {fd_, POLLIN, 0};
+          if (poll(&p, 1, 100) <= 0) continue;
+          for (unsigned k = 0; k < batch; ++k) {
+            in_iov[k].iov_base = &bufs[k * request_room];
+            in_iov[k].iov_len = request_room;
+            std::memset(&in[k].msg_hdr, 0, sizeof(in[k].msg_hdr));
+            in[k].msg_hdr.msg_name = &from[k];
+            in[k].msg_hdr.msg_namelen = sizeof(from[k]);
+            in[k].msg_hdr.msg_iov = &in_iov[k];
+            in[k].msg_hdr.msg_iovlen = 1;
+            in[k].msg_hdr.msg_control = &control[k * cmsg_space];
+            in[k].msg_hdr.msg_controllen = cmsg_space;
+          }
+          int n = recvmmsg(fd_, &in[0], batch, MSG_DONTWAIT, NULL);
+          if (n <= 0) continue;
+
+          unsigned replies = 0;
+          for (int k = 0; k < n; ++k) {
+            if (in[k].msg_len < 5 || bufs[k * request_room + 4] != 0x54) continue;
+            struct msghdr &m = out[replies].msg_hdr;
+            std::memset(&m, 0, sizeof(m));
+            out_iov[replies].iov_base = &reply_[0];
+            out_iov[replies].iov_len = reply_.size();
+            m.msg_name = &from[k];
+            m.msg_namelen = sizeof(from[k]);
+            m.msg_iov = &out_iov[replies];
+            m.msg_iovlen = 1;
+            // Sending the pktinfo back makes the reply come from the address asked.
+            std::memcpy(&out_control[replies * cmsg_space], &control[k * cmsg_space], cmsg_space);
+            m.msg_control = &out_control[replies * cmsg_space];
+            m.msg_controllen = in[k].msg_hdr.msg_controllen;
+            struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+            if (c && c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+              struct in_pktinfo *pi = (struct in_pktinfo *) CMSG_DATA(c);
+              pi->ipi_spec_dst = pi->ipi_addr;
+              pi->ipi_ifindex = 0;
+            }
+            ++replies;
+          }
+          if (replies) sendmmsg(fd_, &out[0], replies, 0);
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,655 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief Benchmarks for the packet code and end-to-end RCON throughput.
+
+Cases:
+- \c rcon_encode_*     -- command_base::write() into a local socket.
+- \c rcon_decode_*     -- command_base::read() of a single packet.
+- \c rcon_reassemble_* -- a multi-packet response read in the same way as command.
+- \c a2s_*_parse       -- the query classes parsing captured replies.
+- \c a2s_split_*       -- query::split_reassembler joining a reply's fragments,
+                          with no sockets.
+- \c snapshot_*        -- query::snapshot against a loopback server which insists on
+                          challenges, checking how many requests each took.
+- \c scan_*            -- one query::scanner sweep of a fleet of loopback servers,
+                          all answered from one socket on 127.0.0.0/8.
+- \c fleet_*           -- filtering and summing the columns of a query::fleet_table.
+- \c history_*         -- one server's players across every snapshot in a
+                          query::history_reader, read from the mapped file.
+- \c coalesce_*        -- common::coalescer answering from its cache, which is
+                          what every caller but the first pays.
+- \c codec_*          -- the I/O free codecs alone, with no syscalls or allocation.
+- \c e2e_rcon_*        -- complete commands against a loopback server; the mean gives
+                          commands per second and the percentiles the latency.
+- \c e2e_shared_*      -- batches of commands pipelined through rcon::shared_connection,
+                          either waited for by futures or completed on a work_pool.
+- \c priority_*        -- the latency of one interactive command sent through
+                          rcon::shared_connection behind a queue of bulk ones.
+- \c e2e_sharded_*     -- one command to each of a fleet of loopback servers through
+                          rcon::sharded_engine, with epoll and, where the kernel
+                          has it, io_uring (_uring).
+
+The rcon_* and a2s_* cases go through AF_UNIX socket pairs so they include the
+syscalls made by the library for each packet; compare them with codec_* to see
+the I/O overhead.
+
+Usage:
+  lrcon_bench [-o file.json] [-s scale] [-f filter]
+
+Human readable lines go to stderr and the JSON document to stdout, or the -o file.
+*/
+
+#include <lrcon/rcon.hpp>
+#include <lrcon/query.hpp>
+#include <lrcon/rcon_codec.hpp>
+#include <lrcon/query_codec.hpp>
+#include <lrcon/query_fleet.hpp>
+#include <lrcon/query_history.hpp>
+#include <lrcon/query_scanner.hpp>
+#include <lrcon/query_snapshot.hpp>
+#include <lrcon/query_split.hpp>
+#include <lrcon/shared_connection.hpp>
+#include <lrcon/sharded_engine.hpp>
+#include <lrcon/coalescer.hpp>
+
+#include "bench.hpp"
+#include "captured_packets.hpp"
+#include "loopback_server.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// Set by CMake from PROJECT_VERSION.
+#ifndef LRCON_VERSION
+#  define LRCON_VERSION "unknown"
+#endif
+
+namespace {
+  const char *const bench_version = LRCON_VERSION;
+
+  //! Connection over a socket we already have.
+  struct adopted_connection : public common::connection_base {
+    explicit adopted_connection(int fd) : common::connection_base(fd) {}
+  };
+
+  //! Exposes the protected packet code.
+  struct bench_packet : public rcon::command_base {
+    //! Encodes and sends the packet.
+    bench_packet(common::connection_base &c, const std::string &payload)
+    : rcon::command_base(c, rcon::command::default_request_id, command_base::exec_request, payload) {}
+
+    void encode(int socket) { write(socket); }
+
+    void decode_one(int socket) {
+      payload_.clear();
+      read(socket, true);
+    }
+
+    //! Same read strategy as rcon::command.
+    void decode_all(int socket) {
+      payload_.clear();
+      bool first = true;
+      read_result r;
+      do {
+        r = read(socket, first);
+        first = false;
+      } while (r == read_again);
+    }
+
+    static std::size_t full_packet_size() { return max_packet_size; }
+  };
+
+  //! A socket pair which is closed on destruction.
+  struct socket_pair {
+    int fds[2];
+
+    explicit socket_pair(int type) {
+      if (socketpair(AF_UNIX, type, 0, fds) == -1) {
+        common::errno_throw<common::connection_error>("socketpair() failed");
+      }
+    }
+
+    ~socket_pair() {
+      if (fds[0] != -1) close(fds[0]);
+      if (fds[1] != -1) close(fds[1]);
+    }
+
+    //! Pass the first socket to a connection object.
+    int release_first() { int f = fds[0]; fds[0] = -1; return f; }
+  };
+
+  void send_all(int fd, const void *buf, std::size_t sz) {
+    if (send(fd, (const char *) buf, sz, 0) != (ssize_t) sz) {
+      common::errno_throw<common::send_error>("send() to the benchmark socket failed");
+    }
+  }
+
+  //! Discard everything from fd until it is shut down.
+  void drain(int fd) {
+    char buf[16384];
+    while (recv(fd, buf, sizeof(buf), 0) > 0) {}
+  }
+
+  //! Discard any datagrams or packets waiting on fd without blocking.
+  void drain_pending(int fd) {
+    char buf[16384];
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+  }
+
+  void bench_rcon_encode(bench::runner &r, const std::string &name, std::size_t payload_size) {
+    if (! r.enabled(name)) return;
+
+    socket_pair sp(SOCK_STREAM);
+    int peer = sp.fds[1];
+    std::thread drainer(drain, peer);
+    {
+      adopted_connection conn(sp.release_first());
+      bench_packet p(conn, std::string(payload_size, 'a'));
+      int fd = conn.socket();
+      r.run(name, 200000, [&]() { p.encode(fd); }, payload_size + 14);
+      shutdown(fd, SHUT_RDWR);
+    }
+    drainer.join();
+  }
+
+  void bench_rcon_decode(bench::runner &r, const std::string &name, std::size_t payload_size) {
+    if (! r.enabled(name)) return;
+
+    socket_pair sp(SOCK_STREAM);
+    int peer = sp.fds[1];
+    adopted_connection conn(sp.release_first());
+    bench_packet p(conn, "status");
+    drain_pending(peer);
+
+    std::string pkt;
+    bench::append_rcon_packet(pkt, rcon::command::default_request_id, 0, std::string(payload_size, 'b'));
+    int fd = conn.socket();
+    r.run(name, 200000, [&]() {
+      send_all(peer, pkt.data(), pkt.size());
+      p.decode_one(fd);
+    }, pkt.size());
+  }
+
+  void bench_rcon_reassemble(bench::runner &r, const std::string &name, std::size_t full_packets) {
+    if (! r.enabled(name)) return;
+
+    socket_pair sp(SOCK_STREAM);
+    int peer = sp.fds[1];
+    adopted_connection conn(sp.release_first());
+    bench_packet p(conn, "cvarlist");
+    drain_pending(peer);
+
+    // Strings sized so the packet is exactly full, which means "more data follows".
+    std::size_t half = (bench_packet::full_packet_size() - 12) / 2;
+    std::string full, last;
+    bench::append_rcon_packet(full, rcon::command::default_request_id, 0, std::string(half - 2, 'c'), std::string(half, 'c'));
+    bench::append_rcon_packet(last, rcon::command::default_request_id, 0, std::string(100, 'd'));
+    assert(full.size() == bench_packet::full_packet_size());
+
+    int fd = conn.socket();
+    r.run(name, 20000, [&]() {
+      for (std::size_t i = 0; i < full_packets; ++i) send_all(peer, full.data(), full.size());
+      send_all(peer, last.data(), last.size());
+      p.decode_all(fd);
+    }, full.size() * full_packets + last.size());
+  }
+
+  //! Runs query type Q where the server sends the given replies, in order.
+  template <typename Q>
+  void bench_a2s(bench::runner &r, const std::string &name,
+                 const unsigned char *reply, std::size_t reply_size,
+                 const unsigned char *challenge = NULL, std::size_t challenge_size = 0) {
+    if (! r.enabled(name)) return;
+
+    socket_pair sp(SOCK_DGRAM);
+    int peer = sp.fds[1];
+    adopted_connection conn(sp.release_first());
+    r.run(name, 100000, [&]() {
+      if (challenge) send_all(peer, challenge, challenge_size);
+      send_all(peer, reply, reply_size);
+      Q q(conn);
+      drain_pending(peer);
+    }, reply_size);
+  }
+
+  void bench_codec_rcon_encode(bench::runner &r, const std::string &name, std::size_t payload_size) {
+    if (! r.enabled(name)) return;
+
+    std::string payload(payload_size, 'a');
+    char buf[rcon::codec::max_packet_size];
+    r.run(name, 2000000, [&]() {
+      std::size_t n = rcon::codec::encode(buf, sizeof(buf), 42, 2, payload);
+      bench::do_not_optimise(n);
+    }, payload_size + 14);
+  }
+
+  void bench_codec_rcon_decode(bench::runner &r, const std::string &name, std::size_t payload_size) {
+    if (! r.enabled(name)) return;
+
+    std::string pkt;
+    bench::append_rcon_packet(pkt, 42, 0, std::string(payload_size, 'b'));
+    r.run(name, 2000000, [&]() {
+      rcon::codec::packet_view p;
+      std::size_t need;
+      if (rcon::codec::decode(pkt.data(), pkt.size(), p, need) != common::codec::decode_ok) {
+        throw common::response_error("captured rcon packet did not decode");
+      }
+      bench::do_not_optimise(p.body.length());
+    }, pkt.size());
+  }
+
+  void bench_codec_a2s(bench::runner &r) {
+    using namespace captured;
+    if (r.enabled("codec_a2s_info")) {
+      r.run("codec_a2s_info", 2000000, [&]() {
+        query::codec::info_view v;
+        query::codec::decode_info(a2s_info_reply, sizeof(a2s_info_reply), v);
+        bench::do_not_optimise(v.players);
+      }, sizeof(a2s_info_reply));
+    }
+    // What a fleet scan for player counts reads.
+    if (r.enabled("codec_a2s_info_players_only")) {
+      r.run("codec_a2s_info_players_only", 2000000, [&]() {
+        query::codec::info_reader v;
+        v.open(a2s_info_reply, sizeof(a2s_info_reply));
+        bench::do_not_optimise(v.players());
+      }, sizeof(a2s_info_reply));
+    }
+    if (r.enabled("codec_a2s_players")) {
+      r.run("codec_a2s_players", 1000000, [&]() {
+        query::codec::player_cursor c;
+        query::codec::decode_players(a2s_players_reply, sizeof(a2s_players_reply), c);
+        query::codec::player_view p;
+        int32_t total = 0;
+        while (c.next(p)) total += p.score;
+        bench::do_not_optimise(total);
+      }, sizeof(a2s_players_reply));
+    }
+    if (r.enabled("codec_a2s_rules")) {
+      r.run("codec_a2s_rules", 1000000, [&]() {
+        query::codec::rule_cursor c;
+        query::codec::decode_rules(a2s_rules_reply, sizeof(a2s_rules_reply), c);
+        query::codec::rule_view rule;
+        std::size_t total = 0;
+        while (c.next(rule)) total += rule.value.length();
+        bench::do_not_optimise(total);
+      }, sizeof(a2s_rules_reply));
+    }
+    if (r.enabled("codec_a2s_rules_map")) {
+      // The map is reused, as query::rules_watch does, so its memory is kept.
+      query::rule_map map;
+      r.run("codec_a2s_rules_map", 1000000, [&]() {
+        query::codec::rule_cursor c;
+        query::codec::decode_rules(a2s_rules_reply, sizeof(a2s_rules_reply), c);
+        map.clear();
+        map.reserve(c.count(), sizeof(a2s_rules_reply));
+        query::codec::rule_view rule;
+        while (c.next(rule)) map.set(rule.key, rule.value);
+        bench::do_not_optimise(map.get("sv_gravity").length());
+      }, sizeof(a2s_rules_reply));
+    }
+  }
+
+  //! A Source split reply of \c fragments full datagrams, fed in reverse order.
+  void bench_a2s_split(bench::runner &r, const std::string &name, std::size_t fragments) {
+    if (! r.enabled(name)) return;
+
+    const std::size_t chunk = 1248;
+    std::string reply("\xFF\xFF\xFF\xFF" "E", 5);
+    reply.append(fragments * chunk - reply.size(), 'r');
+    std::vector<std::string> dgrams;
+    for (std::size_t i = 0; i < fragments; ++i) {
+      std::string d("\xFE\xFF\xFF\xFF" "\x2A\x00\x00\x00", 8);
+      d += (char) fragments;
+      d += (char) i;
+      d += (char) (chunk & 0xFF);
+      d += (char) (chunk >> 8);
+      d += reply.substr(i * chunk, chunk);
+      dgrams.push_back(d);
+    }
+    query::split_reassembler split;
+    r.run(name, 200000, [&]() {
+      std::string_view whole;
+      for (std::size_t i = fragments; i-- > 0; ) split.add(dgrams[i].data(), dgrams[i].size(), 0, whole);
+      bench::do_not_optimise(whole.size());
+    }, reply.size());
+  }
+
+  //! Throw unless the last query took \c requests requests in \c rounds rounds.
+  void expect_requests(const char *what, unsigned requests, unsigned expected, unsigned rounds, unsigned expected_rounds) {
+    if (requests == expected && rounds == expected_rounds) return;
+    std::string m(what);
+    m += ": " + std::to_string(requests) + " requests in " + std::to_string(rounds) + " rounds, expected "
+       + std::to_string(expected) + " in " + std::to_string(expected_rounds);
+    throw common::response_error(m);
+  }
+
+  /*!
+  \brief query::snapshot with a warm challenge_cache, after checking the request counts.
+
+  A cold cache takes two rounds of three requests.  A warm one takes one round.  A
+  stale one takes two rounds again.  players and rules with a warm cache take one
+  request each.
+  */
+  void bench_snapshot(bench::runner &r, const std::string &name) {
+    if (! r.enabled(name)) return;
+
+    using namespace captured;
+    bench::loopback_a2s_server server(std::string((const char *) a2s_info_reply, sizeof(a2s_info_reply)),
+                                      std::string((const char *) a2s_players_reply, sizeof(a2s_players_reply)),
+                                      std::string((const char *) a2s_rules_reply, sizeof(a2s_rules_reply)));
+    query::connection conn(query::host("127.0.0.1", server.port(), true));
+    query::challenge_cache cache;
+
+    unsigned before = server.requests();
+    {
+      query::snapshot s(conn, cache);
+      expect_requests("cold snapshot", server.requests() - before, 6, s.rounds(), 2);
+    }
+    before = server.requests();
+    {
+      query::snapshot s(conn, cache);
+      expect_requests("warm snapshot", server.requests() - before, 3, s.rounds(), 1);
+    }
+    server.rotate();
+    before = server.requests();
+    {
+      query::snapshot s(conn, cache);
+      expect_requests("stale snapshot", server.requests() - before, 6, s.rounds(), 2);
+    }
+    before = server.requests();
+    {
+      query::players p(conn, cache);
+      query::rules ru(conn, cache);
+      expect_requests("warm players and rules", server.requests() - before, 2, 1, 1);
+    }
+
+    std::size_t bytes = sizeof(a2s_info_reply) + sizeof(a2s_players_reply) + sizeof(a2s_rules_reply);
+    r.run(name, 5000, [&]() {
+      query::snapshot s(conn, cache);
+      if (s.rounds() != 1) throw common::response_error("a warm snapshot took more than one round");
+    }, bytes);
+  }
+
+  //! One sweep of a loopback fleet with query::scanner.
+  void bench_scan(bench::runner &r, const std::string &name, std::size_t servers) {
+    if (! r.enabled(name)) return;
+
+    using namespace captured;
+    bench::loopback_a2s_fleet fleet(a2s_info_reply, sizeof(a2s_info_reply));
+    query::scanner scan;
+    scan.reserve(servers);
+    for (std::size_t i = 0; i < servers; ++i) scan.add(bench::loopback_a2s_fleet::server(i, fleet.port()));
+    r.run(name, 20, [&]() {
+      scan.run().check();
+      if (scan.replied() != servers) throw common::response_error("loopback servers did not all reply");
+    }, sizeof(a2s_info_reply) * servers);
+  }
+
+  //! An info reply on \c map with \c players of 32.
+  std::string synthetic_info(const char *map, uint8_t players) {
+    std::string r("\xff\xff\xff\xffI\x11" "bench server", 18);
+    r += '\0';
+    r += map;
+    r += '\0';
+    r += std::string("cstrike\0Counter-Strike: Source\0\xf0\x00", 33);
+    r += (char) players;
+    r += std::string("\x20\x00" "dl\x00\x01" "1.0.0.0", 13);
+    r += '\0';
+    return r;
+  }
+
+  //! query::fleet_table::select() over a fleet of \c servers, one map in four and 21+ players.
+  void bench_fleet(bench::runner &r, const std::string &name, std::size_t servers) {
+    if (! r.enabled(name)) return;
+
+    const char *maps[] = {"de_dust2", "de_nuke", "cs_office", "de_inferno"};
+    query::fleet_table fleet;
+    fleet.reserve(servers);
+    for (std::size_t i = 0; i < servers; ++i) {
+      std::string reply = synthetic_info(maps[(i * 7) % 4], (uint8_t) ((i * 13) % 33));
+      query::codec::info_reader info;
+      info.open(reply.data(), reply.size());
+      fleet.add(bench::loopback_a2s_fleet::server(i, 27015), info, 1000000 + i);
+    }
+    query::fleet_table::filter f;
+    f.map = fleet.maps().find("de_dust2");
+    f.min_players = 21;
+    std::vector<uint32_t> rows;
+    r.run(name, 2000, [&]() {
+      fleet.select(f, rows);
+      bench::do_not_optimise(fleet.sum_players(rows));
+    }, servers);
+  }
+
+  //! \c frames snapshots of \c servers each, then one server looked up in all of them.
+  void bench_history(bench::runner &r, const std::string &name, std::size_t frames, std::size_t servers) {
+    if (! r.enabled(name)) return;
+
+    char path[] = "/tmp/lrcon_bench_history_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) throw common::error("mkstemp() failed");
+    close(fd);
+    unlink(path);
+    {
+      const char *maps[] = {"de_dust2", "de_nuke", "cs_office", "de_inferno"};
+      query::history_writer w(path);
+      query::fleet_table fleet;
+      for (std::size_t t = 0; t < frames; ++t) {
+        fleet.clear();
+        for (std::size_t i = 0; i < servers; ++i) {
+          std::string reply = synthetic_info(maps[(i + t) % 4], (uint8_t) ((i * 13 + t) % 33));
+          query::codec::info_reader info;
+          info.open(reply.data(), reply.size());
+          fleet.add(bench::loopback_a2s_fleet::server(i, 27015), info, 1000000 + i);
+        }
+        w.append(fleet, 1000000000ULL * (t + 1)).check();
+      }
+    }
+
+    query::history_reader h(path);
+    struct sockaddr_in server = bench::loopback_a2s_fleet::server(servers / 2, 27015);
+    r.run(name, 200, [&]() {
+      uint64_t sum = 0;
+      query::history_frame f;
+      query::history_reader::cursor c = h.all();
+      while (c.next(f)) {
+        std::size_t row = f.find(server);
+        if (row != query::history_frame::npos) sum += f.players()[row];
+      }
+      bench::do_not_optimise(sum);
+    }, frames);
+    unlink(path);
+    unlink((std::string(path) + ".idx").c_str());
+  }
+
+  //! common::coalescer::run() for a key whose value is cached.
+  void bench_coalesce(bench::runner &r, const std::string &name, std::size_t reply_size) {
+    if (! r.enabled(name)) return;
+
+    std::string reply(reply_size, 'a');
+    common::coalescer<std::shared_ptr<const std::string> > cache(60 * 1000);
+    std::shared_ptr<const std::string> value(new std::string(reply));
+    std::string key = common::request_key("10.0.0.5", "27015", "status");
+    r.run(name, 1000000, [&]() {
+      bench::do_not_optimise(cache.run(key, [&]() { return value; })->size());
+    }, reply_size);
+  }
+
+  void bench_e2e(bench::runner &r, const std::string &name, std::size_t reply_size) {
+    if (! r.enabled(name)) return;
+
+    bench::loopback_rcon_server server("benchpass", reply_size);
+    rcon::connection conn(rcon::host("127.0.0.1", server.port(), true), "benchpass");
+    r.run(name, 1000, [&]() { rcon::command c(conn, "status"); }, reply_size);
+  }
+
+  void bench_e2e_shared(bench::runner &r, const std::string &name, std::size_t reply_size, std::size_t batch) {
+    if (! r.enabled(name)) return;
+
+    bench::loopback_rcon_server server("benchpass", reply_size);
+    rcon::shared_connection conn(rcon::host("127.0.0.1", server.port(), true), "benchpass");
+    std::vector<std::future<std::string> > replies(batch);
+    r.run(name, 1000, [&]() {
+      for (std::size_t i = 0; i < batch; ++i) replies[i] = conn.submit("status");
+      for (std::size_t i = 0; i < batch; ++i) replies[i].get();
+    }, reply_size * batch);
+  }
+
+  /*!
+  \brief One interactive command behind \c bulk bulk ones, each taking the server \c delay_us.
+
+  Only the interactive command is timed.  It should overtake all but the bulk
+  commands already on the wire, so it fails if every bulk command finished first.
+  */
+  void bench_priority(bench::runner &r, const std::string &name, std::size_t bulk, int delay_us) {
+    if (! r.enabled(name)) return;
+
+    bench::loopback_rcon_server server("benchpass", 64, delay_us);
+    rcon::shared_connection conn(rcon::host("127.0.0.1", server.port(), true), "benchpass");
+    std::vector<std::future<std::string> > replies(bulk);
+    std::vector<double> samples;
+    for (std::size_t it = 0; it < 20; ++it) {
+      for (std::size_t i = 0; i < bulk; ++i) replies[i] = conn.submit("cvarlist", common::priority_bulk);
+      uint64_t start = common::metrics::now_ns();
+      conn.submit("status").get();
+      samples.push_back((double) (common::metrics::now_ns() - start));
+
+      std::size_t overtaken = 0;
+      for (std::size_t i = 0; i < bulk; ++i) {
+        if (replies[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready) ++overtaken;
+      }
+      if (overtaken == 0) throw common::response_error("the interactive command waited for every bulk one");
+      for (std::size_t i = 0; i < bulk; ++i) replies[i].get();
+    }
+    r.add(bench::summarise(name, samples, 64));
+  }
+
+  void bench_e2e_pool(bench::runner &r, const std::string &name, std::size_t reply_size, std::size_t batch) {
+    if (! r.enabled(name)) return;
+
+    bench::loopback_rcon_server server("benchpass", reply_size);
+    common::work_pool pool;
+    rcon::shared_connection conn(rcon::host("127.0.0.1", server.port(), true), "benchpass",
+                                 rcon::shared_connection::default_timeout_ms, &pool);
+    std::atomic<std::size_t> done(0);
+    r.run(name, 1000, [&]() {
+      done.store(0);
+      for (std::size_t i = 0; i < batch; ++i) {
+        conn.submit("status", [&](common::result<std::string> &reply) {
+          if (reply.ok()) bench::do_not_optimise(reply.value().length());
+          done.fetch_add(1);
+        });
+      }
+      while (done.load() != batch) std::this_thread::yield();
+    }, reply_size * batch);
+  }
+
+  void bench_e2e_sharded(bench::runner &r, const std::string &name, std::size_t reply_size, std::size_t servers,
+                         rcon::sharded_engine::backend_t backend = rcon::sharded_engine::backend_epoll) {
+    if (! r.enabled(name)) return;
+
+    std::vector<std::unique_ptr<bench::loopback_rcon_server> > fleet;
+    std::vector<rcon::endpoint> endpoints;
+    for (std::size_t i = 0; i < servers; ++i) {
+      fleet.push_back(std::unique_ptr<bench::loopback_rcon_server>(new bench::loopback_rcon_server("benchpass", reply_size)));
+      endpoints.push_back(rcon::endpoint("127.0.0.1", fleet.back()->port(), "benchpass", true));
+    }
+
+    rcon::sharded_engine engine(0, rcon::sharded_engine::default_timeout_ms, NULL, backend);
+    // Without io_uring this would only repeat the epoll case.
+    if (engine.backend() != backend) return;
+    std::vector<std::future<std::string> > replies(servers);
+    r.run(name, 1000, [&]() {
+      for (std::size_t i = 0; i < servers; ++i) replies[i] = engine.submit(endpoints[i], "status");
+      for (std::size_t i = 0; i < servers; ++i) replies[i].get();
+    }, reply_size * servers);
+  }
+
+  void print_usage(const char *pname) {
+    std::cerr << pname << " [-o file.json] [-s scale] [-f filter]\n"
+                 "  -o  write the JSON results here instead of stdout\n"
+                 "  -s  multiply the iteration counts by this (default: 1.0)\n"
+                 "  -f  only run cases whose name contains this\n"
+              << std::flush;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  const char *filter = "";
+  double scale = 1.0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    }
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      scale = std::atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    }
+    else {
+      print_usage(argv[0]);
+      return (strcmp(argv[i], "-h") == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  bench::runner r(filter, scale);
+  try {
+    bench_rcon_encode(r, "rcon_encode_small", 6);
+    bench_rcon_encode(r, "rcon_encode_4k", 4000);
+    bench_rcon_decode(r, "rcon_decode_small", 64);
+    bench_rcon_decode(r, "rcon_decode_4k", 4000);
+    bench_rcon_reassemble(r, "rcon_reassemble_4", 3);
+
+    using namespace captured;
+    bench_a2s<query::info>(r, "a2s_info_parse", a2s_info_reply, sizeof(a2s_info_reply));
+    bench_a2s<query::challenge>(r, "a2s_challenge_parse", a2s_challenge_reply, sizeof(a2s_challenge_reply));
+    bench_a2s<query::players>(r, "a2s_players_parse", a2s_players_reply, sizeof(a2s_players_reply),
+                              a2s_challenge_reply, sizeof(a2s_challenge_reply));
+    bench_a2s<query::rules>(r, "a2s_rules_parse", a2s_rules_reply, sizeof(a2s_rules_reply),
+                            a2s_challenge_reply, sizeof(a2s_challenge_reply));
+
+    bench_codec_rcon_encode(r, "codec_rcon_encode_small", 6);
+    bench_codec_rcon_encode(r, "codec_rcon_encode_4k", 4000);
+    bench_codec_rcon_decode(r, "codec_rcon_decode_small", 64);
+    bench_codec_rcon_decode(r, "codec_rcon_decode_4k", 4000);
+    bench_codec_a2s(r);
+    bench_a2s_split(r, "a2s_split_reassemble_8", 8);
+    bench_snapshot(r, "snapshot_a2s_warm");
+    bench_scan(r, "scan_a2s_info_20000", 20000);
+    bench_fleet(r, "fleet_select_100000", 100000);
+    bench_history(r, "history_lookup_1000x1000", 1000, 1000);
+    bench_coalesce(r, "coalesce_cached_hit", 4000);
+
+    bench_e2e(r, "e2e_rcon_command_small", 64);
+    bench_e2e(r, "e2e_rcon_command_4k", 4000);
+    bench_e2e_shared(r, "e2e_shared_rcon_pipelined_16", 64, 16);
+    bench_e2e_pool(r, "e2e_shared_rcon_pool_16", 4000, 16);
+    bench_priority(r, "priority_interactive_behind_500_bulk", 500, 200);
+    bench_e2e_sharded(r, "e2e_sharded_rcon_fleet_16", 64, 16);
+    bench_e2e_sharded(r, "e2e_sharded_rcon_fleet_16_uring", 64, 16, rcon::sharded_engine::backend_io_uring);
+  }
+  catch (common::error &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::FILE *out = stdout;
+  if (output) {
+    out = std::fopen(output, "w");
+    if (! out) {
+      std::perror(output);
+      return EXIT_FAILURE;
+    }
+  }
+  r.write_json(out, bench_version);
+  if (out != stdout) std::fclose(out);
+
+  return EXIT_SUCCESS;
+}
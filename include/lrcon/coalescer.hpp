@@ -0,0 +1,173 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Single-flight and short-lived caching of identical requests.
+
+\code
+common::coalescer<std::string> status_cache(200); // 200ms
+
+// From many threads at once; only one of them talks to the server.
+std::string out = status_cache.run(common::request_key("10.0.0.5", "27015", "status"), [&]() {
+  rcon::connection conn(rcon::host("10.0.0.5", "27015", true), password);
+  return rcon::command(conn, "status").data();
+});
+\endcode
+*/
+
+#ifndef COALESCER_HPP_p4e8s6yv
+#define COALESCER_HPP_p4e8s6yv
+
+#include <lrcon/metrics.hpp>
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace common {
+  //! Key for a coalescer: the endpoint and the request text.
+  inline std::string request_key(const std::string &address, const std::string &port, const std::string &request) {
+    std::string k;
+    k.reserve(address.length() + port.length() + request.length() + 2);
+    k += address;
+    k += ':';
+    k += port;
+    // Not a valid character in a command, so no two requests share a key.
+    k += '\0';
+    k += request;
+    return k;
+  }
+
+  /*!
+  \brief Shares one fetch between everyone who asks for the same key at once.
+
+  The first caller for a key runs the fetch on its own thread.  Callers who ask
+  while it is running wait for it and get the same value or exception.  A
+  successful value is then kept for the TTL and handed straight to anyone else who
+  asks for it; use a TTL of 0 to only coalesce.  Errors are never cached.
+
+  Only cache replies to commands without side effects.  Each call may give its own
+  TTL for that reason.
+  */
+  template <typename V>
+  class coalescer {
+    public:
+      //! \param ttl_ms  default time a value is kept.
+      explicit coalescer(int ttl_ms = 100) : ttl_ns_((uint64_t) ttl_ms * 1000000), sweep_at_(64) {}
+
+      //! Get the value for \c key, calling \c fetch only if no one else is.
+      template <typename F>
+      V run(const std::string &key, F fetch) {
+        return run(key, fetch, ttl_ns_);
+      }
+
+      //! \copydoc run(const std::string &, F)
+      //! \param ttl_ns  how long to keep this value; 0 to not keep it.
+      template <typename F>
+      V run(const std::string &key, F fetch, uint64_t ttl_ns) {
+        std::shared_ptr<flight> f;
+        bool leader = false;
+        {
+          std::lock_guard<std::mutex> l(mutex_);
+          uint64_t now = metrics::now_ns();
+          typename cache_map::iterator c = cache_.find(key);
+          if (c != cache_.end()) {
+            if (c->second.expires_ns > now) return c->second.value;
+            cache_.erase(c);
+          }
+
+          typename flight_map::iterator i = in_flight_.find(key);
+          if (i != in_flight_.end()) {
+            f = i->second;
+          }
+          else {
+            f.reset(new flight());
+            f->result = f->promise.get_future().share();
+            in_flight_[key] = f;
+            leader = true;
+          }
+        }
+
+        // Someone else is fetching it.
+        if (! leader) return f->result.get();
+
+        try {
+          V v = fetch();
+          std::lock_guard<std::mutex> l(mutex_);
+          if (land(key, f) && ttl_ns) store(key, v, metrics::now_ns() + ttl_ns);
+          f->promise.set_value(v);
+          return v;
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> l(mutex_);
+          land(key, f);
+          f->promise.set_exception(std::current_exception());
+          throw;
+        }
+      }
+
+      /*!
+      \brief Drop a cached value, eg after a command which changes it.
+
+      A fetch already running may have read the old value, so its result still goes
+      to those waiting for it but is not kept, and later callers fetch again.
+      */
+      void invalidate(const std::string &key) {
+        std::lock_guard<std::mutex> l(mutex_);
+        cache_.erase(key);
+        in_flight_.erase(key);
+      }
+
+    private:
+      struct flight {
+        std::promise<V> promise;
+        std::shared_future<V> result;
+      };
+
+      struct cached {
+        V value;
+        uint64_t expires_ns;
+      };
+
+      typedef std::unordered_map<std::string, std::shared_ptr<flight> > flight_map;
+      typedef std::unordered_map<std::string, cached> cache_map;
+
+      uint64_t ttl_ns_;
+      std::mutex mutex_;
+      flight_map in_flight_;
+      cache_map cache_;
+      //! Expired entries are swept out when the cache grows to this.
+      std::size_t sweep_at_;
+
+      //! The flight \c f for \c key is over.  Caller holds mutex_.  \returns false if it was invalidated.
+      bool land(const std::string &key, const std::shared_ptr<flight> &f) {
+        typename flight_map::iterator i = in_flight_.find(key);
+        if (i == in_flight_.end() || i->second != f) return false;
+        in_flight_.erase(i);
+        return true;
+      }
+
+      //! Caller holds mutex_.
+      void store(const std::string &key, const V &v, uint64_t expires_ns) {
+        cached &c = cache_[key];
+        c.value = v;
+        c.expires_ns = expires_ns;
+
+        if (cache_.size() < sweep_at_) return;
+        uint64_t now = metrics::now_ns();
+        for (typename cache_map::iterator i = cache_.begin(); i != cache_.end(); ) {
+          if (i->second.expires_ns <= now) i = cache_.erase(i);
+          else ++i;
+        }
+        sweep_at_ = cache_.size() * 2 + 64;
+      }
+
+      coalescer(const coalescer &);
+      coalescer &operator=(const coalescer &);
+  };
+}
+
+#endif
@@ -0,0 +1,439 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Building blocks for the packet codecs.
+
+The codecs in \link rcon_codec.hpp \endlink and \link query_codec.hpp \endlink never
+touch a socket or the heap: encoders write into a buffer given by the caller and
+decoders return views which point into the buffer they were given.  This lets
+anything which can produce bytes -- a blocking socket, an event loop or a file of
+captured packets -- drive them.
+
+Decoders return a \link common::codec::decode_t decode_t \endlink.  When it is
+\c decode_need_more the caller should supply a longer buffer (at least the number of
+bytes reported, when the decoder can tell) and call again.
+*/
+
+#ifndef CODEC_HPP_m4c8vz2e
+#define CODEC_HPP_m4c8vz2e
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace common {
+  //! I/O free encoding and decoding helpers; see \link codec.hpp \endlink.
+  namespace codec {
+    //! Result of a decode.
+    typedef enum {
+      //! The output is valid.
+      decode_ok,
+      //! The buffer ended before the packet did.
+      decode_need_more,
+      //! The bytes can never be a valid packet.
+      decode_invalid
+    } decode_t;
+
+    //! \name Byte order
+    //! Fixed size fields are copied with memcpy and swapped with the compiler's
+    //! byte swap builtins on big endian hosts, so each is a single load or store.
+    //@{
+    inline uint8_t byte_swap(uint8_t v) { return v; }
+    inline uint16_t byte_swap(uint16_t v) { return __builtin_bswap16(v); }
+    inline uint32_t byte_swap(uint32_t v) { return __builtin_bswap32(v); }
+    inline uint64_t byte_swap(uint64_t v) { return __builtin_bswap64(v); }
+
+    //! Unsigned integer of the same size as T, used to swap it.
+    template <typename T>
+    struct bits_of {
+      typedef typename std::conditional<sizeof(T) == 1, uint8_t,
+              typename std::conditional<sizeof(T) == 2, uint16_t,
+              typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type type;
+    };
+
+    //! Load a little endian value (integers and float).
+    template <typename T>
+    inline T load_le(const unsigned char *p) {
+      typename bits_of<T>::type b;
+      std::memcpy(&b, p, sizeof(b));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      b = byte_swap(b);
+#endif
+      T v;
+      std::memcpy(&v, &b, sizeof(v));
+      return v;
+    }
+
+    //! Store a little endian value.
+    template <typename T>
+    inline void store_le(unsigned char *p, T v) {
+      typename bits_of<T>::type b;
+      std::memcpy(&b, &v, sizeof(b));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      b = byte_swap(b);
+#endif
+      std::memcpy(p, &b, sizeof(b));
+    }
+    //@}
+
+    /*!
+    \brief The CRC-32 of zip and PNG.
+
+    Pass the result back as \c crc to carry on over more bytes.
+    */
+    inline uint32_t crc32(const void *data, std::size_t n, uint32_t crc = 0) {
+      struct table {
+        uint32_t t[256];
+        table() {
+          for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+          }
+        }
+      };
+      static const table crc_table;
+      const unsigned char *p = (const unsigned char *) data;
+      uint32_t c = crc ^ 0xFFFFFFFFu;
+      for (std::size_t i = 0; i < n; ++i) c = crc_table.t[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+      return c ^ 0xFFFFFFFFu;
+    }
+
+    /*!
+    \brief Bounds checked cursor over a received buffer.
+
+    Reading past the end does not fail straight away: the reader is marked short and
+    returns zeros or empty strings, so a decoder can read every field and check
+    status() once at the end.
+    */
+    class reader {
+      const unsigned char *pos_;
+      const unsigned char *end_;
+      decode_t status_;
+
+      public:
+        reader(const void *buf, std::size_t len)
+        : pos_((const unsigned char *) buf), end_((const unsigned char *) buf + len), status_(decode_ok) {}
+
+        //! decode_ok unless a read went past the end.
+        decode_t status() const { return status_; }
+        bool ok() const { return status_ == decode_ok; }
+
+        std::size_t remaining() const { return end_ - pos_; }
+        const unsigned char *position() const { return pos_; }
+
+        //! A fixed size little endian field.
+        template <typename T>
+        T get() {
+          if (remaining() < sizeof(T)) {
+            short_read();
+            return T();
+          }
+          T v = load_le<T>(pos_);
+          pos_ += sizeof(T);
+          return v;
+        }
+
+        //! A null-terminated string.  The view does not include the null.
+        std::string_view cstring() {
+          const void *nul = std::memchr(pos_, '\0', remaining());
+          if (nul == NULL) {
+            short_read();
+            return std::string_view();
+          }
+          std::string_view s((const char *) pos_, (const unsigned char *) nul - pos_);
+          pos_ += s.length() + 1;
+          return s;
+        }
+
+        void skip(std::size_t n) {
+          if (remaining() < n) {
+            short_read();
+            return;
+          }
+          pos_ += n;
+        }
+
+        //! Mark the data as invalid; it sticks.
+        void invalid() { status_ = decode_invalid; }
+
+      private:
+        void short_read() {
+          if (status_ == decode_ok) status_ = decode_need_more;
+          pos_ = end_;
+        }
+    };
+
+    /*!
+    \brief Bounds checked cursor over a buffer being encoded.
+
+    Like the reader, overflow is sticky and checked once with ok().
+    */
+    class writer {
+      unsigned char *start_;
+      unsigned char *pos_;
+      unsigned char *end_;
+      bool ok_;
+
+      public:
+        writer(void *buf, std::size_t cap)
+        : start_((unsigned char *) buf), pos_(start_), end_(start_ + cap), ok_(true) {}
+
+        bool ok() const { return ok_; }
+        std::size_t written() const { return pos_ - start_; }
+
+        template <typename T>
+        void put(T v) {
+          if (! reserve(sizeof(T))) return;
+          store_le<T>(pos_, v);
+          pos_ += sizeof(T);
+        }
+
+        void bytes(const void *src, std::size_t n) {
+          if (! reserve(n)) return;
+          std::memcpy(pos_, src, n);
+          pos_ += n;
+        }
+
+        //! Write the string and a terminating null.
+        void cstring(std::string_view s) {
+          if (! reserve(s.length() + 1)) return;
+          std::memcpy(pos_, s.data(), s.length());
+          pos_ += s.length();
+          *pos_++ = '\0';
+        }
+
+      private:
+        bool reserve(std::size_t n) {
+          if (! ok_ || (std::size_t) (end_ - pos_) < n) {
+            ok_ = false;
+            return false;
+          }
+          return true;
+        }
+    };
+
+    /*!
+    \name Packet layouts
+
+    A packet is declared once as a list of fields and the encoder and decoder are
+    generated from it:
+
+    \code
+    struct challenge_fields { int32_t challenge; };
+    typedef layout<constant<int32_t, -1>,
+                   constant<uint8_t, 0x41>,
+                   field<&challenge_fields::challenge> > challenge_layout;
+
+    challenge_fields f;
+    decode_t d = challenge_layout::decode(buf, len, f);
+    std::size_t n = challenge_layout::encode(out, cap, f);
+    \endcode
+
+    Integer, float, char and bool members are little endian fixed size fields and
+    std::string_view members are null-terminated strings.  The minimum size of the
+    whole packet is a compile time constant which is checked once; fixed size fields
+    are then loaded without further checks.  Only a string, whose length is not
+    known in advance, causes the minimum size of the remaining fields to be checked
+    again.
+    */
+    //@{
+
+    //! How a member type is represented on the wire.
+    template <typename T, typename Enable = void>
+    struct wire {
+      static_assert(std::is_arithmetic<T>::value, "no wire representation for this type");
+      static const bool is_fixed = true;
+      static const std::size_t min_size = sizeof(T);
+
+      static decode_t load(const unsigned char *&p, const unsigned char *, T &v) {
+        v = load_le<T>(p);
+        p += sizeof(T);
+        return decode_ok;
+      }
+      static std::size_t size(const T &) { return sizeof(T); }
+      static void store(unsigned char *&p, const T &v) {
+        store_le<T>(p, v);
+        p += sizeof(T);
+      }
+    };
+
+    //! A single byte which is 1 for true.
+    template <>
+    struct wire<bool> {
+      static const bool is_fixed = true;
+      static const std::size_t min_size = 1;
+
+      static decode_t load(const unsigned char *&p, const unsigned char *, bool &v) {
+        v = *p++ == 1;
+        return decode_ok;
+      }
+      static std::size_t size(const bool &) { return 1; }
+      static void store(unsigned char *&p, const bool &v) { *p++ = v ? 1 : 0; }
+    };
+
+    //! A null-terminated string.  Decoding points the view into the buffer.
+    template <>
+    struct wire<std::string_view> {
+      static const bool is_fixed = false;
+      static const std::size_t min_size = 1;
+
+      static decode_t load(const unsigned char *&p, const unsigned char *end, std::string_view &v) {
+        const void *nul = std::memchr(p, '\0', end - p);
+        if (nul == NULL) return decode_need_more;
+        v = std::string_view((const char *) p, (const unsigned char *) nul - p);
+        p = (const unsigned char *) nul + 1;
+        return decode_ok;
+      }
+      static std::size_t size(const std::string_view &v) { return v.length() + 1; }
+      static void store(unsigned char *&p, const std::string_view &v) {
+        // An empty view may have a null data(), which memcpy() must not be given.
+        if (! v.empty()) std::memcpy(p, v.data(), v.length());
+        p += v.length();
+        *p++ = '\0';
+      }
+    };
+
+    template <typename M>
+    struct member_traits;
+
+    template <typename C, typename T>
+    struct member_traits<T C::*> {
+      typedef T value_type;
+    };
+
+    //! A field stored in the given data member.
+    template <auto Member>
+    struct field {
+      typedef typename member_traits<decltype(Member)>::value_type value_type;
+      typedef wire<value_type> wire_type;
+      static const bool is_fixed = wire_type::is_fixed;
+      static const std::size_t min_size = wire_type::min_size;
+
+      template <typename S>
+      static decode_t load(const unsigned char *&p, const unsigned char *end, S &s) {
+        return wire_type::load(p, end, s.*Member);
+      }
+      template <typename S>
+      static std::size_t size(const S &s) { return wire_type::size(s.*Member); }
+      template <typename S>
+      static void store(unsigned char *&p, const S &s) { wire_type::store(p, s.*Member); }
+    };
+
+    //! A fixed value: written when encoding and checked when decoding.
+    template <typename T, T Value>
+    struct constant {
+      static const bool is_fixed = true;
+      static const std::size_t min_size = sizeof(T);
+
+      template <typename S>
+      static decode_t load(const unsigned char *&p, const unsigned char *, S &) {
+        T v = load_le<T>(p);
+        p += sizeof(T);
+        return (v == Value) ? decode_ok : decode_invalid;
+      }
+      template <typename S>
+      static std::size_t size(const S &) { return sizeof(T); }
+      template <typename S>
+      static void store(unsigned char *&p, const S &) {
+        store_le<T>(p, Value);
+        p += sizeof(T);
+      }
+    };
+
+    //! A fixed null-terminated string; \c Text must have static storage.
+    template <const char *Text>
+    struct literal {
+      static const bool is_fixed = true;
+      static const std::size_t min_size = std::char_traits<char>::length(Text) + 1;
+
+      template <typename S>
+      static decode_t load(const unsigned char *&p, const unsigned char *, S &) {
+        bool same = std::memcmp(p, Text, min_size) == 0;
+        p += min_size;
+        return same ? decode_ok : decode_invalid;
+      }
+      template <typename S>
+      static std::size_t size(const S &) { return min_size; }
+      template <typename S>
+      static void store(unsigned char *&p, const S &) {
+        std::memcpy(p, Text, min_size);
+        p += min_size;
+      }
+    };
+
+    //! For layouts which are entirely constant.
+    struct no_fields {};
+
+    //! The packet made of the given fields in order.
+    template <typename... Fields>
+    struct layout {
+      //! Smallest possible encoding, with all strings empty.
+      static const std::size_t min_size = (Fields::min_size + ... + 0);
+      //! There are no strings so every encoding is min_size.
+      static const bool is_fixed = (Fields::is_fixed && ...);
+
+      /*!
+      \brief Decode the start of \c buf into \c out.
+
+      \param used  if not NULL, set to the bytes decoded on success.
+      */
+      template <typename S>
+      static decode_t decode(const void *buf, std::size_t len, S &out, std::size_t *used = NULL) {
+        if (len < min_size) return decode_need_more;
+        const unsigned char *start = (const unsigned char *) buf;
+        const unsigned char *p = start;
+        decode_t d = decode_fields<S, Fields...>(p, start + len, out);
+        if (d == decode_ok && used != NULL) *used = p - start;
+        return d;
+      }
+
+      //! Bytes needed to encode \c in.
+      template <typename S>
+      static std::size_t encoded_size(const S &in) {
+        if constexpr (is_fixed) return min_size;
+        else return (Fields::size(in) + ... + 0);
+      }
+
+      //! Encode \c in.  \returns bytes written or 0 if \c cap is too small.
+      template <typename S>
+      static std::size_t encode(void *buf, std::size_t cap, const S &in) {
+        std::size_t sz = encoded_size(in);
+        if (cap < sz) return 0;
+        encode_unchecked((unsigned char *) buf, in);
+        return sz;
+      }
+
+      static std::size_t encode(void *buf, std::size_t cap) { return encode(buf, cap, no_fields()); }
+
+      //! \pre there are encoded_size(in) bytes at \c p.  \returns the end of the encoding.
+      template <typename S>
+      static unsigned char *encode_unchecked(unsigned char *p, const S &in) {
+        (Fields::store(p, in), ...);
+        return p;
+      }
+
+    private:
+      template <typename S, typename F, typename... Rest>
+      static decode_t decode_fields(const unsigned char *&p, const unsigned char *end, S &out) {
+        decode_t d = F::load(p, end, out);
+        if (d != decode_ok) return d;
+        if constexpr (sizeof...(Rest) > 0) {
+          if constexpr (! F::is_fixed) {
+            // A string used an unknown amount so the rest must be checked again.
+            if ((std::size_t) (end - p) < (Rest::min_size + ... + 0)) return decode_need_more;
+          }
+          return decode_fields<S, Rest...>(p, end, out);
+        }
+        return decode_ok;
+      }
+    };
+    //@}
+  }
+}
+
+#endif
@@ -51,8 +51,18 @@
 #include <cerrno>
 #include <cstring>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <iostream>
+#include <thread>
+#include <utility>
+
+#include <lrcon/metrics.hpp>
+#include <lrcon/trace.hpp>
 
 #if defined(COMMON_DEBUG_MESSAGES) || defined(RCON_DEBUG_MESSAGES ) \
     || defined(QUERY_DEBUG_MESSAGES)
@@ -165,6 +175,12 @@ namespace common {
     ~proto_error() throw() {}
   };
 
+  //! The operation was stopped with a cancel_token.
+  struct cancelled_error : public comm_error {
+    cancelled_error(const std::string &s) : comm_error(s) {}
+    ~cancelled_error() throw() {}
+  };
+
   //! Throw given exception using errno to get a message
   template <typename Exception>
   void errno_throw(const char *message) {
@@ -174,6 +190,318 @@ namespace common {
     throw Exception(m);
   }
 
+  /*!
+  \brief Failure reasons for the non-throwing API.
+
+  Each one corresponds to the exception which the throwing API raises; see
+  status::check().
+  */
+  typedef enum {
+    no_error = 0,
+    //! connection_error
+    connection_failed,
+    //! connection_error from looking up the host
+    resolve_failed,
+    //! timeout_error
+    timed_out,
+    //! auth_error
+    auth_failed,
+    //! bad_password
+    password_rejected,
+    //! response_error
+    bad_response,
+    //! send_error
+    send_failed,
+    //! recv_error
+    recv_failed,
+    //! proto_error
+    protocol_violation,
+    //! cancelled_error
+    cancelled
+  } error_code_t;
+
+  /*!
+  \brief Outcome of a non-throwing operation.
+
+  This never allocates: the message is a static string and the system error is
+  kept as a number until describe() is called.
+  */
+  struct status {
+    error_code_t code;
+    //! errno, or a getaddrinfo() code when code is resolve_failed.  0 if there was none.
+    int sys_error;
+    //! Static description of what failed.
+    const char *message;
+
+    status() : code(no_error), sys_error(0), message("") {}
+    status(error_code_t c, const char *m, int e = 0) : code(c), sys_error(e), message(m) {}
+
+    bool ok() const { return code == no_error; }
+
+    //! The message an exception for this status would carry.
+    std::string describe() const {
+      std::string m(message);
+      if (code == resolve_failed) {
+        m += ": ";
+        m += gai_strerror(sys_error);
+      }
+      else if (sys_error != 0) {
+        m += ": ";
+        m += strerror(sys_error);
+      }
+      return m;
+    }
+
+    //! Throw the exception which matches the code, if this is an error.
+    void check() const {
+      switch (code) {
+        case no_error: return;
+        case connection_failed:
+        case resolve_failed: throw connection_error(describe());
+        case timed_out: throw timeout_error(describe());
+        case auth_failed: throw auth_error(describe());
+        case password_rejected: throw bad_password(describe());
+        case bad_response: throw response_error(describe());
+        case send_failed: throw send_error(describe());
+        case recv_failed: throw recv_error(describe());
+        case protocol_violation: throw proto_error(describe());
+        case cancelled: throw cancelled_error(describe());
+      }
+      throw error(describe());
+    }
+  };
+
+  //! A failed status carrying the current errno.
+  inline status errno_status(error_code_t code, const char *message) {
+    return status(code, message, errno);
+  }
+
+  /*!
+  \brief Which work goes first when there is a queue.
+
+  Interactive work jumps ahead of bulk work, but not forever; see
+  interactive_per_bulk.
+  */
+  typedef enum {
+    //! An operator waiting on the result.
+    priority_interactive = 0,
+    //! Mass operations which only care about throughput.
+    priority_bulk = 1
+  } priority_t;
+
+  //! While bulk work is waiting, this many interactive items go before each bulk one.
+  const unsigned interactive_per_bulk = 8;
+
+  /*!
+  \brief Either a value or the status saying why there isn't one.
+
+  \code
+  common::result<int> r = common::try_wait_for_select(fd);
+  if (! r.ok()) return r.error();
+  \endcode
+  */
+  template <typename T>
+  class result {
+    T value_;
+    status status_;
+
+    public:
+      result(const T &v) : value_(v) {}
+      result(T &&v) : value_(std::move(v)) {}
+      result(const status &s) : value_(), status_(s) { assert(! s.ok()); }
+
+      bool ok() const { return status_.ok(); }
+      const status &error() const { return status_; }
+
+      //! \pre ok()
+      const T &value() const { assert(ok()); return value_; }
+      //! \pre ok().  The value may be moved from.
+      T &value() { assert(ok()); return value_; }
+
+      //! The value or the exception matching the error.
+      const T &get() const {
+        status_.check();
+        return value_;
+      }
+  };
+
+  /*!
+  \brief Lets one thread stop another's network operations.
+
+  Copies share one flag.  Give a copy to the operation inside a deadline and keep
+  one to call cancel() with.  Waits on sockets wake as soon as it is called.
+  */
+  class cancel_token {
+    friend class deadline;
+
+    struct state {
+      std::atomic<bool> cancelled;
+      //! Readable after cancel() so that select() wakes.  -1 where there are no pipes.
+      int pipe_fds[2];
+
+      state() : cancelled(false) {
+        pipe_fds[0] = pipe_fds[1] = -1;
+#ifndef LRCON_WINDOWS
+        if (pipe(pipe_fds) == -1) pipe_fds[0] = pipe_fds[1] = -1;
+#endif
+      }
+
+      ~state() {
+#ifndef LRCON_WINDOWS
+        if (pipe_fds[0] != -1) {
+          close(pipe_fds[0]);
+          close(pipe_fds[1]);
+        }
+#endif
+      }
+    };
+
+    std::shared_ptr<state> state_;
+
+    public:
+      cancel_token() : state_(new state()) {}
+
+      //! Stop every operation using this token, now and later.  Safe from any thread.
+      void cancel() {
+        if (state_->cancelled.exchange(true)) return;
+#ifndef LRCON_WINDOWS
+        char c = 0;
+        if (state_->pipe_fds[1] != -1) {
+          while (write(state_->pipe_fds[1], &c, 1) == -1 && errno == EINTR) {}
+        }
+#endif
+      }
+
+      bool cancelled() const { return state_->cancelled.load(); }
+  };
+
+  /*!
+  \brief When to give up on an operation, and optionally a token to give up sooner.
+
+  The time is absolute, on the metrics::now_ns() clock, so one deadline bounds a
+  whole sequence of lookups, connects and reads rather than each wait.  The default
+  never expires.
+  */
+  class deadline {
+    uint64_t at_ns_;
+    std::shared_ptr<cancel_token::state> cancel_;
+
+    public:
+      static const uint64_t never = ~uint64_t(0);
+
+      deadline() : at_ns_(never) {}
+      explicit deadline(uint64_t at_ns) : at_ns_(at_ns) {}
+      deadline(uint64_t at_ns, const cancel_token &t) : at_ns_(at_ns), cancel_(t.state_) {}
+
+      //! Only cancellation; no time limit.
+      explicit deadline(const cancel_token &t) : at_ns_(never), cancel_(t.state_) {}
+
+      //! \c ms from now.
+      static deadline in_ms(int ms) {
+        return deadline(metrics::now_ns() + (uint64_t) ms * 1000000);
+      }
+
+      static deadline in_ms(int ms, const cancel_token &t) {
+        return deadline(metrics::now_ns() + (uint64_t) ms * 1000000, t);
+      }
+
+      uint64_t at_ns() const { return at_ns_; }
+
+      bool cancellable() const { return cancel_ != NULL; }
+      bool cancelled() const { return cancel_ && cancel_->cancelled.load(); }
+
+      //! Readable once cancelled.  -1 if there is no token or it has no pipe.
+      int cancel_fd() const { return cancel_ ? cancel_->pipe_fds[0] : -1; }
+
+      //! cancelled or timed_out if the operation should stop now.
+      status check(uint64_t now_ns) const {
+        if (cancelled()) return status(common::cancelled, "the operation was cancelled");
+        if (now_ns >= at_ns_) return status(timed_out, "the deadline passed");
+        return status();
+      }
+  };
+
+  /*!
+  \brief Bounds every blocking operation on this thread while it exists.
+
+  \code
+  common::cancel_token stop;  // stop.cancel() from another thread
+  common::deadline_scope cycle(common::deadline::in_ms(500, stop));
+  rcon::connection conn(server, password, st);
+  if (st.ok()) rcon::command c(conn, "status", st);
+  \endcode
+
+  Scopes nest: the earliest time and every token apply.  Operations which take a
+  deadline argument open a scope for it.  An operation stopped by a scope fails with
+  timed_out or cancelled; an RCON command keeps the part of the reply it read.
+  */
+  class deadline_scope {
+    deadline deadline_;
+    deadline_scope *outer_;
+
+    public:
+      //! Tokens without a pipe are checked this often by waits.
+      static const uint64_t cancel_poll_ns = 50 * 1000000ULL;
+
+      explicit deadline_scope(const deadline &d) : deadline_(d), outer_(innermost()) {
+        innermost() = this;
+      }
+
+      ~deadline_scope() { innermost() = outer_; }
+
+      //! Whether a scope is open on this thread.
+      static bool active() { return innermost() != NULL; }
+
+      //! The earliest deadline of the open scopes, or deadline::never.
+      static uint64_t at_ns() {
+        uint64_t at = deadline::never;
+        for (const deadline_scope *s = innermost(); s != NULL; s = s->outer_) {
+          if (s->deadline_.at_ns() < at) at = s->deadline_.at_ns();
+        }
+        return at;
+      }
+
+      //! cancelled or timed_out if an open scope says to stop.
+      static status check(uint64_t now_ns) {
+        for (const deadline_scope *s = innermost(); s != NULL; s = s->outer_) {
+          status st = s->deadline_.check(now_ns);
+          if (! st.ok()) return st;
+        }
+        return status();
+      }
+
+      /*!
+      \brief Put the open scopes' cancel pipes in \c fds.
+
+      \param must_poll  set if a token has no pipe, so waits must wake to check it.
+      \returns the highest fd added, or -1.
+      */
+      static int add_cancel_fds(fd_set &fds, bool &must_poll) {
+        int top = -1;
+        must_poll = false;
+        for (const deadline_scope *s = innermost(); s != NULL; s = s->outer_) {
+          if (! s->deadline_.cancellable()) continue;
+          int fd = s->deadline_.cancel_fd();
+          if (fd == -1) {
+            must_poll = true;
+            continue;
+          }
+          FD_SET(fd, &fds);
+          if (fd > top) top = fd;
+        }
+        return top;
+      }
+
+    private:
+      static deadline_scope *&innermost() {
+        static thread_local deadline_scope *s = NULL;
+        return s;
+      }
+
+      deadline_scope(const deadline_scope &);
+      deadline_scope &operator=(const deadline_scope &);
+  };
+
 #ifdef LRCON_WINDOWS
   namespace {
     /*!
@@ -238,13 +566,62 @@ namespace common {
       /*!
       \param attr  Bitmask of options from host_attr_t.  Defaults to tcp if nothing is set.
       */
-      host(const char *host, const char *port, int attr = host::tcp) {
-        COMMON_DEBUG_MESSAGE("Host is: " << host << ":" << port << " attr:" << attr);
-
+      host(const char *host, const char *port, int attr = host::tcp) : ad_info(NULL) {
         if (host == NULL) throw std::invalid_argument("host not be empty");
 
         if (port == NULL) throw std::invalid_argument("port must be a numeric string");
 
+        resolve(host, port, attr).check();
+      }
+
+      /*!
+      \brief Look up the host without throwing.  Check \c st or valid() before use.
+
+      \pre host and port are not NULL.
+      */
+      host(const char *host, const char *port, int attr, status &st) : ad_info(NULL) {
+        assert(host != NULL && port != NULL);
+        st = resolve(host, port, attr);
+      }
+
+      /*!
+      \brief Look up the host without throwing, giving up at \c limit.
+
+      \pre host and port are not NULL.
+      */
+      host(const char *host, const char *port, int attr, const deadline &limit, status &st) : ad_info(NULL) {
+        assert(host != NULL && port != NULL);
+        deadline_scope s(limit);
+        st = resolve(host, port, attr);
+      }
+
+      ~host() {
+        // also frees the sockets, of course
+        if (ad_info != NULL) freeaddrinfo(ad_info);
+      }
+
+      //! False if a non-throwing constructor failed.
+      bool valid() const { return ad_info != NULL; }
+
+      //! ai_family for a socket() call.
+      int family() const { return ad_info->ai_family; }
+
+      //! Address struct for a connect() call.
+      const struct sockaddr *address() const { return ad_info->ai_addr; }
+
+      //! Length value for a connect() call.
+      int address_len() const { return ad_info->ai_addrlen; }
+
+      //! SOCK_DGRAM etc.  For socket()
+      int type() const { return ad_info->ai_socktype; }
+
+    private:
+      host(const host &);
+      host &operator=(const host &);
+
+      status resolve(const char *host, const char *port, int attr) {
+        COMMON_DEBUG_MESSAGE("Host is: " << host << ":" << port << " attr:" << attr);
+
         assert(! (attr & tcp & udp));
 
         struct addrinfo hints;
@@ -275,13 +652,16 @@ namespace common {
         hints.ai_next = NULL;
 
         COMMON_DEBUG_MESSAGE("Getting address info.");
-        int r;
-        if ((r = getaddrinfo(host, port, &hints, &ad_info)) != 0) {
-          throw connection_error(std::string("getaddrinfo() failed: ") + gai_strerror(r));
+        status looked_up = lookup(host, port, hints, ad_info);
+        if (! looked_up.ok()) {
+          ad_info = NULL;
+          return looked_up;
         }
 
         if (ad_info->ai_addr == NULL || ad_info->ai_addrlen == 0) {
-          throw connection_error("No socket address returned.");
+          freeaddrinfo(ad_info);
+          ad_info = NULL;
+          return status(connection_failed, "No socket address returned.");
         }
 #if defined(COMMON_DEBUG_MESSAGES)
         else if (ad_info->ai_next != NULL) {
@@ -290,33 +670,88 @@ namespace common {
                                "changes or that the host is multi-homed.");
         }
 #endif
+        return status();
       }
 
-      ~host() {
-        // also frees the sockets, of course
-        freeaddrinfo(ad_info);
-      }
-
-      //! ai_family for a socket() call.
-      int family() const { return ad_info->ai_family; }
-
-      //! Address struct for a connect() call.
-      const struct sockaddr *address() const { return ad_info->ai_addr; }
-
-      //! Length value for a connect() call.
-      int address_len() const { return ad_info->ai_addrlen; }
+      /*!
+      \brief getaddrinfo(), abandoned if a deadline_scope says to stop.
 
-      //! SOCK_DGRAM etc.  For socket()
-      int type() const { return ad_info->ai_socktype; }
+      getaddrinfo() cannot be interrupted, so under a scope a name lookup runs on a
+      thread of its own.  If the wait is given up that thread finishes the lookup
+      in the background and frees the answer.
+      */
+      static status lookup(const char *host, const char *port, const struct addrinfo &hints,
+                           struct addrinfo *&answer) {
+        if (! deadline_scope::active() || (hints.ai_flags & AI_NUMERICHOST)) {
+          int r = getaddrinfo(host, port, &hints, &answer);
+          if (r != 0) return status(resolve_failed, "getaddrinfo() failed", r);
+          return status();
+        }
 
+        status stop = deadline_scope::check(metrics::now_ns());
+        if (! stop.ok()) return stop;
+
+        struct pending {
+          std::mutex mutex;
+          std::condition_variable finished;
+          std::string host, port;
+          struct addrinfo hints;
+          struct addrinfo *answer;
+          int code;
+          bool done, abandoned;
+        };
+        std::shared_ptr<pending> p(new pending());
+        p->host = host;
+        p->port = port;
+        p->hints = hints;
+        p->answer = NULL;
+        p->code = 0;
+        p->done = p->abandoned = false;
+
+        std::thread([p]() {
+          struct addrinfo *a = NULL;
+          int r = getaddrinfo(p->host.c_str(), p->port.c_str(), &p->hints, &a);
+          std::lock_guard<std::mutex> l(p->mutex);
+          if (p->abandoned) {
+            if (r == 0) freeaddrinfo(a);
+            return;
+          }
+          p->answer = a;
+          p->code = r;
+          p->done = true;
+          p->finished.notify_one();
+        }).detach();
+
+        std::unique_lock<std::mutex> l(p->mutex);
+        while (! p->done) {
+          uint64_t now = metrics::now_ns();
+          stop = deadline_scope::check(now);
+          if (! stop.ok()) {
+            p->abandoned = true;
+            return stop;
+          }
+          // A cancel_token cannot notify the condition, so wake to check it.
+          uint64_t wait = deadline_scope::at_ns() - now;
+          if (wait > deadline_scope::cancel_poll_ns) wait = deadline_scope::cancel_poll_ns;
+          p->finished.wait_for(l, std::chrono::nanoseconds(wait));
+        }
+        if (p->code != 0) return status(resolve_failed, "getaddrinfo() failed", p->code);
+        answer = p->answer;
+        return status();
+      }
   };
 
 
   const int wait_for_select_timeout = 0;
   typedef enum {wait_readable, wait_writeable} wait_for_select_mode_t;
 
-  //! 0 if timeout, time_left if no timeout, -1 if error.  Time params are offsets.
-  inline int wait_for_select(int socket_fd, wait_for_select_mode_t mode = wait_readable, int timeout_usecs = 1000000) {
+  /*!
+  \brief Non-throwing wait_for_select().  The value is 0 if timeout, time_left otherwise.
+
+  Waits inside a deadline_scope end early: with timed_out when the deadline passes
+  and with cancelled as soon as a token is cancelled.
+  */
+  inline result<int> try_wait_for_select(int socket_fd, wait_for_select_mode_t mode = wait_readable, int timeout_usecs = 1000000) {
 
     /// \todo This func implies that I should really have stored the connection object
     ///       in the command object.  It breaks things atm, but later I should
@@ -327,99 +762,209 @@ namespace common {
     ///       There's not a problem with it really, I just get the socket in the command
     ///       things so I can write to it directly.  In fact, I could really do everything
     ///       using a read/write member function of connection.
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(socket_fd, &fds);
-
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = timeout_usecs;
-    int ret;
-    if (mode == wait_readable) {
-      ret = select(socket_fd+1, &fds, NULL, NULL, &timeout);
-    }
-    else {
-      ret = select(socket_fd+1, NULL, &fds, NULL, &timeout);
-    }
+    uint64_t start = metrics::now_ns();
+    status stop = deadline_scope::check(start);
+    if (! stop.ok()) return stop;
+
+    uint64_t until = start + (uint64_t) timeout_usecs * 1000;
+    uint64_t limit = deadline_scope::at_ns();
+    if (limit < until) until = limit;
+
+    while (true) {
+      fd_set reads, writes;
+      FD_ZERO(&reads);
+      FD_ZERO(&writes);
+      bool must_poll;
+      int top = deadline_scope::add_cancel_fds(reads, must_poll);
+      FD_SET(socket_fd, (mode == wait_readable) ? &reads : &writes);
+      if (socket_fd > top) top = socket_fd;
+
+      uint64_t now = metrics::now_ns();
+      uint64_t wait = (until > now) ? until - now : 0;
+      if (must_poll && wait > deadline_scope::cancel_poll_ns) wait = deadline_scope::cancel_poll_ns;
+      struct timeval timeout;
+      timeout.tv_sec = wait / 1000000000;
+      timeout.tv_usec = (wait % 1000000000) / 1000;
+
+      int ret = select(top + 1, &reads, &writes, NULL, &timeout);
+      if (ret == -1) {
+        if (errno == EINTR) continue;
+        return errno_status(connection_failed, "select() failed");
+      }
 
-    if (ret == -1) {
-      errno_throw<connection_error>("select() failed");
-    }
+      now = metrics::now_ns();
+      if (FD_ISSET(socket_fd, (mode == wait_readable) ? &reads : &writes)) {
+        int elapsed = (int) ((now - start) / 1000);
+        return (elapsed < timeout_usecs) ? timeout_usecs - elapsed : 1;
+      }
 
-    if (FD_ISSET(socket_fd, &fds)) {
-      return timeout.tv_usec;
-    }
-    else {
-      return wait_for_select_timeout;
+      stop = deadline_scope::check(now);
+      if (! stop.ok()) return stop;
+      if (now >= until) return wait_for_select_timeout;
     }
   }
 
+  //! 0 if timeout, time_left if no timeout.  Time params are offsets.
+  //! \throws connection_error  if select() fails
+  inline int wait_for_select(int socket_fd, wait_for_select_mode_t mode = wait_readable, int timeout_usecs = 1000000) {
+    return try_wait_for_select(socket_fd, mode, timeout_usecs).get();
+  }
+
   //! \brief Non-instancable base class which resolves a circular dependancy from having authing.
   class connection_base {
     static const int wait_for_select_timeout = 0;
 
     int socket_;
+    LRCON_METRIC(metrics::connection_stats stats_;)
 
     protected:
       /*!
       \brief Connects to the server.
+
+      \throws connection_error
+      */
+      connection_base(const host &server) : socket_(-1) {
+        open(server).check();
+      }
+
+      /*!
+      \brief Connects to the server without throwing.
+
+      On failure \c st says why and connected() is false.
+      */
+      connection_base(const host &server, status &st) : socket_(-1) {
+        st = open(server);
+      }
+
+      //! \brief Connects without throwing, giving up at \c limit.
+      connection_base(const host &server, const deadline &limit, status &st) : socket_(-1) {
+        deadline_scope s(limit);
+        st = open(server);
+      }
+
+      /*!
+      \brief Adopt a socket which is already connected.
+
+      Ownership passes to the new object, so the socket is closed on destruction.
+      This is mostly of use for custom transports, tests and benchmarks.
       */
-      connection_base(const host &server) {
+      explicit connection_base(int connected_socket) : socket_(connected_socket) {
+        assert(socket_ != -1);
+      }
+
+      //! \brief Disconnects
+      ~connection_base() {
+        disconnect();
+      }
+
+
+    public:
+      //! Necessary to be public for the message types to call it but not the user.
+      int socket() { return socket_; }
+
+      //! False if the non-throwing constructor failed.
+      bool connected() const { return socket_ != -1; }
+
+#ifdef LRCON_METRICS
+      //! Traffic recorded on this connection.  Only exists when LRCON_METRICS is defined.
+      metrics::connection_stats &stats() { return stats_; }
+#endif
+
+    private:
+      connection_base(const connection_base &);
+      connection_base &operator=(const connection_base &);
+
+      void disconnect() {
+        if (socket_ == -1) return;
+#ifdef LRCON_WINDOWS
+        closesocket(socket_);
+#else
+        close(socket_);
+#endif
+        socket_ = -1;
+      }
+
+      //! Close the socket and pass on the failure.
+      status fail(const status &st) {
+        disconnect();
+        return st;
+      }
+
+      //! Implementation of the constructors.  On failure the socket is closed.
+      status open(const host &server) {
+        LRCON_METRIC(uint64_t connect_start = metrics::now_ns());
+        LRCON_METRIC(metrics::failure_guard failed(metrics::global().connect_failures));
+
+        if (! server.valid()) {
+          return status(resolve_failed, "the host was not resolved");
+        }
+
         COMMON_DEBUG_MESSAGE("Initialising sockets.");
         socket_ = ::socket(server.family(), server.type(), 0);
         if (socket_ == -1) {
-          errno_throw<connection_error>("socket() failed");
+          return errno_status(connection_failed, "socket() failed");
         }
+        LRCON_TRACE(ev_connect_begin, socket_, 0, 0, 0);
 
 #ifndef LRCON_WINDOWS
         COMMON_DEBUG_MESSAGE("Setting nonblock.");
 
         int flags = fcntl(socket_, F_GETFL, 0);
         if (flags == -1) {
-          errno_throw<connection_error>("fcntl(): F_GETFL failed");
+          return fail(errno_status(connection_failed, "fcntl(): F_GETFL failed"));
         }
         else if (! (flags & O_NONBLOCK)) {
           if (fcntl(socket_, F_SETFL, flags | O_NONBLOCK) == -1) {
-            std::cerr << "warning: couldn't set non-blocking flags on the socket.  "
-                         "If the host drops packets, the connection will block forever." << std::endl;
+            // If the host drops packets, the connection will block forever.
+            LRCON_TRACE(ev_nonblock_failed, socket_, 0, 0, errno);
           }
         }
 
         COMMON_DEBUG_MESSAGE("Connecting socket.");
         int ret = connect(socket_, server.address(), server.address_len());
-        if (errno == EINPROGRESS && ret == -1) {
-          COMMON_DEBUG_MESSAGE("Connect is now in progress.");
-        }
-        else {
-          errno_throw<connection_error>("connect() failed");
+        if (ret == 0) {
+          // Datagram sockets and some local connections complete immediately.
+          COMMON_DEBUG_MESSAGE("Connected immediately.");
         }
+        else if (errno == EINPROGRESS) {
+          COMMON_DEBUG_MESSAGE("Connect is now in progress.");
 
-        COMMON_DEBUG_MESSAGE("Waiting for select.");
-        if (wait_for_select(socket_, wait_writeable, 1000000) == wait_for_select_timeout) {
-          /// \todo Coluld do with a timeout_error.
-          throw connection_error("timeout when connecting to host.");
-        }
+          COMMON_DEBUG_MESSAGE("Waiting for select.");
+          result<int> waited = try_wait_for_select(socket_, wait_writeable, 1000000);
+          if (! waited.ok()) {
+            return fail(waited.error());
+          }
+          else if (waited.value() == wait_for_select_timeout) {
+            LRCON_METRIC(metrics::record_timeout(stats_));
+            LRCON_TRACE(ev_connect_timeout, socket_, 0, 0, 0);
+            return fail(status(timed_out, "timeout when connecting to host."));
+          }
 
-        socklen_t option_value_size = sizeof(int);
-        int option_value;
-        if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, (void*)(&option_value), &option_value_size) < 0) {
-          errno_throw<connection_error>("checking for socket error with getsockopt() failed");
-        }
-        assert(option_value_size == sizeof(option_value));
+          socklen_t option_value_size = sizeof(int);
+          int option_value;
+          if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, (void*)(&option_value), &option_value_size) < 0) {
+            return fail(errno_status(connection_failed, "checking for socket error with getsockopt() failed"));
+          }
+          assert(option_value_size == sizeof(option_value));
 
-        if (option_value) {
-          errno = option_value;
-          errno_throw<connection_error>("delayed connection failed");
+          if (option_value) {
+            LRCON_TRACE(ev_connect_failed, socket_, 0, 0, option_value);
+            return fail(status(connection_failed, "delayed connection failed", option_value));
+          }
+        }
+        else {
+          LRCON_TRACE(ev_connect_failed, socket_, 0, 0, errno);
+          return fail(errno_status(connection_failed, "connect() failed"));
         }
 
         COMMON_DEBUG_MESSAGE("Setting blocking again.");
         flags = fcntl(socket_, F_GETFL, 0);
         if (flags == -1) {
-          errno_throw<connection_error>("fcntl(): F_GETFL failed");
+          return fail(errno_status(connection_failed, "fcntl(): F_GETFL failed"));
         }
         else if (flags & O_NONBLOCK) {
           if (fcntl(socket_, F_SETFL, flags & ~O_NONBLOCK) == -1) {
-            errno_throw<connection_error>("could not reset the socket to blocking mode");
+            return fail(errno_status(connection_failed, "could not reset the socket to blocking mode"));
           }
         }
 
@@ -429,25 +974,18 @@ namespace common {
 
         COMMON_DEBUG_MESSAGE("Connecting socket.");
         if (connect(socket_, server.address(), server.address_len()) == -1) {
-          errno_throw<connection_error>("connect() failed");
+          return fail(errno_status(connection_failed, "connect() failed"));
         }
 #endif
         COMMON_DEBUG_MESSAGE("Sockets all set up.");
-      }
+        LRCON_TRACE(ev_connect_end, socket_, 0, 0, 0);
 
-      //! \brief Disconnects
-      ~connection_base() {
-#ifdef LRCON_WINDOWS
-        closesocket(socket_);
-#else
-        close(socket_);
-#endif
+        LRCON_METRIC(failed.dismiss());
+        LRCON_METRIC(stats_.connect_ns = metrics::now_ns() - connect_start);
+        LRCON_METRIC(metrics::global().connect_latency.record(stats_.connect_ns));
+        LRCON_METRIC(metrics::global().connects.add());
+        return status();
       }
-
-
-    public:
-      //! Necessary to be public for the message types to call it but not the user.
-      int socket() { return socket_; }
   };
 
 
@@ -519,6 +1057,16 @@ namespace common {
   /// This is all used by query tho.
   ///
 
+  //! Read a buffer from the socket without throwing.
+  inline result<int> try_read_to_buffer(int socket_fd, void *buff, size_t buffsz, const char *errormsg = "recv() failed") {
+    // windows needs char*
+    int read = recv(socket_fd, (char *) buff, buffsz, 0);
+    if (read == -1) {
+      return errno_status(recv_failed, errormsg);
+    }
+    return read;
+  }
+
   //! Read a buffer from the socket
   template <typename Exception>
   int read_to_buffer(int socket_fd, void *buff, size_t buffsz, const char *errormsg = "recv() failed") {
@@ -536,12 +1084,21 @@ namespace common {
     return read_to_buffer<recv_error>(socket_fd, buff, buffsz, errormsg);
   }
 
+  //! Send a buffer to the socket without throwing.
+  inline result<int> try_send_from_buffer(int socket_fd, const void *buff, std::size_t buffsz, const char *errormsg = "send() failed") {
+    int sent = send(socket_fd, (const char *) buff, buffsz, 0);
+    if (sent == -1) {
+      return errno_status(send_failed, errormsg);
+    }
+    return sent;
+  }
+
   //! Send a buffer to the socket
   template<class Exception>
   int send_from_buffer(int socket_fd, const void *buff, std::size_t buffsz, const char *errormsg = "send() failed") {
     /// \todo make this a member of connection_base
     int sent;
-    if ((sent = send(socket_fd, (char *) &buff, buffsz, 0)) == -1) {
+    if ((sent = send(socket_fd, (const char *) buff, buffsz, 0)) == -1) {
       common::errno_throw<Exception>(errormsg);
     }
     return sent;
@@ -589,12 +1146,14 @@ namespace common {
 
 
   //! Adds to a string (also increments idx by reference).  The compiler definitely should
-  //! optimise the by-value copy out when initialising a variable.
-  inline std::string from_buffer(void *buf, size_t &idx, size_t max) {
-    char *b = (char *) buf;
+  //! optimise the by-value copy out when initialising a variable.  The terminating null is
+  //! skipped but not included in the string.
+  inline std::string from_buffer(const void *buf, size_t &idx, size_t max) {
+    const char *b = (const char *) buf;
     size_t start = idx;
-    while (idx < max && b[idx++] != '\0');
+    while (idx < max && b[idx] != '\0') ++idx;
     size_t chrs = idx - start;
+    if (idx < max) ++idx;
     return std::string(&b[start], chrs);
   }
 
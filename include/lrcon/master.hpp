@@ -0,0 +1,273 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Server lists from a Valve master server, streamed as they come.
+
+http://developer.valvesoftware.com/wiki/Master_Server_Query_Protocol
+
+\code
+master::client m(query::host("hl2master.steampowered.com", "27011"));
+std::vector<struct sockaddr_in> found;
+common::status st = m.run(master::region_world, "\\gamedir\\cstrike",
+                          [&](const struct sockaddr_in &a) { found.push_back(a); });
+\endcode
+*/
+
+#ifndef MASTER_HPP_d8r2j6xq
+#define MASTER_HPP_d8r2j6xq
+
+#include <lrcon/common.hpp>
+#include <lrcon/query.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+//! For listing servers from a master server.
+namespace master {
+  //! Which servers to list, by where they are.
+  typedef enum {
+    region_us_east = 0x00,
+    region_us_west = 0x01,
+    region_south_america = 0x02,
+    region_europe = 0x03,
+    region_asia = 0x04,
+    region_australia = 0x05,
+    region_middle_east = 0x06,
+    region_africa = 0x07,
+    region_world = 0xff
+  } region_t;
+
+  //! I/O free master server codec.
+  namespace codec {
+    using common::codec::decode_t;
+    using common::codec::decode_ok;
+    using common::codec::decode_need_more;
+    using common::codec::decode_invalid;
+
+    //! Starts every request.
+    const uint8_t list_request = 0x31;
+    //! A reply starts with four 0xff bytes, then this and a newline.
+    const uint8_t list_reply = 0x66;
+    //! Bytes before the first address of a reply.
+    const std::size_t reply_header_size = 6;
+    //! Each address is four bytes of IPv4 and the port, both big-endian.
+    const std::size_t entry_size = 6;
+
+    /*!
+    \brief A request for the page of servers which follows \c seed.
+
+    The first request's seed is 0.0.0.0:0 and each later one's is the last address
+    of the page before.  \returns 0 if \c cap is too small.
+    */
+    inline std::size_t encode_request(void *buf, std::size_t cap, region_t region, const struct sockaddr_in &seed,
+                                      const std::string &filter) {
+      char ip[INET_ADDRSTRLEN];
+      if (inet_ntop(AF_INET, &seed.sin_addr, ip, sizeof(ip)) == NULL) return 0;
+      char seed_text[INET_ADDRSTRLEN + 8];
+      int n = snprintf(seed_text, sizeof(seed_text), "%s:%u", ip, (unsigned) ntohs(seed.sin_port));
+      std::size_t need = 2 + (std::size_t) n + 1 + filter.size() + 1;
+      if (n < 0 || need > cap) return 0;
+
+      unsigned char *p = (unsigned char *) buf;
+      *p++ = list_request;
+      *p++ = (uint8_t) region;
+      std::memcpy(p, seed_text, n + 1);
+      p += n + 1;
+      std::memcpy(p, filter.c_str(), filter.size() + 1);
+      return need;
+    }
+
+    //! The addresses in one reply.
+    class page {
+      const unsigned char *entries_;
+      std::size_t count_;
+
+      public:
+        page() : entries_(NULL), count_(0) {}
+        page(const unsigned char *entries, std::size_t count) : entries_(entries), count_(count) {}
+
+        std::size_t size() const { return count_; }
+
+        //! The \c i th address, as a sockaddr ready for a query.
+        struct sockaddr_in at(std::size_t i) const {
+          struct sockaddr_in a;
+          std::memset(&a, 0, sizeof(a));
+          a.sin_family = AF_INET;
+          std::memcpy(&a.sin_addr.s_addr, entries_ + i * entry_size, 4);
+          std::memcpy(&a.sin_port, entries_ + i * entry_size + 4, 2);
+          return a;
+        }
+
+        //! Whether the \c i th address is 0.0.0.0:0, which ends the list.
+        bool is_end(std::size_t i) const {
+          static const unsigned char zero[entry_size] = {0, 0, 0, 0, 0, 0};
+          return std::memcmp(entries_ + i * entry_size, zero, entry_size) == 0;
+        }
+
+        //! The \c i th address as one number, for telling addresses apart.
+        uint64_t key(std::size_t i) const {
+          uint64_t k = 0;
+          for (std::size_t b = 0; b < entry_size; ++b) k = (k << 8) | entries_[i * entry_size + b];
+          return k;
+        }
+
+        //! Whether the \c i th address of this page and the \c j th of \c o are the same.
+        bool same(std::size_t i, const page &o, std::size_t j) const {
+          return std::memcmp(entries_ + i * entry_size, o.entries_ + j * entry_size, entry_size) == 0;
+        }
+    };
+
+    inline decode_t decode_page(const void *buf, std::size_t len, page &out) {
+      static const unsigned char header[reply_header_size] = {0xff, 0xff, 0xff, 0xff, list_reply, '\n'};
+      if (len < reply_header_size) return decode_need_more;
+      if (std::memcmp(buf, header, reply_header_size) != 0) return decode_invalid;
+      std::size_t body = len - reply_header_size;
+      if (body == 0 || body % entry_size != 0) return decode_invalid;
+      out = page((const unsigned char *) buf + reply_header_size, body / entry_size);
+      return decode_ok;
+    }
+  }
+
+  /*!
+  \brief Lists the servers a master server knows, one page at a time.
+
+  A master server sends a page of up to 231 addresses per request, and the next
+  page is asked for with the last address of the one before.  As soon as a page
+  comes the request for the next is sent, and only then are the page's addresses
+  given to the callback.  So the callback's work overlaps the next round trip, and
+  a consumer, such as a query::scanner fed from another thread, can start on the
+  first servers while the rest of the list is still coming.
+
+  A request which gets no reply is sent again up to \c retries times.  A page
+  which comes twice, because a resent request and the original were both
+  answered, is only passed on once, even when the second copy comes after later
+  pages.
+
+  A run() inside a common::deadline_scope stops at its deadline or when it is
+  cancelled, with what was already passed on left passed on.
+  */
+  class client {
+    public:
+      struct options {
+        //! How long to wait for each page.
+        int timeout_ms;
+        //! Times to send a request again when its page does not come.
+        unsigned retries;
+        //! Stop after this many servers; 0 for all of them.
+        std::size_t max_servers;
+
+        options() : timeout_ms(2000), retries(3), max_servers(0) {}
+      };
+
+      typedef std::function<void (const struct sockaddr_in &)> sink;
+
+      //! Connect to the master server.
+      client(const query::host &master, const options &o = options())
+      : conn_(master), opt_(o), pages_(0), servers_(0), requests_(0) {}
+
+      //! Connect without throwing.  \c st says why if it failed.
+      client(const query::host &master, const options &o, common::status &st)
+      : conn_(master, st), opt_(o), pages_(0), servers_(0), requests_(0) {}
+
+      /*!
+      \brief Stream the servers matching \c filter in \c region to \c out.
+
+      \param filter  Valve's filter syntax, eg "\\gamedir\\tf\\empty\\1", or empty for every server.
+      */
+      common::status run(region_t region, const std::string &filter, const sink &out) {
+        using common::status;
+        int socket = ((common::connection_base &) conn_).socket();
+        struct sockaddr_in seed;
+        std::memset(&seed, 0, sizeof(seed));
+        seed.sin_family = AF_INET;
+        pages_ = 0;
+        servers_ = 0;
+        requests_ = 0;
+
+        status st = send(socket, region, seed, filter);
+        if (! st.ok()) return st;
+
+        // The first address of every page passed on, to spot one coming again however late.
+        std::unordered_set<uint64_t> firsts;
+        // The last page passed on, which the next may start with the end of.
+        unsigned char last[query::codec::max_packet_size];
+        codec::page last_page;
+        unsigned char buf[query::codec::max_packet_size];
+        unsigned tries = 0;
+        while (true) {
+          common::result<int> t = common::try_wait_for_select(socket, common::wait_readable, opt_.timeout_ms * 1000);
+          if (! t.ok()) return t.error();
+          if (t.value() == common::wait_for_select_timeout) {
+            if (++tries > opt_.retries) return status(common::timed_out, "timed out waiting for a master server page");
+            st = send(socket, region, seed, filter);
+            if (! st.ok()) return st;
+            continue;
+          }
+
+          common::result<int> received = common::try_read_to_buffer(socket, buf, sizeof(buf));
+          if (! received.ok()) return received.error();
+          codec::page p;
+          if (codec::decode_page(buf, received.value(), p) != codec::decode_ok) {
+            return status(common::protocol_violation, "invalid master server reply");
+          }
+          if (! firsts.insert(p.key(0)).second) continue;
+
+          // Some servers start a page with the seed again.
+          std::size_t first = (last_page.size() && p.same(0, last_page, last_page.size() - 1)) ? 1 : 0;
+          bool done = p.is_end(p.size() - 1);
+          if (! done) {
+            seed = p.at(p.size() - 1);
+            tries = 0;
+            st = send(socket, region, seed, filter);
+            if (! st.ok()) return st;
+          }
+          ++pages_;
+
+          std::size_t end = done ? p.size() - 1 : p.size();
+          for (std::size_t i = first; i < end; ++i) {
+            out(p.at(i));
+            if (++servers_ == opt_.max_servers) return status();
+          }
+          if (done) return status();
+
+          std::memcpy(last, buf, received.value());
+          last_page = codec::page(last + codec::reply_header_size, p.size());
+        }
+      }
+
+      //! Pages received and servers passed on by the last run().
+      unsigned pages() const { return pages_; }
+      std::size_t servers() const { return servers_; }
+      //! Requests sent by the last run(), including ones sent again.
+      unsigned requests() const { return requests_; }
+
+    private:
+      query::connection conn_;
+      options opt_;
+      unsigned pages_;
+      std::size_t servers_;
+      unsigned requests_;
+
+      common::status send(int socket, region_t region, const struct sockaddr_in &seed, const std::string &filter) {
+        unsigned char pkt[query::codec::max_packet_size];
+        std::size_t sz = codec::encode_request(pkt, sizeof(pkt), region, seed, filter);
+        if (sz == 0) return common::status(common::send_failed, "the filter is too long for a request");
+        common::result<int> sent = common::try_send_from_buffer(socket, pkt, sz);
+        if (! sent.ok()) return sent.error();
+        ++requests_;
+        return common::status();
+      }
+
+      client(const client &);
+      client &operator=(const client &);
+  };
+}
+
+#endif
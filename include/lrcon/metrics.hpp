@@ -0,0 +1,294 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Counters and latency histograms recorded inside the library.
+
+Metrics are only recorded when \c LRCON_METRICS is defined (it must be defined the
+same way in every translation unit, like the debug message macros).  Otherwise the
+\link LRCON_METRIC \endlink statements compile to nothing and the types here are
+unused.
+
+Example:
+
+\code
+const common::metrics::registry &m = common::metrics::global();
+std::cout << "p99 command latency: " << m.command_latency.percentile(99.0) << "ns\n"
+          << "timeouts: " << m.timeouts.value() << std::endl;
+\endcode
+*/
+
+#ifndef METRICS_HPP_r8w2mc4n
+#define METRICS_HPP_r8w2mc4n
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/*!
+\def LRCON_METRIC
+
+Wraps a metrics recording statement so that it disappears entirely unless
+\c LRCON_METRICS is defined.
+*/
+#ifdef LRCON_METRICS
+#  define LRCON_METRIC(x__) x__
+#else
+#  define LRCON_METRIC(x__)
+#endif
+
+namespace common {
+  //! Low overhead counters and histograms; see \link metrics.hpp \endlink.
+  namespace metrics {
+    //! Nanoseconds on the monotonic clock.
+    inline uint64_t now_ns() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //! Lock-free monotonic counter.
+    class counter {
+      std::atomic<uint64_t> value_;
+
+      public:
+        counter() : value_(0) {}
+
+        void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+        void reset() { value_.store(0, std::memory_order_relaxed); }
+
+      private:
+        counter(const counter &);
+        counter &operator=(const counter &);
+    };
+
+    /*!
+    \brief Lock-free log-linear histogram of nanosecond values.
+
+    Values under 32 get a bucket each; above that every power of two is split into
+    16 buckets, so a reported value is within about 3% of the recorded one.  This is
+    the bucketing scheme of HdrHistogram.  Recording is a handful of relaxed atomic
+    operations.
+    */
+    class histogram {
+      public:
+        static const unsigned sub_bucket_bits = 4;
+        static const unsigned sub_buckets = 1 << sub_bucket_bits;
+        static const unsigned linear_limit = sub_buckets * 2;
+        static const unsigned bucket_count = linear_limit + (64 - sub_bucket_bits - 1) * sub_buckets;
+
+      private:
+        std::atomic<uint64_t> buckets_[bucket_count];
+        std::atomic<uint64_t> count_;
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> min_;
+        std::atomic<uint64_t> max_;
+
+      public:
+        histogram() { reset(); }
+
+        //! Bucket which \c v is counted in.
+        static unsigned bucket_index(uint64_t v) {
+          if (v < linear_limit) return (unsigned) v;
+          unsigned magnitude = 63 - __builtin_clzll(v);
+          unsigned shift = magnitude - sub_bucket_bits;
+          unsigned sub = (unsigned) (v >> shift) - sub_buckets;
+          return linear_limit + (magnitude - sub_bucket_bits - 1) * sub_buckets + sub;
+        }
+
+        //! Smallest value counted in bucket \c i.
+        static uint64_t bucket_low(unsigned i) {
+          if (i < linear_limit) return i;
+          unsigned k = i - linear_limit;
+          unsigned magnitude = k / sub_buckets + sub_bucket_bits + 1;
+          uint64_t sub = k % sub_buckets + sub_buckets;
+          return sub << (magnitude - sub_bucket_bits);
+        }
+
+        //! Largest value counted in bucket \c i.
+        static uint64_t bucket_high(unsigned i) {
+          return (i + 1 < bucket_count) ? bucket_low(i + 1) - 1 : ~uint64_t(0);
+        }
+
+        void record(uint64_t v) {
+          buckets_[bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+          count_.fetch_add(1, std::memory_order_relaxed);
+          sum_.fetch_add(v, std::memory_order_relaxed);
+
+          uint64_t m = min_.load(std::memory_order_relaxed);
+          while (v < m && ! min_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+          m = max_.load(std::memory_order_relaxed);
+          while (v > m && ! max_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+        }
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        uint64_t min() const { return count() ? min_.load(std::memory_order_relaxed) : 0; }
+        uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+        double mean() const {
+          uint64_t c = count();
+          return c ? (double) sum_.load(std::memory_order_relaxed) / c : 0.0;
+        }
+
+        /*!
+        \brief Value at or below which \c p percent of the recorded values fall.
+
+        The result is the midpoint of the bucket, clamped to the recorded min/max.
+        It is approximate if values are recorded concurrently.
+        */
+        uint64_t percentile(double p) const {
+          uint64_t total = count();
+          if (total == 0) return 0;
+
+          uint64_t rank = (uint64_t) ((p / 100.0) * total + 0.5);
+          if (rank == 0) rank = 1;
+          if (rank > total) rank = total;
+
+          uint64_t seen = 0;
+          for (unsigned i = 0; i < bucket_count; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+              uint64_t v = bucket_low(i) + (bucket_high(i) - bucket_low(i)) / 2;
+              if (v < min()) v = min();
+              if (v > max()) v = max();
+              return v;
+            }
+          }
+          return max();
+        }
+
+        void reset() {
+          for (unsigned i = 0; i < bucket_count; ++i) buckets_[i].store(0, std::memory_order_relaxed);
+          count_.store(0, std::memory_order_relaxed);
+          sum_.store(0, std::memory_order_relaxed);
+          min_.store(~uint64_t(0), std::memory_order_relaxed);
+          max_.store(0, std::memory_order_relaxed);
+        }
+
+      private:
+        histogram(const histogram &);
+        histogram &operator=(const histogram &);
+    };
+
+    //! Traffic on one connection.  Available as connection_base::stats().
+    struct connection_stats {
+      counter bytes_sent;
+      counter bytes_received;
+      counter packets_sent;
+      counter packets_received;
+      counter timeouts;
+      //! Time taken by connect(), including waiting for it to complete.
+      uint64_t connect_ns;
+
+      connection_stats() : connect_ns(0) {}
+    };
+
+    //! Process-wide metrics.  See global().
+    struct registry {
+      //! \name Latencies in nanoseconds
+      //@{
+      //! socket() to a completed connect().
+      histogram connect_latency;
+      //! Sending an auth_command to reading the auth response.
+      histogram auth_latency;
+      //! Sending an RCON command to the first packet of its reply.
+      histogram first_byte_latency;
+      //! First packet of a multi-packet reply to the end of the reply.
+      histogram tail_wait_latency;
+      //! Complete RCON commands.
+      histogram command_latency;
+      //! Complete server queries.  The challenge made by a players or rules query is
+      //! counted as a query in its own right as well as being part of the outer one.
+      histogram query_latency;
+      //@}
+
+      //! \name Counters
+      //@{
+      counter connects;
+      counter connect_failures;
+      counter auths;
+      counter auth_failures;
+      counter commands;
+      counter queries;
+      counter bytes_sent;
+      counter bytes_received;
+      counter packets_sent;
+      counter packets_received;
+      counter timeouts;
+      //@}
+
+      void reset() {
+        histogram *h[] = {&connect_latency, &auth_latency, &first_byte_latency,
+                          &tail_wait_latency, &command_latency, &query_latency};
+        for (unsigned i = 0; i < sizeof(h) / sizeof(h[0]); ++i) h[i]->reset();
+        counter *c[] = {&connects, &connect_failures, &auths, &auth_failures, &commands, &queries,
+                        &bytes_sent, &bytes_received, &packets_sent, &packets_received, &timeouts};
+        for (unsigned i = 0; i < sizeof(c) / sizeof(c[0]); ++i) c[i]->reset();
+      }
+    };
+
+    //! The process-wide registry.
+    inline registry &global() {
+      static registry r;
+      return r;
+    }
+
+    //! Record traffic in both the connection and the global totals.
+    inline void record_sent(connection_stats &s, uint64_t bytes, uint64_t packets = 1) {
+      s.bytes_sent.add(bytes);
+      s.packets_sent.add(packets);
+      global().bytes_sent.add(bytes);
+      global().packets_sent.add(packets);
+    }
+
+    //! \copydoc record_sent
+    inline void record_received(connection_stats &s, uint64_t bytes, uint64_t packets = 1) {
+      s.bytes_received.add(bytes);
+      s.packets_received.add(packets);
+      global().bytes_received.add(bytes);
+      global().packets_received.add(packets);
+    }
+
+    //! Count a timeout against a connection and the global totals.
+    inline void record_timeout(connection_stats &s) {
+      s.timeouts.add();
+      global().timeouts.add();
+    }
+
+    //! Counts a failure unless dismiss() is called before it goes out of scope.
+    class failure_guard {
+      counter &failures_;
+      bool dismissed_;
+
+      public:
+        explicit failure_guard(counter &failures) : failures_(failures), dismissed_(false) {}
+        ~failure_guard() { if (! dismissed_) failures_.add(); }
+        void dismiss() { dismissed_ = true; }
+    };
+
+    //! Print a histogram summary on one line.
+    inline void print(std::ostream &o, const char *name, const histogram &h) {
+      o << name << ": count=" << h.count() << " mean=" << (uint64_t) h.mean()
+        << " p50=" << h.percentile(50) << " p99=" << h.percentile(99)
+        << " max=" << h.max() << " (ns)\n";
+    }
+
+    //! Print everything in the registry.
+    inline void print(std::ostream &o, const registry &r) {
+      print(o, "connect_latency", r.connect_latency);
+      print(o, "auth_latency", r.auth_latency);
+      print(o, "first_byte_latency", r.first_byte_latency);
+      print(o, "tail_wait_latency", r.tail_wait_latency);
+      print(o, "command_latency", r.command_latency);
+      print(o, "query_latency", r.query_latency);
+      o << "connects=" << r.connects.value() << " connect_failures=" << r.connect_failures.value()
+        << " auths=" << r.auths.value() << " auth_failures=" << r.auth_failures.value()
+        << " commands=" << r.commands.value() << " queries=" << r.queries.value() << "\n"
+        << "bytes_sent=" << r.bytes_sent.value() << " bytes_received=" << r.bytes_received.value()
+        << " packets_sent=" << r.packets_sent.value() << " packets_received=" << r.packets_received.value()
+        << " timeouts=" << r.timeouts.value() << std::endl;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,83 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Lock-free multi-producer single-consumer queue.
+*/
+
+#ifndef MPSC_QUEUE_HPP_d1k7w3qe
+#define MPSC_QUEUE_HPP_d1k7w3qe
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+namespace common {
+  /*!
+  \brief Unbounded queue which any thread may push to and one thread pops from.
+
+  This is Dmitry Vyukov's node based MPSC queue: a push is one atomic exchange and
+  a pop does not need any atomic read-modify-write at all.  A push is complete once
+  its exchange is done; if pop() finds one which has not yet linked its node it
+  waits the few instructions until it has, so pop() only returns false when every
+  push which began before it is visible.
+  */
+  template <typename T>
+  class mpsc_queue {
+    struct node {
+      std::atomic<node *> next;
+      T value;
+
+      node() : next(NULL) {}
+      explicit node(T &&v) : next(NULL), value(std::move(v)) {}
+    };
+
+    //! Producers swap themselves in here.
+    std::atomic<node *> head_;
+    //! Only touched by the consumer.  Always points at a node whose value was taken.
+    node *tail_;
+
+    public:
+      mpsc_queue() {
+        node *stub = new node();
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+      }
+
+      ~mpsc_queue() {
+        T discard;
+        while (pop(discard)) {}
+        delete tail_;
+      }
+
+      //! Safe from any thread.
+      void push(T v) {
+        node *n = new node(std::move(v));
+        node *prev = head_.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+      }
+
+      //! Consumer only.  \returns false if there was nothing to pop.
+      bool pop(T &out) {
+        node *next = tail_->next.load(std::memory_order_acquire);
+        if (next == NULL) {
+          if (head_.load(std::memory_order_acquire) == tail_) return false;
+          // A producer has swapped in its node but not linked it yet.
+          do {
+            std::this_thread::yield();
+            next = tail_->next.load(std::memory_order_acquire);
+          } while (next == NULL);
+        }
+        out = std::move(next->value);
+        delete tail_;
+        tail_ = next;
+        return true;
+      }
+
+    private:
+      mpsc_queue(const mpsc_queue &);
+      mpsc_queue &operator=(const mpsc_queue &);
+  };
+}
+
+#endif
@@ -20,10 +20,18 @@
 #define QUERY_HPP_ifzth5xs
 
 #include <lrcon/common.hpp>
+#include <lrcon/query_codec.hpp>
+#include <lrcon/query_challenge.hpp>
+#include <lrcon/query_split.hpp>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #ifdef QUERY_DEBUG_MESSAGES
 #  include <iostream>
-#  define QUERY_DEBUG_MESSAGE(x__) std::cout << x__ << std::endl; 
+#  define QUERY_DEBUG_MESSAGE(x__) std::cout << x__ << std::endl;
 #else
 #  define QUERY_DEBUG_MESSAGE(x__)
 #endif
@@ -33,54 +41,803 @@ namespace query {
   //! Convenience wrapper class
   struct host : public common::host {
     //! \param is_ip  means no lookup will be done if true
-    host(const char *host, const char *port, bool is_ip = false) 
-    : common::host(host, port, ((is_ip) ? (common::host::is_ip&common::host::udp) : common::host::udp)) {}
+    host(const char *host, const char *port, bool is_ip = false)
+    : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::udp) : common::host::udp)) {}
+
+    //! Resolve without throwing.  On failure \c st says why and valid() is false.
+    host(const char *host, const char *port, bool is_ip, common::status &st)
+    : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::udp) : common::host::udp), st) {}
+
+    //! Resolve without throwing, giving up at \c limit.
+    host(const char *host, const char *port, bool is_ip, const common::deadline &limit, common::status &st)
+    : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::udp) : common::host::udp), limit, st) {}
   };
-  
+
   //! Wrapper for a query server connection.
   class connection : public common::connection_base {
     public:
       //! Connect to the given query server.
       connection(const host &server) : common::connection_base(server) {}
-      
+
+      //! Connect without throwing.  On failure \c st says why and connected() is false.
+      connection(const host &server, common::status &st) : common::connection_base(server, st) {}
+
+      //! Connect without throwing, giving up at \c limit.
+      connection(const host &server, const common::deadline &limit, common::status &st)
+      : common::connection_base(server, limit, st) {}
+
     protected:
       //! override the access.
       int socket() { return connection_base::socket(); }
   };
-  
 
 
+
+  namespace {
+    //! Helper function to send some arbitrary static data without throwing.
+    //! \todo this should be in common
+    inline common::result<int> try_send_buffered_packet(int socket, const unsigned char *pkt, size_t sz) {
+      common::result<int> sent = common::try_send_from_buffer(socket, pkt, sz);
+      if (sent.ok()) {
+        LRCON_TRACE(ev_query_send, socket, 0, sent.value(), (sz > 4) ? pkt[4] : 0);
+      }
+      return sent;
+    }
+
+    //! Helper function to send some arbitrary static data.
+    inline int send_buffered_packet(int socket, const unsigned char *pkt, size_t sz) {
+      return try_send_buffered_packet(socket, pkt, sz).get();
+    }
+  }
+
   //! Non-instanciable base class for request types.
   class query_base {
     protected:
-      static const size_t max_packet_size = 1400;
-      enum split_type {split_single = -1, split_multiple = -2};
+      static const size_t max_packet_size = codec::max_packet_size;
+      enum split_type {split_single = codec::split_single, split_multiple = codec::split_multiple};
+
+      //! Map a failed decode onto a status.
+      static common::status decode_error(codec::decode_t d, const char *message) {
+        return common::status(common::protocol_violation,
+                              (d == codec::decode_need_more) ? "the reply was truncated" : message);
+      }
+
+      //! Whether a query may start under the open deadline_scopes; nothing is sent if not.
+      static common::status may_start() {
+        return common::deadline_scope::check(common::metrics::now_ns());
+      }
+
+      /*!
+      \brief Read datagrams until a whole reply is in, putting split ones back together.
+
+      \c reply views \c buf, or \c split until its next add().  Every datagram must
+      come within \c timeout_usecs of the call.
+      */
+      common::status try_read_reply(int socket, char *buf, split_reassembler &split, std::string_view &reply,
+                                    const char *timeout_message, int timeout_usecs = 1000000) {
+        int left = timeout_usecs;
+        while (true) {
+          common::result<int> t = common::try_wait_for_select(socket, common::wait_readable, left);
+          if (! t.ok()) return t.error();
+          if (t.value() == common::wait_for_select_timeout) {
+            LRCON_METRIC(common::metrics::record_timeout(*stats_));
+            LRCON_TRACE(ev_query_timeout, socket, 0, 0, 0);
+            if (split.pending()) {
+              LRCON_TRACE(ev_query_split_incomplete, socket, 0, split.pending(), 0);
+              return common::status(common::timed_out, "timed out waiting for the rest of a split reply");
+            }
+            return common::status(common::timed_out, timeout_message);
+          }
+          left = t.value();
+
+          common::result<int> received = common::try_read_to_buffer(socket, buf, max_packet_size);
+          if (! received.ok()) return received.error();
+          int read = received.value();
+          LRCON_METRIC(common::metrics::record_received(*stats_, read));
+          LRCON_TRACE(ev_query_recv, socket, 0, read, (read > 4) ? (uint8_t) buf[4] : 0);
+
+          common::status st = split.add(buf, read, common::metrics::now_ns(), reply);
+          if (! st.ok() || ! reply.empty()) return st;
+        }
+      }
+
+      /*!
+      \brief Send a players or rules request with the cached challenge and read the reply.
+
+      If the server answers with a new challenge instead, it is cached and the
+      request is sent again with it.
+      */
+      common::status try_challenged(int socket, codec::packet_type_t type, challenge_cache &cache, char *buf,
+                                    split_reassembler &split, std::string_view &reply, const char *timeout_message) {
+        std::string key = challenge_cache::key(socket);
+        int32_t challenge = cache.get(key);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+          unsigned char pkt[16];
+          std::size_t sz = codec::encode_challenged(pkt, sizeof(pkt), type, challenge);
+          common::result<int> sent = try_send_buffered_packet(socket, pkt, sz);
+          if (! sent.ok()) return sent.error();
+          LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+
+          common::status st = try_read_reply(socket, buf, split, reply, timeout_message);
+          if (! st.ok()) return st;
+          if (reply.size() < 5 || (uint8_t) reply[4] != codec::challenge_reply) return st;
+          codec::decode_t d = codec::decode_challenge(reply.data(), reply.size(), challenge);
+          if (d != codec::decode_ok) return decode_error(d, "invalid challenge reply");
+          QUERY_DEBUG_MESSAGE("  new challenge_num: " << challenge);
+          cache.put(key, challenge);
+        }
+        return common::status(common::protocol_violation, "the server would not accept its own challenge");
+      }
+
+#ifdef LRCON_METRICS
+      common::metrics::connection_stats *stats_;
+      uint64_t started_ns_;
+
+      void metrics_start(common::connection_base &conn) {
+        stats_ = &conn.stats();
+        started_ns_ = common::metrics::now_ns();
+      }
+
+      void metrics_finish() {
+        common::metrics::global().queries.add();
+        common::metrics::global().query_latency.record(common::metrics::now_ns() - started_ns_);
+      }
+#endif
   };
-  
-  
-#if 0
 
+  //! Common properties of static packets (ie, single static send buffer)
+  class static_packet : public query_base {
+     /// atm it seems this is a bit useless
+
+  };
+
+  //! Common properties of dynamic packets (ie, send a header and some data)
+  class dynamic_packet : public query_base {
+    /// atm it seems this is a bit ueeless.. too much function wrapping is just confusing.
+  };
+
+
+  /*!
+  \brief A ping command to measure latency.
+
+  \note This command cannot be used to determine if the host exists as the connection
+        object would detect this and throw an exception.
+
+  \internal
+
+  \todo Perhaps that note means I should maek a connection object which is instancable
+        and merely determines that hte host is existing.
+  */
+  class ping : public static_packet {
+    int latency_;
 
-  //! List of players.
-  class players : public query_base {
     public:
-      players(connection &conn) : query_base() {}
+      //! There was a timeout
+      static const int no_ping = -1;
+      //! Time in usecs to wait
+      static const int timeout = 1000000;
+
+      /*!
+      \throws send_error
+      \throws recv_error
+      */
+      ping(common::connection_base &conn) : latency_(timeout) {
+        run(conn).check();
+      }
+
+      //! Ping without throwing.  \c st says why if it failed.
+      ping(common::connection_base &conn, common::status &st) : latency_(timeout) {
+        st = run(conn);
+      }
+
+      //! Ping without throwing, giving up at \c limit.
+      ping(common::connection_base &conn, const common::deadline &limit, common::status &st) : latency_(timeout) {
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn);
+      }
+
+      //! Did the server reply?
+      bool pingable() const { return latency_ != no_ping; }
+
+      /*!
+      \brief The round trip in microseconds, or no_ping.
+
+      One sample read from the steady clock around the exchange.  For numbers worth
+      ranking servers on, use query::latency_probe.
+      */
+      int latency() const { return latency_; }
+      int latency_ms() const { return (latency_ == no_ping) ? no_ping : latency_ / 1000; }
+
+    protected:
+      common::status run(common::connection_base &conn) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Sending ping packet.");
+        unsigned char pkt[16];
+        std::size_t sz = codec::encode_ping(pkt, sizeof(pkt));
+        uint64_t sent_ns = common::metrics::now_ns();
+        common::result<int> sent = try_send_buffered_packet(conn.socket(), pkt, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+
+        common::result<int> timeleft = common::try_wait_for_select(conn.socket(), common::wait_readable, timeout);
+        if (! timeleft.ok()) return timeleft.error();
+        common::status st;
+        if (timeleft.value() == common::wait_for_select_timeout) {
+          QUERY_DEBUG_MESSAGE("Timeout.");
+          LRCON_METRIC(common::metrics::record_timeout(*stats_));
+          LRCON_TRACE(ev_query_timeout, conn.socket(), 0, 0, 0);
+          latency_ = no_ping;
+        }
+        else {
+          latency_ = (int) ((common::metrics::now_ns() - sent_ns) / 1000);
+          QUERY_DEBUG_MESSAGE("Latency is: " << latency_);
+          st = try_read(conn.socket());
+        }
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      common::status try_read(int socket_fd) {
+        char buf[max_packet_size];
+        common::result<int> received = common::try_read_to_buffer(socket_fd, buf, max_packet_size);
+        if (! received.ok()) return received.error();
+        int read = received.value();
+        LRCON_METRIC(common::metrics::record_received(*stats_, read));
+        LRCON_TRACE(ev_query_recv, socket_fd, 0, read, (read > 4) ? (uint8_t) buf[4] : 0);
+
+        if (read < 5 || buf[4] != 'j') {
+          LRCON_TRACE(ev_query_bad_ping, socket_fd, 0, read, (read > 4) ? (uint8_t) buf[4] : 0);
+          return common::status();
+        }
+
+        const char *ptr = &(buf[4+2]);
+        if (buf[0] == '\0') {
+          QUERY_DEBUG_MESSAGE("Detected a goldsrc server.");
+        }
+        else if (read >= 4 + 2 + 14 && strncmp(ptr, "0000000000000", 14) == 0) {
+          QUERY_DEBUG_MESSAGE("Detected a source server.");
+        }
+        else {
+          LRCON_TRACE(ev_query_bad_ping, socket_fd, 0, read, (uint8_t) buf[4]);
+        }
+
+        if (read > 20) {
+          LRCON_TRACE(ev_query_ping_extra_data, socket_fd, 0, read, 0);
+        }
+        return common::status();
+      }
   };
-  
-  //! Configuration variables.
-  class rules : public query_base {
+
+
+
+  /// question: do you always need a new challenge number for every relevant request?
+
+  /// Extensibility: other games have query protocols.  We could well implement them using
+  /// the same data structures, but the actual send/recv would need to be abstracted.  I
+  /// guess this is for later, but the best solution is probably to have a ping_data
+  /// class and a source_server_ping class.  The specific class takes the data class and
+  /// assigns its members.  Might be better to extend an abstract ping tho.  Better for
+  /// initialisation.  Might involve virtual functions tho... certainly would reduce
+  /// code duplication.
+
+  /*!
+  \brief Query for server name, num players etc.
+
+  The reply is kept and read through data(), which decodes each field only when
+  it is asked for.  Its strings point into this object.
+
+  \code
+  query::info q(conn);
+  if (q.data().players() < q.data().max_players()) join(q.data().map());
+  \endcode
+  */
+  class info : public static_packet {
+    char buf_[max_packet_size];
+    //! The reply if it was split.
+    std::string whole_;
+    codec::info_reader data_;
+
     public:
-      rules(connection &conn) : query_base() {}
+      info(common::connection_base &conn) {
+        run(conn).check();
+      }
+
+      //! Query without throwing.  \c st says why if it failed.
+      info(common::connection_base &conn, common::status &st) {
+        st = run(conn);
+      }
+
+      //! Query without throwing, giving up at \c limit.
+      info(common::connection_base &conn, const common::deadline &limit, common::status &st) {
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn);
+      }
+
+      /*!
+      \brief The reply.  Fields the server cut off read as zero or empty.
+
+      Its status() is not decode_ok if the query failed.
+      */
+      const codec::info_reader &data() const { return data_; }
+
+    protected:
+      common::status run(common::connection_base &conn) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Sending info packet.");
+        unsigned char pkt[32];
+        std::size_t sz = codec::encode_info(pkt, sizeof(pkt));
+        common::result<int> sent = try_send_buffered_packet(conn.socket(), pkt, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+        common::status st = try_read(conn.socket());
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      common::status try_read(int socket) {
+        using common::status;
+        split_reassembler split;
+        std::string_view reply;
+        status st = try_read_reply(socket, buf_, split, reply, "timeout reading an info reply");
+        if (! st.ok()) return st;
+        if (reply.data() != buf_) {
+          whole_.assign(reply.data(), reply.size());
+          reply = whole_;
+        }
+
+        // Only the header; the rest is decoded as it is asked for.
+        codec::decode_t d = data_.open(reply.data(), reply.size());
+        if (d != codec::decode_ok) return decode_error(d, "invalid info reply");
+
+        QUERY_DEBUG_MESSAGE("Properties of read:");
+        QUERY_DEBUG_MESSAGE("  steam version: " << (int) data_.protocol());
+        QUERY_DEBUG_MESSAGE("  server name: " << data_.name());
+        QUERY_DEBUG_MESSAGE("  map: " << data_.map());
+        QUERY_DEBUG_MESSAGE("  game dir: " << data_.folder());
+        QUERY_DEBUG_MESSAGE("  long string: " << data_.game());
+        QUERY_DEBUG_MESSAGE("  steam_app_id: " << data_.app_id());
+        QUERY_DEBUG_MESSAGE("  num_players: " << (int) data_.players());
+        QUERY_DEBUG_MESSAGE("  max_players: " << (int) data_.max_players());
+        QUERY_DEBUG_MESSAGE("  num_bots: " << (int) data_.bots());
+        QUERY_DEBUG_MESSAGE("  server_type: " << (char) data_.server_type());
+        QUERY_DEBUG_MESSAGE("  os_type: " << (char) data_.environment());
+        QUERY_DEBUG_MESSAGE("  passworded: " << data_.password());
+        QUERY_DEBUG_MESSAGE("  vac: " << data_.vac());
+        QUERY_DEBUG_MESSAGE("  game_vers: " << data_.version());
+        QUERY_DEBUG_MESSAGE("  extra_data_flag: " << (int) data_.extra_data());
+        return status();
+      }
+
+    private:
+      info(const info &);
+      info &operator=(const info &);
   };
-  
-#endif
-  
 
-}
+  //! \brief Get the challenge number for use in players and rules queries.
+  class challenge : public static_packet {
+    int32_t challenge_num_;
+
+    public:
+      challenge(common::connection_base &conn) : challenge_num_(0) {
+        run(conn).check();
+      }
 
+      //! Get the challenge without throwing.  \c st says why if it failed.
+      challenge(common::connection_base &conn, common::status &st) : challenge_num_(0) {
+        st = run(conn);
+      }
 
+      //! Get the challenge without throwing, giving up at \c limit.
+      challenge(common::connection_base &conn, const common::deadline &limit, common::status &st) : challenge_num_(0) {
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn);
+      }
 
+      //! Opaque value for the players and rules requests.
+      int32_t challenge_num() {
+        return challenge_num_;
+      }
 
-#endif
+    protected:
+      common::status run(common::connection_base &conn) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Challenge query");
+        unsigned char pkt[16];
+        std::size_t sz = codec::encode_challenge(pkt, sizeof(pkt));
+        common::result<int> sent = try_send_buffered_packet(conn.socket(), pkt, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+        common::status st = try_read(conn.socket());
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      common::status try_read(int socket) {
+        QUERY_DEBUG_MESSAGE("Reading:");
+
+        using common::status;
+
+        common::result<int> t = common::try_wait_for_select(socket);
+        if (! t.ok()) return t.error();
+        if (t.value() == common::wait_for_select_timeout) {
+          LRCON_METRIC(common::metrics::record_timeout(*stats_));
+          LRCON_TRACE(ev_query_timeout, socket, 0, 0, 0);
+          return status(common::timed_out, "timed out reading");
+        }
+
+        char buff[max_packet_size];
+        common::result<int> received = common::try_read_to_buffer(socket, buff, max_packet_size, "failed reading challenge packet");
+        if (! received.ok()) return received.error();
+        int bytes = received.value();
+        LRCON_METRIC(common::metrics::record_received(*stats_, bytes));
+        LRCON_TRACE(ev_query_recv, socket, 0, bytes, (bytes > 4) ? (uint8_t) buff[4] : 0);
+        codec::decode_t d = codec::decode_challenge(buff, bytes, challenge_num_);
+        if (d != codec::decode_ok) return decode_error(d, "invalid challenge reply");
+        QUERY_DEBUG_MESSAGE("  challenge_num: " << challenge_num_);
+        return status();
+      }
+  };
+
+
+
+
+  //! \brief List of players on the server
+  class players : public dynamic_packet {
+    int32_t challenge_no_;
+
+    public:
+      players(common::connection_base &conn) : challenge_no_(0) {
+        run(conn).check();
+      }
+
+      //! Query without throwing.  \c st says why if it failed.
+      players(common::connection_base &conn, common::status &st) : challenge_no_(0) {
+        st = run(conn);
+      }
+
+      //! Query without throwing, giving up at \c limit.
+      players(common::connection_base &conn, const common::deadline &limit, common::status &st) : challenge_no_(0) {
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn);
+      }
+
+      //! Query with the challenge in \c cache instead of asking for one first.
+      players(common::connection_base &conn, challenge_cache &cache) : challenge_no_(0) {
+        run(conn, cache).check();
+      }
+
+      //! Query with the challenge in \c cache, without throwing.  \c st says why if it failed.
+      players(common::connection_base &conn, challenge_cache &cache, common::status &st) : challenge_no_(0) {
+        st = run(conn, cache);
+      }
+
+    protected:
+      common::status run(common::connection_base &conn) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Sending players request.");
+        common::status st;
+        challenge c(conn, st);
+        if (! st.ok()) return st;
+        challenge_no_ = c.challenge_num();
+        st = try_write(conn.socket());
+        if (! st.ok()) return st;
+        st = try_read(conn.socket());
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      //! One round trip while the cached challenge is good, two when it is not.
+      common::status run(common::connection_base &conn, challenge_cache &cache) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Sending players request with a cached challenge.");
+        char buff[max_packet_size];
+        split_reassembler split;
+        std::string_view reply;
+        common::status st = try_challenged(conn.socket(), codec::players_request, cache, buff, split, reply, "timed out reading players");
+        if (st.ok()) st = parse(reply);
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      common::status try_write(int socket) {
+        QUERY_DEBUG_MESSAGE("Sending players request");
+        unsigned char sendbuff[16];
+        std::size_t sz = codec::encode_challenged(sendbuff, sizeof(sendbuff), codec::players_request, challenge_no_);
+        common::result<int> sent = try_send_buffered_packet(socket, sendbuff, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+        return common::status();
+      }
+
+      common::status try_read(int socket) {
+        using common::status;
+
+        QUERY_DEBUG_MESSAGE("Receiving players data:");
+        char buff[max_packet_size];
+        split_reassembler split;
+        std::string_view reply;
+        status st = try_read_reply(socket, buff, split, reply, "timed out reading players");
+        if (! st.ok()) return st;
+        return parse(reply);
+      }
+
+      common::status parse(std::string_view reply) {
+        using common::status;
+
+        codec::player_cursor c;
+        codec::decode_t d = codec::decode_players(reply.data(), reply.size(), c);
+        if (d != codec::decode_ok) return decode_error(d, "invalid players reply");
+        QUERY_DEBUG_MESSAGE("  num players: " << (int) c.count());
+
+        // now a list of players
+        codec::player_view p;
+        while (c.next(p)) {
+          QUERY_DEBUG_MESSAGE("  player num: " << (int) p.index);
+          QUERY_DEBUG_MESSAGE("  player name: " << p.name);
+          QUERY_DEBUG_MESSAGE("  kills: " << p.score);
+          QUERY_DEBUG_MESSAGE("  connect time: " << p.duration);
+        }
+        if (c.status() != codec::decode_ok) return decode_error(c.status(), "invalid players reply");
+        return status();
+      }
+  };
+
+    //////////////////////////////////////////////////////
+    /// NOTE: I stopped updatng the code at this point ///
+    //////////////////////////////////////////////////////
+
+  /*!
+  \brief The rules of a server, by name.
+
+  Every key and value is copied into one string, and an open addressing table of
+  indexes into the entries finds them, so filling the map from a reply of a few
+  hundred rules makes a handful of allocations rather than two per rule.  clear()
+  keeps the memory for the next reply.
+
+  Views returned stay valid until the map is next changed.
+  */
+  class rule_map {
+    public:
+      rule_map() : mask_(0) {}
+
+      //! Empty it, keeping the memory.
+      void clear() {
+        arena_.clear();
+        entries_.clear();
+        slots_.assign(slots_.size(), 0);
+      }
+
+      //! Make room for \c rules rules of \c bytes bytes altogether.
+      void reserve(std::size_t rules, std::size_t bytes) {
+        arena_.reserve(bytes);
+        entries_.reserve(rules);
+        std::size_t want = 16;
+        while (want < rules * 2) want *= 2;
+        if (want > slots_.size()) rehash(want);
+      }
+
+      //! Add a rule, or change its value if it is already there.
+      void set(std::string_view key, std::string_view value) {
+        if ((entries_.size() + 1) * 2 > slots_.size()) rehash(slots_.empty() ? 16 : slots_.size() * 2);
+        uint32_t h = hash(key);
+        uint32_t &s = probe(key, h);
+        if (s == 0) {
+          entry e;
+          e.hash = h;
+          e.key_at = (uint32_t) arena_.size();
+          e.key_len = (uint32_t) key.size();
+          arena_.append(key.data(), key.size());
+          entries_.push_back(e);
+          s = (uint32_t) entries_.size();
+        }
+        entry &e = entries_[s - 1];
+        e.value_at = (uint32_t) arena_.size();
+        e.value_len = (uint32_t) value.size();
+        arena_.append(value.data(), value.size());
+      }
 
+      //! \returns false if there is no such rule.
+      bool find(std::string_view key, std::string_view &value) const {
+        if (slots_.empty()) return false;
+        uint32_t s = const_cast<rule_map *>(this)->probe(key, hash(key));
+        if (s == 0) return false;
+        value = value_at(s - 1);
+        return true;
+      }
 
+      //! The value of \c key, or \c otherwise if there is no such rule.
+      std::string_view get(std::string_view key, std::string_view otherwise = std::string_view()) const {
+        std::string_view v;
+        return find(key, v) ? v : otherwise;
+      }
+
+      std::size_t size() const { return entries_.size(); }
+      bool empty() const { return entries_.empty(); }
+
+      //! The rules in the order they were added, for \c i below size().
+      std::string_view key_at(std::size_t i) const {
+        return std::string_view(arena_.data() + entries_[i].key_at, entries_[i].key_len);
+      }
+      std::string_view value_at(std::size_t i) const {
+        return std::string_view(arena_.data() + entries_[i].value_at, entries_[i].value_len);
+      }
+
+      void swap(rule_map &o) {
+        arena_.swap(o.arena_);
+        entries_.swap(o.entries_);
+        slots_.swap(o.slots_);
+        std::swap(mask_, o.mask_);
+      }
+
+    private:
+      struct entry {
+        uint32_t hash;
+        uint32_t key_at;
+        uint32_t key_len;
+        uint32_t value_at;
+        uint32_t value_len;
+      };
+
+      std::string arena_;
+      std::vector<entry> entries_;
+      //! An index into entries_ plus one, or 0 for an empty slot.
+      std::vector<uint32_t> slots_;
+      std::size_t mask_;
+
+      //! FNV-1a; rule names are short.
+      static uint32_t hash(std::string_view key) {
+        uint32_t h = 2166136261U;
+        for (std::size_t i = 0; i < key.size(); ++i) {
+          h ^= (unsigned char) key[i];
+          h *= 16777619U;
+        }
+        return h;
+      }
+
+      uint32_t &probe(std::string_view key, uint32_t h) {
+        std::size_t i = h & mask_;
+        for (;;) {
+          uint32_t s = slots_[i];
+          if (s == 0) return slots_[i];
+          const entry &e = entries_[s - 1];
+          if (e.hash == h && key_at(s - 1) == key) return slots_[i];
+          i = (i + 1) & mask_;
+        }
+      }
+
+      void rehash(std::size_t capacity) {
+        slots_.assign(capacity, 0);
+        mask_ = capacity - 1;
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+          std::size_t j = entries_[i].hash & mask_;
+          while (slots_[j] != 0) j = (j + 1) & mask_;
+          slots_[j] = (uint32_t) i + 1;
+        }
+      }
+  };
+
+  //! \brief List of some server vars.
+  class rules : public dynamic_packet {
+    int32_t challenge_no_;
+    rule_map map_;
+
+    public:
+      rules(common::connection_base &conn) : challenge_no_(0) {
+        run(conn).check();
+      }
+
+      //! Query without throwing.  \c st says why if it failed.
+      rules(common::connection_base &conn, common::status &st) : challenge_no_(0) {
+        st = run(conn);
+      }
+
+      //! Query without throwing, giving up at \c limit.
+      rules(common::connection_base &conn, const common::deadline &limit, common::status &st) : challenge_no_(0) {
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn);
+      }
+
+      //! Query with the challenge in \c cache instead of asking for one first.
+      rules(common::connection_base &conn, challenge_cache &cache) : challenge_no_(0) {
+        run(conn, cache).check();
+      }
+
+      //! Query with the challenge in \c cache, without throwing.  \c st says why if it failed.
+      rules(common::connection_base &conn, challenge_cache &cache, common::status &st) : challenge_no_(0) {
+        st = run(conn, cache);
+      }
+
+      //! The rules, by name.
+      const rule_map &map() const { return map_; }
+      //! For taking the rules with swap() rather than copying them.
+      rule_map &map() { return map_; }
+
+    protected:
+      common::status run(common::connection_base &conn) {
+        LRCON_METRIC(metrics_start(conn));
+        common::status st;
+        challenge c(conn, st);
+        if (! st.ok()) return st;
+        challenge_no_ = c.challenge_num();
+        st = try_write(conn.socket());
+        if (! st.ok()) return st;
+        st = try_read(conn.socket());
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      //! One round trip while the cached challenge is good, two when it is not.
+      common::status run(common::connection_base &conn, challenge_cache &cache) {
+        LRCON_METRIC(metrics_start(conn));
+        QUERY_DEBUG_MESSAGE("Sending rules request with a cached challenge.");
+        char buff[max_packet_size];
+        split_reassembler split;
+        std::string_view reply;
+        common::status st = try_challenged(conn.socket(), codec::rules_request, cache, buff, split, reply, "timed out reading rules");
+        if (st.ok()) st = parse(conn.socket(), reply);
+        LRCON_METRIC(if (st.ok()) metrics_finish());
+        return st;
+      }
+
+      common::status try_write(int socket) {
+        QUERY_DEBUG_MESSAGE("Sending rules request");
+        unsigned char buff[16];
+        std::size_t sz = codec::encode_challenged(buff, sizeof(buff), codec::rules_request, challenge_no_);
+        common::result<int> sent = try_send_buffered_packet(socket, buff, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+        return common::status();
+      }
+
+      common::status try_read(int socket) {
+        using common::status;
+
+        QUERY_DEBUG_MESSAGE("Receiving rules data");
+        char buff[max_packet_size];
+        split_reassembler split;
+        std::string_view reply;
+        status st = try_read_reply(socket, buff, split, reply, "timed out reading rules");
+        if (! st.ok()) return st;
+        return parse(socket, reply);
+      }
+
+      common::status parse(int socket, std::string_view reply) {
+        using common::status;
+        // Only traced.
+        (void) socket;
+
+        codec::rule_cursor c;
+        codec::decode_t d = codec::decode_rules(reply.data(), reply.size(), c);
+        if (d != codec::decode_ok) return decode_error(d, "invalid rules reply");
+        int num_rules = c.count();
+        QUERY_DEBUG_MESSAGE("  num rules: " << num_rules);
+
+        // The reply's length bounds the bytes of every key and value.
+        map_.clear();
+        map_.reserve(num_rules, reply.size());
+        int rules_read = 0;
+        codec::rule_view rule;
+        while (c.next(rule)) {
+          QUERY_DEBUG_MESSAGE("    " << rule.key << " = " << rule.value);
+          map_.set(rule.key, rule.value);
+          ++rules_read;
+        }
+        if (c.status() != codec::decode_ok) return decode_error(c.status(), "invalid rules reply");
+
+        if (rules_read != num_rules) {
+          LRCON_TRACE(ev_query_rules_mismatch, socket, 0, rules_read, num_rules);
+        }
+        return status();
+      }
+  };
+}
+
+
+
+
+#endif
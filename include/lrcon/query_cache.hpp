@@ -0,0 +1,379 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Query replies kept for a while, so that asking often costs a lookup.
+
+\code
+common::work_pool pool(2);
+query::challenge_cache challenges;
+query::result_cache cache(pool, challenges);
+
+query::result_cache::value_ptr v = cache.get("10.0.0.5", "27015", query::result_cache::kind_info);
+query::codec::info_reader info;
+if (v->ok() && info.open(v->reply.data(), v->reply.size()) == query::codec::decode_ok) {
+  std::cout << info.map() << std::endl;
+}
+\endcode
+*/
+
+#ifndef QUERY_CACHE_HPP_w3f6n9tz
+#define QUERY_CACHE_HPP_w3f6n9tz
+
+#include <lrcon/query.hpp>
+#include <lrcon/work_pool.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief Info, players and rules replies by server, refreshed in the background.
+
+  get() answers from memory whenever it has a reply younger than max_stale_ns.  A
+  reply older than its kind's ttl is still returned at once, and one refresh of it
+  is posted to the work_pool; callers keep getting the old reply until the new one
+  is in.  Only when there is no reply, or it is too old to serve, does get() query
+  the server itself, and callers asking for the same thing meanwhile wait for that
+  one query rather than sending their own.
+
+  A failed query is cached as well, for error_ttl_ns, so that a dead server is not
+  asked on every call.  A failed background refresh leaves the old reply in place
+  and is tried again after error_ttl_ns.
+
+  Values are the whole reply, split ones joined, for the codec to read.  They never
+  change once made, so any number of threads can read one.
+
+  If a query throws, such as bad_alloc, get() and the callers waiting on it get
+  the exception and nothing is cached.
+
+  The pool must outlive the cache.  The destructor waits for refreshes in flight.
+  */
+  class result_cache {
+    public:
+      typedef enum {kind_info, kind_players, kind_rules, kinds} kind_t;
+
+      struct options {
+        //! How long each kind of reply is fresh, by kind_t.
+        uint64_t ttl_ns[kinds];
+        //! Older than this a reply is not served at all.
+        uint64_t max_stale_ns;
+        //! How long a failure is remembered.
+        uint64_t error_ttl_ns;
+        //! When there are this many entries, expired ones are dropped, then the oldest.
+        std::size_t max_entries;
+
+        options() : max_stale_ns(300 * 1000000000ULL), error_ttl_ns(2 * 1000000000ULL), max_entries(65536) {
+          ttl_ns[kind_info] = 5 * 1000000000ULL;
+          ttl_ns[kind_players] = 5 * 1000000000ULL;
+          ttl_ns[kind_rules] = 60 * 1000000000ULL;
+        }
+      };
+
+      //! One reply as it was cached.
+      struct value {
+        //! Empty if the query failed.
+        std::string reply;
+        common::status status;
+        //! When it came, on common::metrics::now_ns().
+        uint64_t fetched_ns;
+
+        bool ok() const { return status.ok(); }
+      };
+      typedef std::shared_ptr<const value> value_ptr;
+
+      //! How get() calls were answered.
+      struct counters {
+        //! From a reply within its ttl.
+        uint64_t fresh;
+        //! From an older reply while it was refreshed.
+        uint64_t stale;
+        //! By waiting for a query.
+        uint64_t misses;
+        //! Background refreshes posted.
+        uint64_t refreshes;
+      };
+
+      result_cache(common::work_pool &pool, challenge_cache &challenges, const options &o = options())
+      : pool_(pool), challenges_(challenges), opt_(o), in_flight_(0) {
+        counters_.fresh = counters_.stale = counters_.misses = counters_.refreshes = 0;
+      }
+
+      ~result_cache() {
+        std::unique_lock<std::mutex> l(mutex_);
+        idle_.wait(l, [this]() { return in_flight_ == 0; });
+      }
+
+      //! The reply for \c kind from the server at \c address and \c port; never NULL.
+      value_ptr get(const std::string &address, const std::string &port, kind_t kind) {
+        std::string k = key(address, port, kind);
+        uint64_t now = common::metrics::now_ns();
+        std::shared_future<value_ptr> wait;
+        std::promise<value_ptr> mine;
+        {
+          std::lock_guard<std::mutex> l(mutex_);
+          entry &e = entries_[k];
+          if (e.current && now - e.current->fetched_ns < fresh_for(*e.current, kind)) {
+            ++counters_.fresh;
+            return e.current;
+          }
+          if (e.current && e.current->ok() && now - e.current->fetched_ns < opt_.max_stale_ns) {
+            ++counters_.stale;
+            if (! e.refreshing && now >= e.retry_at) refresh(e, k, address, port, kind);
+            return e.current;
+          }
+
+          ++counters_.misses;
+          if (e.loading.valid()) {
+            wait = e.loading;
+          }
+          else {
+            e.loading = mine.get_future().share();
+            ++in_flight_;
+          }
+        }
+        if (wait.valid()) return wait.get();
+
+        value_ptr v;
+        try {
+          v = fetch(address, port, kind);
+        }
+        catch (...) {
+          // Whoever waits for this query gets the exception too, and the next get() tries again.
+          {
+            std::lock_guard<std::mutex> l(mutex_);
+            entries_[k].loading = std::shared_future<value_ptr>();
+          }
+          mine.set_exception(std::current_exception());
+          done();
+          throw;
+        }
+        {
+          std::lock_guard<std::mutex> l(mutex_);
+          entry &e = entries_[k];
+          e.current = v;
+          e.loading = std::shared_future<value_ptr>();
+          trim();
+        }
+        mine.set_value(v);
+        done();
+        return v;
+      }
+
+      //! Forget a server's reply so the next get() asks for it.
+      void forget(const std::string &address, const std::string &port, kind_t kind) {
+        std::lock_guard<std::mutex> l(mutex_);
+        entry_map::iterator i = entries_.find(key(address, port, kind));
+        if (i != entries_.end() && ! busy(i->second)) entries_.erase(i);
+      }
+
+      std::size_t size() {
+        std::lock_guard<std::mutex> l(mutex_);
+        return entries_.size();
+      }
+
+      counters stats() {
+        std::lock_guard<std::mutex> l(mutex_);
+        return counters_;
+      }
+
+    private:
+      struct entry {
+        value_ptr current;
+        //! Set while a get() queries for a missing reply.
+        std::shared_future<value_ptr> loading;
+        bool refreshing;
+        //! No refresh before this, after one failed.
+        uint64_t retry_at;
+
+        entry() : refreshing(false), retry_at(0) {}
+      };
+
+      typedef std::unordered_map<std::string, entry> entry_map;
+
+      //! Runs one query and keeps its reply.
+      class fetcher : public query_base {
+        public:
+          common::status run(common::connection_base &conn, kind_t kind, challenge_cache &cache, std::string &out) {
+            LRCON_METRIC(metrics_start(conn));
+            char buf[max_packet_size];
+            split_reassembler split;
+            std::string_view reply;
+            common::status st;
+            codec::decode_t d;
+            switch (kind) {
+              case kind_info: {
+                st = try_info(conn.socket(), cache, buf, split, reply);
+                if (! st.ok()) return st;
+                codec::info_reader r;
+                d = r.open(reply.data(), reply.size());
+                break;
+              }
+              case kind_players: {
+                st = try_challenged(conn.socket(), codec::players_request, cache, buf, split, reply,
+                                    "timed out reading players");
+                if (! st.ok()) return st;
+                codec::player_cursor c;
+                d = codec::decode_players(reply.data(), reply.size(), c);
+                break;
+              }
+              default: {
+                st = try_challenged(conn.socket(), codec::rules_request, cache, buf, split, reply,
+                                    "timed out reading rules");
+                if (! st.ok()) return st;
+                codec::rule_cursor c;
+                d = codec::decode_rules(reply.data(), reply.size(), c);
+                break;
+              }
+            }
+            if (d != codec::decode_ok) return decode_error(d, "invalid reply");
+            out.assign(reply.data(), reply.size());
+            LRCON_METRIC(metrics_finish());
+            return st;
+          }
+
+        private:
+          //! Info with the cached challenge, for servers which want one; others ignore it.
+          common::status try_info(int socket, challenge_cache &cache, char *buf, split_reassembler &split,
+                                  std::string_view &reply) {
+            std::string key = challenge_cache::key(socket);
+            int32_t challenge = cache.get(key);
+            for (int attempt = 0; attempt < 2; ++attempt) {
+              unsigned char pkt[32];
+              std::size_t sz = (challenge == codec::no_challenge) ? codec::encode_info(pkt, sizeof(pkt))
+                                                                  : codec::encode_info(pkt, sizeof(pkt), challenge);
+              common::result<int> sent = try_send_buffered_packet(socket, pkt, sz);
+              if (! sent.ok()) return sent.error();
+              LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+
+              common::status st = try_read_reply(socket, buf, split, reply, "timeout reading an info reply");
+              if (! st.ok()) return st;
+              if (reply.size() < 5 || (uint8_t) reply[4] != codec::challenge_reply) return st;
+              codec::decode_t d = codec::decode_challenge(reply.data(), reply.size(), challenge);
+              if (d != codec::decode_ok) return decode_error(d, "invalid challenge reply");
+              cache.put(key, challenge);
+            }
+            return common::status(common::protocol_violation, "the server would not accept its own challenge");
+          }
+      };
+
+      common::work_pool &pool_;
+      challenge_cache &challenges_;
+      options opt_;
+      std::mutex mutex_;
+      std::condition_variable idle_;
+      entry_map entries_;
+      //! Queries running, in get() or on the pool.
+      unsigned in_flight_;
+      counters counters_;
+
+      static std::string key(const std::string &address, const std::string &port, kind_t kind) {
+        std::string k;
+        k.reserve(address.size() + port.size() + 2);
+        k += address;
+        k += ':';
+        k += port;
+        k += (char) ('0' + kind);
+        return k;
+      }
+
+      static kind_t kind_of(const std::string &key) { return (kind_t) (key[key.size() - 1] - '0'); }
+
+      uint64_t fresh_for(const value &v, kind_t kind) const {
+        return v.ok() ? opt_.ttl_ns[kind] : opt_.error_ttl_ns;
+      }
+
+      static bool busy(const entry &e) { return e.refreshing || e.loading.valid(); }
+
+      //! Post a refresh of \c e.  Called with mutex_ held.
+      void refresh(entry &e, const std::string &k, const std::string &address, const std::string &port, kind_t kind) {
+        e.refreshing = true;
+        ++in_flight_;
+        ++counters_.refreshes;
+        pool_.post([this, k, address, port, kind]() {
+          value_ptr v;
+          try {
+            v = fetch(address, port, kind);
+          }
+          catch (...) {
+            // Such as bad_alloc; treated as a failed refresh, with nobody to tell.
+          }
+          {
+            std::lock_guard<std::mutex> l(mutex_);
+            entry &e = entries_[k];
+            e.refreshing = false;
+            if (v && v->ok()) e.current = v;
+            else e.retry_at = common::metrics::now_ns() + opt_.error_ttl_ns;
+            trim();
+          }
+          done();
+        });
+      }
+
+      void done() {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (--in_flight_ == 0) idle_.notify_all();
+      }
+
+      /*!
+      \brief Make room when there are max_entries entries.  Called with mutex_ held.
+
+      Replies past their ttl go first.  If that is not enough, the oldest go until
+      an eighth of the entries are free, so that this does not run on every insert.
+      */
+      void trim() {
+        if (entries_.size() < opt_.max_entries) return;
+        uint64_t now = common::metrics::now_ns();
+        std::vector<std::pair<uint64_t, entry_map::iterator> > old;
+        for (entry_map::iterator i = entries_.begin(); i != entries_.end();) {
+          const entry &e = i->second;
+          if (busy(e)) {
+            ++i;
+          }
+          else if (! e.current || now - e.current->fetched_ns >= fresh_for(*e.current, kind_of(i->first))) {
+            i = entries_.erase(i);
+          }
+          else {
+            old.push_back(std::make_pair(e.current->fetched_ns, i));
+            ++i;
+          }
+        }
+
+        std::size_t keep = opt_.max_entries - opt_.max_entries / 8;
+        if (entries_.size() <= keep) return;
+        std::size_t drop = std::min(entries_.size() - keep, old.size());
+        std::nth_element(old.begin(), old.begin() + drop, old.end(),
+                         [](const std::pair<uint64_t, entry_map::iterator> &a,
+                            const std::pair<uint64_t, entry_map::iterator> &b) { return a.first < b.first; });
+        for (std::size_t i = 0; i < drop; ++i) entries_.erase(old[i].second);
+      }
+
+      value_ptr fetch(const std::string &address, const std::string &port, kind_t kind) {
+        std::shared_ptr<value> v(new value);
+        query::host h(address.c_str(), port.c_str(), false, v->status);
+        if (v->status.ok()) {
+          connection conn(h, v->status);
+          if (v->status.ok()) {
+            fetcher f;
+            v->status = f.run(conn, kind, challenges_, v->reply);
+            if (! v->status.ok()) v->reply.clear();
+          }
+        }
+        v->fetched_ns = common::metrics::now_ns();
+        return v;
+      }
+
+      result_cache(const result_cache &);
+      result_cache &operator=(const result_cache &);
+  };
+}
+
+#endif
@@ -0,0 +1,93 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Remembers each server's challenge number so it needn't be asked for every time.
+
+\code
+query::challenge_cache challenges;
+common::status st;
+query::players p(conn, challenges, st);  // one round trip once the challenge is known
+\endcode
+*/
+
+#ifndef QUERY_CHALLENGE_HPP_q7j3x5nb
+#define QUERY_CHALLENGE_HPP_q7j3x5nb
+
+#include <lrcon/common.hpp>
+#include <lrcon/query_codec.hpp>
+
+#include <sys/socket.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace query {
+  /*!
+  \brief The last challenge number each server gave, by its address.
+
+  A server hands out a challenge which stays valid for a while.  Queries which
+  take a cache send the one stored here, or codec::no_challenge if there is none.
+  When the server answers with a new challenge instead, they store it and ask
+  again, so a stale entry costs one extra round trip and nothing more.
+
+  Thread-safe, so one cache can serve every query in a program.  When it holds
+  max_entries it is emptied, because the challenges are cheap to get back.
+  */
+  class challenge_cache {
+    public:
+      static const std::size_t default_max_entries = 65536;
+
+      explicit challenge_cache(std::size_t max_entries = default_max_entries) : max_entries_(max_entries) {}
+
+      //! The key for the server a connected socket talks to.  Empty if it has no peer.
+      static std::string key(int socket) {
+        struct sockaddr_storage a;
+        socklen_t len = sizeof(a);
+        if (getpeername(socket, (struct sockaddr *) &a, &len) == -1) return std::string();
+        return key((const struct sockaddr *) &a, len);
+      }
+
+      //! The key for a server's address.
+      static std::string key(const struct sockaddr *addr, socklen_t len) {
+        return std::string((const char *) addr, len);
+      }
+
+      //! The stored challenge, or codec::no_challenge.
+      int32_t get(const std::string &key) {
+        std::lock_guard<std::mutex> l(mutex_);
+        map_t::const_iterator i = challenges_.find(key);
+        return (i == challenges_.end()) ? codec::no_challenge : i->second;
+      }
+
+      void put(const std::string &key, int32_t challenge) {
+        if (key.empty()) return;
+        std::lock_guard<std::mutex> l(mutex_);
+        if (challenges_.size() >= max_entries_ && challenges_.find(key) == challenges_.end()) challenges_.clear();
+        challenges_[key] = challenge;
+      }
+
+      void forget(const std::string &key) {
+        std::lock_guard<std::mutex> l(mutex_);
+        challenges_.erase(key);
+      }
+
+      std::size_t size() {
+        std::lock_guard<std::mutex> l(mutex_);
+        return challenges_.size();
+      }
+
+    private:
+      typedef std::unordered_map<std::string, int32_t> map_t;
+
+      std::size_t max_entries_;
+      std::mutex mutex_;
+      map_t challenges_;
+
+      challenge_cache(const challenge_cache &);
+      challenge_cache &operator=(const challenge_cache &);
+  };
+}
+
+#endif
@@ -0,0 +1,518 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Encoding and decoding of server query (A2S) packets without any I/O.
+
+Requests are encoded into a caller's buffer and replies are decoded into views of
+the datagram.  Nothing allocates.  Replies are decoded whole: ones which were
+split over several datagrams are joined first by query::split_reassembler in
+query_split.hpp.  So decode_need_more means the reply was truncated.
+
+\code
+unsigned char dgram[query::codec::max_packet_size];
+ssize_t n = recv(fd, dgram, sizeof(dgram), 0);
+query::codec::info_view info;
+if (query::codec::decode_info(dgram, n, info) == common::codec::decode_ok) {
+  use(info.map);
+}
+\endcode
+*/
+
+#ifndef QUERY_CODEC_HPP_h2n7r0ex
+#define QUERY_CODEC_HPP_h2n7r0ex
+
+#include <lrcon/codec.hpp>
+
+namespace query {
+  //! I/O free server query codec; see \link query_codec.hpp \endlink.
+  namespace codec {
+    using common::codec::decode_t;
+    using common::codec::decode_ok;
+    using common::codec::decode_need_more;
+    using common::codec::decode_invalid;
+
+    //! Largest datagram a server sends.
+    const std::size_t max_packet_size = 1400;
+
+    //! First four bytes of every packet.
+    typedef enum {split_single = -1, split_multiple = -2} split_type_t;
+
+    //! The type byte which follows the split type.
+    typedef enum {
+      ping_request = 0x69,
+      info_request = 0x54,
+      challenge_request = 0x57,
+      players_request = 0x55,
+      rules_request = 0x56,
+
+      ping_reply = 0x6A,
+      info_reply = 0x49,
+      challenge_reply = 0x41,
+      players_reply = 0x44,
+      rules_reply = 0x45
+    } packet_type_t;
+
+    //! Sent in place of a challenge to ask the server for one.
+    const int32_t no_challenge = -1;
+
+    //! Payload of an info request.
+    constexpr char info_payload[] = "Source Engine Query";
+
+    using common::codec::layout;
+    using common::codec::field;
+    using common::codec::constant;
+    using common::codec::literal;
+
+    //! The split type of an unsplit packet.
+    typedef constant<int32_t, split_single> single_packet;
+
+    //! \name Packet layouts
+    //@{
+    //! A challenge number, which is the same in the request and the reply.
+    struct challenge_fields {
+      int32_t challenge;
+    };
+
+    typedef layout<single_packet, constant<uint8_t, ping_request> > ping_layout;
+    typedef layout<single_packet, constant<uint8_t, info_request>, literal<info_payload> > info_request_layout;
+    //! Servers updated since 2020 may want a challenge on info requests too.
+    typedef layout<single_packet, constant<uint8_t, info_request>, literal<info_payload>,
+                   field<&challenge_fields::challenge> > challenged_info_request_layout;
+    typedef layout<single_packet, constant<uint8_t, challenge_request> > challenge_request_layout;
+    typedef layout<single_packet, constant<uint8_t, players_request>,
+                   field<&challenge_fields::challenge> > players_request_layout;
+    typedef layout<single_packet, constant<uint8_t, rules_request>,
+                   field<&challenge_fields::challenge> > rules_request_layout;
+    typedef layout<single_packet, constant<uint8_t, challenge_reply>,
+                   field<&challenge_fields::challenge> > challenge_reply_layout;
+    //@}
+
+    //! \name Requests
+    //! Each returns the bytes written or 0 if \c cap is too small.
+    //@{
+    inline std::size_t encode_ping(void *buf, std::size_t cap) {
+      return ping_layout::encode(buf, cap);
+    }
+
+    inline std::size_t encode_info(void *buf, std::size_t cap) {
+      return info_request_layout::encode(buf, cap);
+    }
+
+    //! An info request carrying the challenge the server replied to the plain one with.
+    inline std::size_t encode_info(void *buf, std::size_t cap, int32_t challenge) {
+      challenge_fields f;
+      f.challenge = challenge;
+      return challenged_info_request_layout::encode(buf, cap, f);
+    }
+
+    inline std::size_t encode_challenge(void *buf, std::size_t cap) {
+      return challenge_request_layout::encode(buf, cap);
+    }
+
+    //! \param type  players_request or rules_request.
+    //! \param challenge  as returned by decode_challenge(), or no_challenge to be sent one.
+    inline std::size_t encode_challenged(void *buf, std::size_t cap, packet_type_t type, int32_t challenge) {
+      challenge_fields f;
+      f.challenge = challenge;
+      if (type == players_request) return players_request_layout::encode(buf, cap, f);
+      return rules_request_layout::encode(buf, cap, f);
+    }
+    //@}
+
+    //! The header common to all replies.
+    struct header_view {
+      int32_t split_type;
+      uint8_t type;
+    };
+
+    typedef layout<field<&header_view::split_type>, field<&header_view::type> > header_layout;
+
+    //! Decode the split type and packet type.
+    inline decode_t decode_header(const void *buf, std::size_t len, header_view &out) {
+      decode_t d = header_layout::decode(buf, len, out);
+      if (d != decode_ok) return d;
+      if (out.split_type != split_single && out.split_type != split_multiple) return decode_invalid;
+      return decode_ok;
+    }
+
+    //! Decode a challenge reply.  The number is passed unchanged to encode_challenged().
+    inline decode_t decode_challenge(const void *buf, std::size_t len, int32_t &challenge) {
+      challenge_fields f;
+      std::size_t used;
+      decode_t d = challenge_reply_layout::decode(buf, len, f, &used);
+      if (d != decode_ok) return d;
+      challenge = f.challenge;
+      return (used == len) ? decode_ok : decode_invalid;
+    }
+
+    //! Extra data flags in an info reply.
+    typedef enum {
+      edf_port = 0x80,
+      edf_steam_id = 0x10,
+      edf_spectator = 0x40,
+      edf_keywords = 0x20,
+      edf_game_id = 0x01
+    } extra_data_t;
+
+    //! A decoded info reply.  Strings point into the datagram.
+    struct info_view {
+      uint8_t protocol;
+      std::string_view name;
+      std::string_view map;
+      std::string_view folder;
+      std::string_view game;
+      uint16_t app_id;
+      uint8_t players;
+      uint8_t max_players;
+      uint8_t bots;
+      //! 'd'edicated, 'l'isten or 'p' for sourcetv.
+      char server_type;
+      //! 'l'inux, 'w'indows or 'm'ac.
+      char environment;
+      bool password;
+      bool vac;
+      std::string_view version;
+      //! Bitmask of extra_data_t saying which of the following are valid.
+      uint8_t extra_data;
+      uint16_t port;
+      uint64_t steam_id;
+      uint16_t spectator_port;
+      std::string_view spectator_name;
+      std::string_view keywords;
+      uint64_t game_id;
+    };
+
+    //! The info reply up to the optional extra data.
+    typedef layout<
+      single_packet, constant<uint8_t, info_reply>,
+      field<&info_view::protocol>,
+      field<&info_view::name>,
+      field<&info_view::map>,
+      field<&info_view::folder>,
+      field<&info_view::game>,
+      field<&info_view::app_id>,
+      field<&info_view::players>,
+      field<&info_view::max_players>,
+      field<&info_view::bots>,
+      field<&info_view::server_type>,
+      field<&info_view::environment>,
+      field<&info_view::password>,
+      field<&info_view::vac>,
+      field<&info_view::version> > info_layout;
+
+    inline decode_t decode_info(const void *buf, std::size_t len, info_view &out) {
+      std::size_t used;
+      decode_t d = info_layout::decode(buf, len, out, &used);
+      if (d != decode_ok) return d;
+
+      // The extra data fields depend on the flags so they are read one at a time.
+      common::codec::reader r((const unsigned char *) buf + used, len - used);
+      out.extra_data = r.remaining() ? r.get<uint8_t>() : 0;
+      out.port = (out.extra_data & edf_port) ? r.get<uint16_t>() : 0;
+      out.steam_id = (out.extra_data & edf_steam_id) ? r.get<uint64_t>() : 0;
+      out.spectator_port = 0;
+      out.spectator_name = std::string_view();
+      if (out.extra_data & edf_spectator) {
+        out.spectator_port = r.get<uint16_t>();
+        out.spectator_name = r.cstring();
+      }
+      out.keywords = (out.extra_data & edf_keywords) ? r.cstring() : std::string_view();
+      out.game_id = (out.extra_data & edf_game_id) ? r.get<uint64_t>() : 0;
+      return r.status();
+    }
+
+    //! What an info reply says the server is.  GoldSrc sends capitals, which are folded.
+    typedef enum {
+      server_dedicated = 'd',
+      server_listen = 'l',
+      server_sourcetv = 'p'
+    } server_type_t;
+
+    //! The server's OS in an info reply.  Old servers say 'o' for mac.
+    typedef enum {
+      os_linux = 'l',
+      os_windows = 'w',
+      os_mac = 'm'
+    } environment_t;
+
+    /*!
+    \brief An info reply which is decoded a field at a time, when it is asked for.
+
+    open() only checks the header.  Each accessor then finds its field, scanning
+    the strings in front of it once and remembering where they ended, so asking
+    for players() costs four memchr()s and asking for nothing costs nothing.
+    Strings point into the datagram, which must outlive the reader.
+
+    A field which is cut off reads as zero or empty and status() says so from then
+    on.  Not thread-safe, even through const accessors.
+
+    \code
+    query::codec::info_reader r;
+    if (r.open(dgram, n) == common::codec::decode_ok && r.players() < r.max_players()) {
+      use(r.map());
+    }
+    \endcode
+    */
+    class info_reader {
+      public:
+        info_reader() : buf_(NULL), len_(0) { reset(decode_need_more); }
+
+        //! Check the header.  Nothing else is read until it is asked for.
+        decode_t open(const void *buf, std::size_t len) {
+          buf_ = (const unsigned char *) buf;
+          len_ = len;
+          header_view h;
+          decode_t d = header_layout::decode(buf, len, h);
+          if (d == decode_ok && (h.split_type != split_single || h.type != info_reply)) d = decode_invalid;
+          if (d == decode_ok && len < body_start) d = decode_need_more;
+          reset(d);
+          return d;
+        }
+
+        //! decode_ok unless open() failed or a field asked for was cut off.
+        decode_t status() const { return status_; }
+
+        uint8_t protocol() const { return (status_ == decode_invalid || len_ < body_start) ? 0 : buf_[body_start - 1]; }
+
+        std::string_view name() const { return string(part_name); }
+        std::string_view map() const { return string(part_map); }
+        std::string_view folder() const { return string(part_folder); }
+        std::string_view game() const { return string(part_game); }
+
+        uint16_t app_id() const { return fixed<uint16_t>(0); }
+        uint8_t players() const { return fixed<uint8_t>(2); }
+        uint8_t max_players() const { return fixed<uint8_t>(3); }
+        uint8_t bots() const { return fixed<uint8_t>(4); }
+        server_type_t server_type() const { return (server_type_t) lower(fixed<uint8_t>(5)); }
+        environment_t environment() const {
+          char e = lower(fixed<uint8_t>(6));
+          return (e == 'o') ? os_mac : (environment_t) e;
+        }
+        bool password() const { return fixed<uint8_t>(7) != 0; }
+        bool vac() const { return fixed<uint8_t>(8) != 0; }
+
+        std::string_view version() const { return string(part_version); }
+
+        //! Bitmask of extra_data_t saying which of the following are present.
+        uint8_t extra_data() const {
+          std::size_t e = end_of(part_version);
+          return (e == 0 || e == len_) ? 0 : buf_[e];
+        }
+
+        uint16_t port() const { return extra<uint16_t>(edf_port); }
+        uint64_t steam_id() const { return extra<uint64_t>(edf_steam_id); }
+        uint16_t spectator_port() const { return extra<uint16_t>(edf_spectator); }
+        std::string_view spectator_name() const {
+          common::codec::reader r(buf_, 0);
+          if (! seek_extra(edf_spectator, r)) return std::string_view();
+          r.skip(sizeof(uint16_t));
+          return checked(r, r.cstring());
+        }
+        std::string_view keywords() const {
+          common::codec::reader r(buf_, 0);
+          if (! seek_extra(edf_keywords, r)) return std::string_view();
+          return checked(r, r.cstring());
+        }
+        uint64_t game_id() const { return extra<uint64_t>(edf_game_id); }
+
+      private:
+        //! Split type, packet type and protocol.
+        static const std::size_t body_start = 6;
+        //! app_id to vac.
+        static const std::size_t fixed_size = 9;
+
+        //! The parts of the reply in order.  Each one's end is found from the last's.
+        enum {part_name, part_map, part_folder, part_game, part_fixed, part_version, parts};
+
+        const unsigned char *buf_;
+        std::size_t len_;
+        mutable decode_t status_;
+        //! Offset just past each part found so far.
+        mutable std::size_t ends_[parts];
+        mutable unsigned found_;
+
+        void reset(decode_t d) {
+          status_ = d;
+          found_ = 0;
+        }
+
+        //! Where \c part ends, finding it and those before it if need be.  0 if it is cut off.
+        std::size_t end_of(unsigned part) const {
+          if (status_ == decode_invalid || len_ < body_start) return 0;
+          while (found_ <= part) {
+            std::size_t start = found_ ? ends_[found_ - 1] : body_start;
+            std::size_t end;
+            if (found_ == part_fixed) {
+              end = start + fixed_size;
+              if (end > len_) return cut_off();
+            }
+            else {
+              const void *nul = std::memchr(buf_ + start, '\0', len_ - start);
+              if (nul == NULL) return cut_off();
+              end = (const unsigned char *) nul - buf_ + 1;
+            }
+            ends_[found_++] = end;
+          }
+          return ends_[part];
+        }
+
+        std::size_t cut_off() const {
+          if (status_ == decode_ok) status_ = decode_need_more;
+          return 0;
+        }
+
+        std::string_view string(unsigned part) const {
+          std::size_t end = end_of(part);
+          if (end == 0) return std::string_view();
+          std::size_t start = part ? ends_[part - 1] : body_start;
+          return std::string_view((const char *) buf_ + start, end - start - 1);
+        }
+
+        template <typename T>
+        T fixed(std::size_t offset) const {
+          std::size_t end = end_of(part_fixed);
+          return end ? common::codec::load_le<T>(buf_ + end - fixed_size + offset) : T();
+        }
+
+        static char lower(uint8_t c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+        //! Move \c r to the extra data field \c flag.  False if that field is not there.
+        bool seek_extra(uint8_t flag, common::codec::reader &r) const {
+          uint8_t flags = extra_data();
+          if (! (flags & flag)) return false;
+          std::size_t start = ends_[part_version] + 1;
+          r = common::codec::reader(buf_ + start, len_ - start);
+          // The order they are sent in.
+          static const uint8_t order[] = {edf_port, edf_steam_id, edf_spectator, edf_keywords, edf_game_id};
+          for (std::size_t i = 0; order[i] != flag; ++i) {
+            if (! (flags & order[i])) continue;
+            if (order[i] == edf_port) r.skip(sizeof(uint16_t));
+            else if (order[i] == edf_steam_id) r.skip(sizeof(uint64_t));
+            else if (order[i] == edf_spectator) {
+              r.skip(sizeof(uint16_t));
+              r.cstring();
+            }
+            else r.cstring();
+          }
+          return true;
+        }
+
+        template <typename T>
+        T extra(uint8_t flag) const {
+          common::codec::reader r(buf_, 0);
+          if (! seek_extra(flag, r)) return T();
+          return checked(r, r.get<T>());
+        }
+
+        //! \c v, having noted whether reading it ran off the end.
+        template <typename T>
+        T checked(const common::codec::reader &r, T v) const {
+          if (! r.ok()) {
+            cut_off();
+            return T();
+          }
+          return v;
+        }
+    };
+
+    /*!
+    \brief Walks a list of records which follow a reply header.
+
+    \c Layout decodes one record of type \c Record.  next() returns false at the end
+    of the data or if a record was truncated, which status() then reports.
+    */
+    template <typename Record, typename Layout, typename Count>
+    class record_cursor {
+      const unsigned char *pos_;
+      const unsigned char *end_;
+      Count count_;
+      decode_t status_;
+
+      public:
+        record_cursor() : pos_(NULL), end_(NULL), count_(0), status_(decode_ok) {}
+        record_cursor(const unsigned char *pos, const unsigned char *end, Count count)
+        : pos_(pos), end_(end), count_(count), status_(decode_ok) {}
+
+        //! Number of records the server says it sent.
+        Count count() const { return count_; }
+
+        bool next(Record &out) {
+          if (pos_ == end_ || status_ != decode_ok) return false;
+          std::size_t used;
+          status_ = Layout::decode(pos_, end_ - pos_, out, &used);
+          if (status_ != decode_ok) return false;
+          pos_ += used;
+          return true;
+        }
+
+        //! decode_ok unless the last record was truncated.
+        decode_t status() const { return status_; }
+    };
+
+    //! The count which follows a players or rules header.
+    template <typename Count>
+    struct count_fields {
+      Count count;
+    };
+
+    //! Decode a reply header and count then start a cursor over the records.
+    template <typename Cursor, packet_type_t Type, typename Count>
+    inline decode_t begin_records(const void *buf, std::size_t len, Cursor &out) {
+      typedef layout<single_packet, constant<uint8_t, Type>, field<&count_fields<Count>::count> > head_layout;
+      count_fields<Count> head;
+      std::size_t used;
+      decode_t d = head_layout::decode(buf, len, head, &used);
+      if (d != decode_ok) return d;
+      const unsigned char *p = (const unsigned char *) buf;
+      out = Cursor(p + used, p + len, head.count);
+      return decode_ok;
+    }
+
+    //! One player from a players reply.
+    struct player_view {
+      uint8_t index;
+      std::string_view name;
+      int32_t score;
+      //! Seconds connected.
+      float duration;
+    };
+
+    typedef layout<field<&player_view::index>, field<&player_view::name>,
+                   field<&player_view::score>, field<&player_view::duration> > player_layout;
+
+    /*!
+    \brief Iterates the players in a players reply.
+
+    \code
+    query::codec::player_cursor c;
+    if (query::codec::decode_players(buf, len, c) != common::codec::decode_ok) fail();
+    query::codec::player_view p;
+    while (c.next(p)) use(p);
+    if (c.status() != common::codec::decode_ok) fail();
+    \endcode
+    */
+    typedef record_cursor<player_view, player_layout, uint8_t> player_cursor;
+
+    inline decode_t decode_players(const void *buf, std::size_t len, player_cursor &out) {
+      return begin_records<player_cursor, players_reply, uint8_t>(buf, len, out);
+    }
+
+    //! One rule from a rules reply.
+    struct rule_view {
+      std::string_view key;
+      std::string_view value;
+    };
+
+    typedef layout<field<&rule_view::key>, field<&rule_view::value> > rule_layout;
+
+    //! Iterates the rules in a rules reply, like player_cursor.
+    typedef record_cursor<rule_view, rule_layout, uint16_t> rule_cursor;
+
+    inline decode_t decode_rules(const void *buf, std::size_t len, rule_cursor &out) {
+      return begin_records<rule_cursor, rules_reply, uint16_t>(buf, len, out);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,334 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief The info replies of a whole fleet as columns, for scanning and adding up.
+
+\code
+query::fleet_table fleet;
+fleet.add(scan);  // a query::scanner after run()
+query::fleet_table::filter f;
+f.map = fleet.maps().find("de_dust2");
+f.min_players = 21;
+std::vector<uint32_t> rows;
+fleet.select(f, rows);
+std::cout << rows.size() << " servers, " << fleet.sum_players(rows) << " players" << std::endl;
+\endcode
+*/
+
+#ifndef QUERY_FLEET_HPP_k2x7b4se
+#define QUERY_FLEET_HPP_k2x7b4se
+
+#include <lrcon/query_codec.hpp>
+#include <lrcon/query_scanner.hpp>
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief Strings numbered in the order they were first seen.
+
+  A fleet has thousands of servers but only tens of maps and games, so each is
+  stored once and the columns hold its number.  Code 0 is always the empty
+  string, which is what servers that did not reply get.
+  */
+  class string_dictionary {
+    public:
+      static const uint32_t npos = ~uint32_t(0);
+
+      string_dictionary() : mask_(0) { intern(std::string_view()); }
+
+      //! The code for \c s, adding it if it is new.
+      uint32_t intern(std::string_view s) {
+        if ((spans_.size() + 1) * 2 > slots_.size()) rehash(slots_.empty() ? 64 : slots_.size() * 2);
+        uint32_t h = hash(s);
+        uint32_t &slot = probe(s, h);
+        if (slot == 0) {
+          span sp = {h, (uint32_t) arena_.size(), (uint32_t) s.size()};
+          arena_.append(s.data(), s.size());
+          spans_.push_back(sp);
+          slot = (uint32_t) spans_.size();
+        }
+        return slot - 1;
+      }
+
+      //! The code for \c s, or npos if it has not been seen.
+      uint32_t find(std::string_view s) const {
+        uint32_t slot = const_cast<string_dictionary *>(this)->probe(s, hash(s));
+        return slot - 1;
+      }
+
+      std::string_view at(uint32_t code) const {
+        return std::string_view(arena_.data() + spans_[code].at, spans_[code].len);
+      }
+
+      std::size_t size() const { return spans_.size(); }
+
+    private:
+      struct span {
+        uint32_t hash;
+        uint32_t at;
+        uint32_t len;
+      };
+
+      std::string arena_;
+      std::vector<span> spans_;
+      //! A code plus one, or 0 for an empty slot.
+      std::vector<uint32_t> slots_;
+      std::size_t mask_;
+
+      static uint32_t hash(std::string_view s) {
+        uint32_t h = 2166136261U;
+        for (std::size_t i = 0; i < s.size(); ++i) {
+          h ^= (unsigned char) s[i];
+          h *= 16777619U;
+        }
+        return h;
+      }
+
+      uint32_t &probe(std::string_view s, uint32_t h) {
+        std::size_t i = h & mask_;
+        while (slots_[i] != 0) {
+          const span &sp = spans_[slots_[i] - 1];
+          if (sp.hash == h && at(slots_[i] - 1) == s) break;
+          i = (i + 1) & mask_;
+        }
+        return slots_[i];
+      }
+
+      void rehash(std::size_t capacity) {
+        slots_.assign(capacity, 0);
+        mask_ = capacity - 1;
+        for (std::size_t c = 0; c < spans_.size(); ++c) {
+          std::size_t i = spans_[c].hash & mask_;
+          while (slots_[i] != 0) i = (i + 1) & mask_;
+          slots_[i] = (uint32_t) c + 1;
+        }
+      }
+  };
+
+  /*!
+  \brief One info reply per server, stored column by column.
+
+  Each field is its own dense array indexed by row, so a filter over the fleet
+  reads only the columns it tests, one after another, and the compiler can
+  vectorise the loops.  Maps and games are dictionary encoded: comparing a map is
+  comparing a uint32_t.
+
+  Rows are filled straight from codec::info_reader, which decodes only the
+  fields stored here, or from every target of a query::scanner.  Servers which did
+  not reply get a row without flag_up, so that rows line up with the scanner's
+  targets.
+  */
+  class fleet_table {
+    public:
+      typedef enum {flag_up = 1 << 0, flag_password = 1 << 1, flag_vac = 1 << 2} flag_t;
+
+      //! The ping of a server which did not reply.
+      static const uint32_t no_ping = ~uint32_t(0);
+
+      //! A map or game in a filter which matches any.
+      static const uint32_t any = string_dictionary::npos - 1;
+
+      /*!
+      \brief What select() looks for.  Every part matches anything by default.
+
+      A map or game of string_dictionary::npos, which is what find() gives for a
+      string no server had, matches no rows.
+      */
+      struct filter {
+        //! A code from maps(), or any.
+        uint32_t map;
+        //! A code from games(), or any.
+        uint32_t game;
+        uint8_t min_players;
+        //! Slots left for players to join.
+        uint8_t min_free;
+        uint32_t max_ping_us;
+        //! Flags a row must have, and flags it must not.
+        uint8_t require;
+        uint8_t reject;
+
+        filter() : map(any), game(any), min_players(0), min_free(0),
+                   max_ping_us(no_ping), require(flag_up), reject(0) {}
+      };
+
+      void reserve(std::size_t rows) {
+        ip_.reserve(rows);
+        port_.reserve(rows);
+        players_.reserve(rows);
+        max_players_.reserve(rows);
+        bots_.reserve(rows);
+        flags_.reserve(rows);
+        ping_us_.reserve(rows);
+        map_.reserve(rows);
+        game_.reserve(rows);
+      }
+
+      //! Empty the rows; the dictionaries are kept so codes stay the same from one scan to the next.
+      void clear() {
+        ip_.clear();
+        port_.clear();
+        players_.clear();
+        max_players_.clear();
+        bots_.clear();
+        flags_.clear();
+        ping_us_.clear();
+        map_.clear();
+        game_.clear();
+      }
+
+      //! Add a server which replied.  \returns its row.
+      std::size_t add(const struct sockaddr_in &addr, const codec::info_reader &info, uint64_t rtt_ns) {
+        uint8_t flags = flag_up | (info.password() ? flag_password : 0) | (info.vac() ? flag_vac : 0);
+        uint64_t us = rtt_ns / 1000;
+        return push(addr, info.players(), info.max_players(), info.bots(), flags,
+                    (us >= no_ping) ? no_ping - 1 : (uint32_t) us, maps_.intern(info.map()), games_.intern(info.game()));
+      }
+
+      //! Add a server which did not reply.
+      std::size_t add_down(const struct sockaddr_in &addr) {
+        return push(addr, 0, 0, 0, 0, no_ping, 0, 0);
+      }
+
+      //! Add a row for every target of \c s, in the same order.
+      void add(const scanner &s) {
+        reserve(size() + s.size());
+        for (std::size_t i = 0; i < s.size(); ++i) {
+          if (s.state(i) == scanner::target_replied) {
+            codec::info_reader info = s.info(i);
+            if (info.status() != codec::decode_invalid) {
+              add(s.address(i), info, s.rtt_ns(i));
+              continue;
+            }
+          }
+          add_down(s.address(i));
+        }
+      }
+
+      std::size_t size() const { return flags_.size(); }
+
+      //! \name Columns, each size() long.
+      //@{
+      //! In network order, as in sockaddr_in.
+      const uint32_t *ip() const { return ip_.data(); }
+      const uint16_t *port() const { return port_.data(); }
+      const uint8_t *players() const { return players_.data(); }
+      const uint8_t *max_players() const { return max_players_.data(); }
+      const uint8_t *bots() const { return bots_.data(); }
+      //! flag_t bits.
+      const uint8_t *flags() const { return flags_.data(); }
+      //! Round trip of the info query in microseconds, or no_ping.
+      const uint32_t *ping_us() const { return ping_us_.data(); }
+      //! Codes in maps().
+      const uint32_t *map() const { return map_.data(); }
+      //! Codes in games().
+      const uint32_t *game() const { return game_.data(); }
+      //@}
+
+      const string_dictionary &maps() const { return maps_; }
+      const string_dictionary &games() const { return games_; }
+
+      struct sockaddr_in address(std::size_t row) const {
+        struct sockaddr_in a;
+        std::memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = ip_[row];
+        a.sin_port = port_[row];
+        return a;
+      }
+
+      //! Put the rows matching \c f in \c rows, in order.  \returns how many.
+      std::size_t select(const filter &f, std::vector<uint32_t> &rows) const {
+        // Room for every row, so the gather below can store without a branch.
+        rows.resize(size());
+        std::size_t found = 0;
+        // A block at a time, one pass per column the filter tests, each a branch
+        // free loop over one array; then the matches are gathered.
+        const std::size_t block = 1024;
+        uint8_t keep[block];
+        for (std::size_t start = 0; start < size(); start += block) {
+          std::size_t n = std::min(block, size() - start);
+          const uint8_t *fl = &flags_[start];
+          for (std::size_t i = 0; i < n; ++i) {
+            keep[i] = ((fl[i] & f.require) == f.require) & ((fl[i] & f.reject) == 0);
+          }
+          if (f.map != any) {
+            const uint32_t *mp = &map_[start];
+            for (std::size_t i = 0; i < n; ++i) keep[i] &= mp[i] == f.map;
+          }
+          if (f.game != any) {
+            const uint32_t *gm = &game_[start];
+            for (std::size_t i = 0; i < n; ++i) keep[i] &= gm[i] == f.game;
+          }
+          if (f.min_players) {
+            const uint8_t *pl = &players_[start];
+            for (std::size_t i = 0; i < n; ++i) keep[i] &= pl[i] >= f.min_players;
+          }
+          if (f.min_free) {
+            const uint8_t *pl = &players_[start], *mx = &max_players_[start];
+            for (std::size_t i = 0; i < n; ++i) keep[i] &= (int) mx[i] - (int) pl[i] >= (int) f.min_free;
+          }
+          if (f.max_ping_us != no_ping) {
+            const uint32_t *pi = &ping_us_[start];
+            for (std::size_t i = 0; i < n; ++i) keep[i] &= pi[i] <= f.max_ping_us;
+          }
+          for (std::size_t i = 0; i < n; ++i) {
+            rows[found] = (uint32_t) (start + i);
+            found += keep[i];
+          }
+        }
+        rows.resize(found);
+        return found;
+      }
+
+      //! Players on the given rows.
+      uint64_t sum_players(const std::vector<uint32_t> &rows) const {
+        uint64_t sum = 0;
+        for (std::size_t i = 0; i < rows.size(); ++i) sum += players_[rows[i]];
+        return sum;
+      }
+
+      //! Players on every server.
+      uint64_t sum_players() const {
+        uint64_t sum = 0;
+        for (std::size_t i = 0; i < players_.size(); ++i) sum += players_[i];
+        return sum;
+      }
+
+    private:
+      std::vector<uint32_t> ip_;
+      std::vector<uint16_t> port_;
+      std::vector<uint8_t> players_;
+      std::vector<uint8_t> max_players_;
+      std::vector<uint8_t> bots_;
+      std::vector<uint8_t> flags_;
+      std::vector<uint32_t> ping_us_;
+      std::vector<uint32_t> map_;
+      std::vector<uint32_t> game_;
+      string_dictionary maps_;
+      string_dictionary games_;
+
+      std::size_t push(const struct sockaddr_in &addr, uint8_t players, uint8_t max_players, uint8_t bots,
+                       uint8_t flags, uint32_t ping_us, uint32_t map, uint32_t game) {
+        ip_.push_back(addr.sin_addr.s_addr);
+        port_.push_back(addr.sin_port);
+        players_.push_back(players);
+        max_players_.push_back(max_players);
+        bots_.push_back(bots);
+        flags_.push_back(flags);
+        ping_us_.push_back(ping_us);
+        map_.push_back(map);
+        game_.push_back(game);
+        return flags_.size() - 1;
+      }
+  };
+}
+
+#endif
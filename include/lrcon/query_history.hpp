@@ -0,0 +1,686 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Fleet snapshots kept over time in an append-only file, read in place.
+
+\code
+// Every minute:
+query::history_writer history("fleet.hist");
+history.append(fleet, query::history_writer::wall_ns());
+
+// Elsewhere, even while that runs:
+query::history_reader h("fleet.hist");
+query::history_reader::cursor c = h.range(week_ago_ns, now_ns);
+query::history_frame f;
+while (c.next(f)) {
+  std::size_t row = f.find(server);
+  if (row != query::history_frame::npos) std::cout << f.time_ns() << " " << (int) f.players()[row] << "\n";
+}
+\endcode
+*/
+
+#ifndef QUERY_HISTORY_HPP_p6t3m8cz
+#define QUERY_HISTORY_HPP_p6t3m8cz
+
+#include <lrcon/common.hpp>
+#include <lrcon/codec.hpp>
+#include <lrcon/query_fleet.hpp>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief The layout shared by history_writer and history_reader.
+
+  The file is a 64 byte header then frames, one per snapshot, each starting on an
+  8 byte boundary.  A frame is a frame_header then its columns:
+
+  \verbatim
+  uint64_t key[rows]            ip << 16 | port, in host order, ascending
+  uint32_t ping_us[rows]
+  uint32_t map[rows]            index into the frame's strings
+  uint32_t game[rows]
+  uint32_t string_at[strings + 1]
+  uint8_t  players[rows], max_players[rows], bots[rows], flags[rows]
+  char     string bytes, then padding to 8
+  \endverbatim
+
+  so a reader finds any column by arithmetic on rows and strings and reads it
+  where it lies.  Everything is in the writer's byte order, which the header
+  records; a file from a host of the other order is refused.
+
+  header.committed is the end of the last whole frame, written after the frame.
+  Readers never look past it, so they can run while a writer appends.
+
+  Next to the file is an index, the same path plus ".idx", of (time, offset) for
+  every index_every th frame, which is what makes a time range a binary search.
+  It can always be rebuilt from the frames.
+  */
+  class history_file {
+    public:
+      //! Row of a server which is not in a frame.
+      static const std::size_t npos = ~std::size_t(0);
+
+    protected:
+      struct file_header {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t header_bytes;
+        uint64_t committed;
+        uint64_t created_ns;
+        char reserved[32];
+      };
+
+      struct frame_header {
+        uint32_t magic;
+        uint32_t rows;
+        uint64_t time_ns;
+        uint64_t seq;
+        uint32_t strings;
+        uint32_t bytes;
+        uint32_t reserved;
+        //! CRC-32 of the header before this field and of everything after it.
+        uint32_t checksum;
+      };
+
+      struct index_entry {
+        uint64_t time_ns;
+        uint64_t offset;
+      };
+
+      //! Where each column of a frame starts.
+      struct frame_layout {
+        std::size_t keys, ping_us, map, game, string_at, players, max_players, bots, flags, strings;
+
+        frame_layout(uint32_t rows, uint32_t strings) {
+          std::size_t at = sizeof(frame_header);
+          keys = at;
+          at += sizeof(uint64_t) * rows;
+          ping_us = at;
+          at += sizeof(uint32_t) * rows;
+          map = at;
+          at += sizeof(uint32_t) * rows;
+          game = at;
+          at += sizeof(uint32_t) * rows;
+          string_at = at;
+          at += sizeof(uint32_t) * (strings + 1);
+          players = at;
+          max_players = players + rows;
+          bots = max_players + rows;
+          flags = bots + rows;
+          this->strings = flags + rows;
+        }
+      };
+
+      static const uint32_t byte_order_mark = 0x01020304;
+      static const uint32_t frame_magic = 0x4d415246;  // "FRAM"
+
+      static const char *file_magic() { return "LRCNHST1"; }
+
+      static std::string index_path(const std::string &path) { return path + ".idx"; }
+
+      static std::size_t padded(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+      //! Whether \c h can start a frame ending by \c end.
+      static bool plausible(const frame_header &h, uint64_t at, uint64_t end) {
+        if (h.magic != frame_magic || h.bytes % 8 != 0 || h.bytes < sizeof(frame_header)) return false;
+        if (at + h.bytes > end) return false;
+        frame_layout l(h.rows, h.strings);
+        return l.strings <= h.bytes;
+      }
+
+      static uint32_t checksum(const unsigned char *frame, std::size_t bytes) {
+        uint32_t crc = common::codec::crc32(frame, offsetof(frame_header, checksum));
+        return common::codec::crc32(frame + sizeof(frame_header), bytes - sizeof(frame_header), crc);
+      }
+  };
+
+  //! One snapshot in a history, read where it lies in the mapped file.
+  class history_frame : public history_file {
+    public:
+      history_frame() : base_(NULL), layout_(0, 0) {}
+
+      uint64_t time_ns() const { return header().time_ns; }
+      //! 0 for the first frame in the file, counting up.
+      uint64_t seq() const { return header().seq; }
+      std::size_t rows() const { return header().rows; }
+
+      //! \name Columns, each rows() long.
+      //@{
+      //! ip << 16 | port in host order, ascending.
+      const uint64_t *keys() const { return column<uint64_t>(layout_.keys); }
+      const uint32_t *ping_us() const { return column<uint32_t>(layout_.ping_us); }
+      const uint8_t *players() const { return column<uint8_t>(layout_.players); }
+      const uint8_t *max_players() const { return column<uint8_t>(layout_.max_players); }
+      const uint8_t *bots() const { return column<uint8_t>(layout_.bots); }
+      //! fleet_table::flag_t bits.
+      const uint8_t *flags() const { return column<uint8_t>(layout_.flags); }
+      //@}
+
+      std::string_view map(std::size_t row) const { return string(column<uint32_t>(layout_.map)[row]); }
+      std::string_view game(std::size_t row) const { return string(column<uint32_t>(layout_.game)[row]); }
+
+      static uint64_t key(const struct sockaddr_in &a) {
+        return ((uint64_t) ntohl(a.sin_addr.s_addr) << 16) | ntohs(a.sin_port);
+      }
+
+      //! The row of a server, or npos.
+      std::size_t find(const struct sockaddr_in &a) const {
+        uint64_t k = key(a);
+        const uint64_t *b = keys(), *e = keys() + rows();
+        const uint64_t *i = std::lower_bound(b, e, k);
+        return (i != e && *i == k) ? (std::size_t) (i - b) : npos;
+      }
+
+    private:
+      friend class history_reader;
+
+      const unsigned char *base_;
+      frame_layout layout_;
+
+      explicit history_frame(const unsigned char *base)
+      : base_(base), layout_(header().rows, header().strings) {}
+
+      const frame_header &header() const { return *(const frame_header *) base_; }
+
+      template <typename T>
+      const T *column(std::size_t at) const { return (const T *) (base_ + at); }
+
+      std::string_view string(uint32_t i) const {
+        const uint32_t *at = column<uint32_t>(layout_.string_at);
+        return std::string_view((const char *) base_ + layout_.strings + at[i], at[i + 1] - at[i]);
+      }
+  };
+
+  /*!
+  \brief Appends fleet snapshots to a history file.
+
+  Only one writer may have a file open; a second fails to open it.  Opening
+  recovers from a crash: frames after the last one indexed are checked against
+  their CRCs, the file is cut back to the end of the last good one, and the index
+  is made to match.  recovered_bytes() says how much was cut.
+
+  With \c sync each append is flushed to disk before the header says it is there,
+  which survives the machine losing power as well as the program crashing, at the
+  price of two fdatasync() calls per snapshot.
+  */
+  class history_writer : public history_file {
+    public:
+      struct options {
+        //! Index one frame in this many.
+        unsigned index_every;
+        bool sync;
+
+        options() : index_every(16), sync(false) {}
+      };
+
+      history_writer(const std::string &path, const options &o = options())
+      : opt_(o), fd_(-1), index_fd_(-1) {
+        init();
+        open(path).check();
+      }
+
+      //! Open without throwing.  \c st says why if it failed.
+      history_writer(const std::string &path, const options &o, common::status &st)
+      : opt_(o), fd_(-1), index_fd_(-1) {
+        init();
+        st = open(path);
+      }
+
+      ~history_writer() { close_files(); }
+
+      //! Nanoseconds since the epoch, which history times are normally in.
+      static uint64_t wall_ns() {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+      }
+
+      /*!
+      \brief Add a snapshot of \c fleet taken at \c time_ns.
+
+      Times must not go backwards.  A server in the fleet twice is stored once.  A
+      writer which failed to open its file refuses, without writing anything.
+      */
+      common::status append(const fleet_table &fleet, uint64_t time_ns) {
+        if (fd_ == -1) return common::status(common::connection_failed, "the history is not open");
+        if (time_ns < last_time_) return common::status(common::protocol_violation, "a snapshot older than the last one");
+
+        build(fleet, time_ns);
+        if (! write_at(fd_, frame_.data(), frame_.size(), committed_)) {
+          return common::errno_status(common::send_failed, "writing to the history failed");
+        }
+        if (opt_.sync && fdatasync(fd_) == -1) return common::errno_status(common::send_failed, "fdatasync() failed");
+        uint64_t end = committed_ + frame_.size();
+        if (! write_at(fd_, &end, sizeof(end), offsetof(file_header, committed))) {
+          return common::errno_status(common::send_failed, "writing to the history failed");
+        }
+        if (opt_.sync && fdatasync(fd_) == -1) return common::errno_status(common::send_failed, "fdatasync() failed");
+
+        if (seq_ % opt_.index_every == 0) add_index(time_ns, committed_);
+        committed_ = end;
+        last_time_ = time_ns;
+        ++seq_;
+        return common::status();
+      }
+
+      //! Frames in the file.
+      uint64_t frames() const { return seq_; }
+      //! Bytes of frames in the file.
+      uint64_t size() const { return committed_; }
+      //! Bytes cut from the end of the file when it was opened.
+      uint64_t recovered_bytes() const { return recovered_; }
+
+    private:
+      options opt_;
+      int fd_;
+      int index_fd_;
+      uint64_t committed_;
+      uint64_t index_size_;
+      uint64_t seq_;
+      uint64_t last_time_;
+      uint64_t recovered_;
+      std::vector<unsigned char> frame_;
+
+      void close_files() {
+        if (index_fd_ != -1) close(index_fd_);
+        if (fd_ != -1) close(fd_);
+        index_fd_ = fd_ = -1;
+      }
+
+      void init() {
+        if (opt_.index_every == 0) opt_.index_every = 1;
+        committed_ = index_size_ = seq_ = last_time_ = recovered_ = 0;
+      }
+
+      //! Open and recover \c path, or close everything so that append() refuses.
+      common::status open(const std::string &path) {
+        common::status st = open_and_recover(path);
+        if (! st.ok()) close_files();
+        return st;
+      }
+
+      common::status open_and_recover(const std::string &path) {
+        using common::status;
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ == -1) return common::errno_status(common::connection_failed, "cannot open the history");
+        if (flock(fd_, LOCK_EX | LOCK_NB) == -1) {
+          return common::errno_status(common::connection_failed, "another writer has the history open");
+        }
+        index_fd_ = ::open(index_path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (index_fd_ == -1) return common::errno_status(common::connection_failed, "cannot open the history index");
+
+        struct stat sb;
+        if (fstat(fd_, &sb) == -1) return common::errno_status(common::send_failed, "fstat() failed");
+        uint64_t size = (uint64_t) sb.st_size;
+        if (size == 0) return create();
+
+        file_header h;
+        if (size < sizeof(h) || ! read_at(fd_, &h, sizeof(h), 0) || std::memcmp(h.magic, file_magic(), 8) != 0
+            || h.header_bytes != sizeof(file_header)) {
+          return status(common::protocol_violation, "not a history file");
+        }
+        if (h.byte_order != byte_order_mark) {
+          return status(common::protocol_violation, "the history was written with the other byte order");
+        }
+        committed_ = std::min<uint64_t>(std::max<uint64_t>(h.committed, sizeof(file_header)), size);
+        return recover(size, h.committed);
+      }
+
+      common::status create() {
+        file_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, file_magic(), 8);
+        h.byte_order = byte_order_mark;
+        h.header_bytes = sizeof(h);
+        h.committed = sizeof(h);
+        h.created_ns = wall_ns();
+        if (! write_at(fd_, &h, sizeof(h), 0) || ftruncate(index_fd_, 0) == -1) {
+          return common::errno_status(common::send_failed, "writing to the history failed");
+        }
+        if (opt_.sync && fdatasync(fd_) == -1) return common::errno_status(common::send_failed, "fdatasync() failed");
+        committed_ = sizeof(h);
+        return common::status();
+      }
+
+      //! Check the frames after the last good index entry and cut off anything after them.
+      common::status recover(uint64_t size, uint64_t header_committed) {
+        struct stat sb;
+        if (fstat(index_fd_, &sb) == -1) return common::errno_status(common::send_failed, "fstat() failed");
+        uint64_t entries = (uint64_t) sb.st_size / sizeof(index_entry);
+
+        uint64_t at = sizeof(file_header);
+        frame_header h;
+        while (entries > 0) {
+          index_entry e;
+          if (read_at(index_fd_, &e, sizeof(e), (entries - 1) * sizeof(e)) && e.offset >= sizeof(file_header)
+              && e.offset % 8 == 0 && whole(e.offset, h) && h.time_ns == e.time_ns) {
+            seq_ = h.seq + 1;
+            last_time_ = h.time_ns;
+            at = e.offset + h.bytes;
+            break;
+          }
+          --entries;
+        }
+        index_size_ = entries * sizeof(index_entry);
+        if (ftruncate(index_fd_, index_size_) == -1) return common::errno_status(common::send_failed, "ftruncate() failed");
+
+        while (at < committed_ && whole(at, h)) {
+          if (h.seq % opt_.index_every == 0) add_index(h.time_ns, at);
+          seq_ = h.seq + 1;
+          last_time_ = h.time_ns;
+          at += h.bytes;
+        }
+
+        recovered_ = size - at;
+        if (recovered_ > 0 || header_committed != at) {
+          if (! write_at(fd_, &at, sizeof(at), offsetof(file_header, committed)) || ftruncate(fd_, at) == -1) {
+            return common::errno_status(common::send_failed, "cutting the end off the history failed");
+          }
+          if (fdatasync(fd_) == -1) return common::errno_status(common::send_failed, "fdatasync() failed");
+        }
+        committed_ = at;
+        return common::status();
+      }
+
+      //! Whether a frame at \c at is all there and matches its checksum.
+      bool whole(uint64_t at, frame_header &h) {
+        if (! read_at(fd_, &h, sizeof(h), at) || ! plausible(h, at, committed_)) return false;
+        frame_.resize(h.bytes);
+        return read_at(fd_, frame_.data(), h.bytes, at) && checksum(frame_.data(), h.bytes) == h.checksum;
+      }
+
+      void add_index(uint64_t time_ns, uint64_t offset) {
+        index_entry e = {time_ns, offset};
+        // A lost entry only makes a range start further back; recovery puts it back.
+        if (write_at(index_fd_, &e, sizeof(e), index_size_)) index_size_ += sizeof(e);
+      }
+
+      //! Lay out the frame for \c fleet in frame_.
+      void build(const fleet_table &fleet, uint64_t time_ns) {
+        // Rows sorted by server, so readers can binary search for one.
+        std::vector<std::pair<uint64_t, uint32_t> > order(fleet.size());
+        for (std::size_t i = 0; i < fleet.size(); ++i) {
+          order[i].first = history_frame::key(fleet.address(i));
+          order[i].second = (uint32_t) i;
+        }
+        std::sort(order.begin(), order.end());
+        order.erase(std::unique(order.begin(), order.end(),
+                                [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) {
+                                  return a.first == b.first;
+                                }), order.end());
+
+        // Only the maps and games in use, numbered for this frame.
+        std::vector<uint32_t> map_ids(fleet.maps().size(), ~uint32_t(0));
+        std::vector<uint32_t> game_ids(fleet.games().size(), ~uint32_t(0));
+        std::vector<std::string_view> strings;
+        uint32_t rows = (uint32_t) order.size();
+        std::vector<uint32_t> maps(rows), games(rows);
+        for (uint32_t r = 0; r < rows; ++r) {
+          maps[r] = number(map_ids, fleet.map()[order[r].second], fleet.maps(), strings);
+          games[r] = number(game_ids, fleet.game()[order[r].second], fleet.games(), strings);
+        }
+
+        std::size_t string_bytes = 0;
+        for (std::size_t i = 0; i < strings.size(); ++i) string_bytes += strings[i].size();
+        frame_layout l(rows, (uint32_t) strings.size());
+        std::size_t bytes = padded(l.strings + string_bytes);
+        frame_.assign(bytes, 0);
+        unsigned char *f = frame_.data();
+
+        uint64_t *keys = (uint64_t *) (f + l.keys);
+        uint32_t *ping = (uint32_t *) (f + l.ping_us);
+        for (uint32_t r = 0; r < rows; ++r) {
+          uint32_t i = order[r].second;
+          keys[r] = order[r].first;
+          ping[r] = fleet.ping_us()[i];
+          f[l.players + r] = fleet.players()[i];
+          f[l.max_players + r] = fleet.max_players()[i];
+          f[l.bots + r] = fleet.bots()[i];
+          f[l.flags + r] = fleet.flags()[i];
+        }
+        if (rows) {
+          std::memcpy(f + l.map, maps.data(), sizeof(uint32_t) * rows);
+          std::memcpy(f + l.game, games.data(), sizeof(uint32_t) * rows);
+        }
+        uint32_t *string_at = (uint32_t *) (f + l.string_at);
+        uint32_t at = 0;
+        for (std::size_t i = 0; i < strings.size(); ++i) {
+          string_at[i] = at;
+          std::memcpy(f + l.strings + at, strings[i].data(), strings[i].size());
+          at += (uint32_t) strings[i].size();
+        }
+        string_at[strings.size()] = at;
+
+        frame_header *h = (frame_header *) f;
+        h->magic = frame_magic;
+        h->rows = rows;
+        h->time_ns = time_ns;
+        h->seq = seq_;
+        h->strings = (uint32_t) strings.size();
+        h->bytes = (uint32_t) bytes;
+        h->checksum = checksum(f, bytes);
+      }
+
+      static uint32_t number(std::vector<uint32_t> &ids, uint32_t code, const string_dictionary &dict,
+                             std::vector<std::string_view> &strings) {
+        if (ids[code] == ~uint32_t(0)) {
+          ids[code] = (uint32_t) strings.size();
+          strings.push_back(dict.at(code));
+        }
+        return ids[code];
+      }
+
+      static bool write_at(int fd, const void *p, std::size_t n, uint64_t at) {
+        const char *c = (const char *) p;
+        while (n > 0) {
+          ssize_t w = pwrite(fd, c, n, (off_t) at);
+          if (w == -1) {
+            if (errno == EINTR) continue;
+            return false;
+          }
+          c += w;
+          n -= (std::size_t) w;
+          at += (uint64_t) w;
+        }
+        return true;
+      }
+
+      static bool read_at(int fd, void *p, std::size_t n, uint64_t at) {
+        char *c = (char *) p;
+        while (n > 0) {
+          ssize_t r = pread(fd, c, n, (off_t) at);
+          if (r == -1 && errno == EINTR) continue;
+          if (r <= 0) return false;
+          c += r;
+          n -= (std::size_t) r;
+          at += (uint64_t) r;
+        }
+        return true;
+      }
+
+      history_writer(const history_writer &);
+      history_writer &operator=(const history_writer &);
+  };
+
+  /*!
+  \brief Reads a history file through a read-only mapping.
+
+  Nothing is parsed or copied: a range is found by a binary search of the mapped
+  index and the frames are read where they lie.  A writer may append at the same
+  time; refresh() maps what it has added since.  Frames from a refresh are valid
+  until the next refresh or the reader is destroyed.
+  */
+  class history_reader : public history_file {
+    public:
+      //! The frames in a time range, oldest first.
+      class cursor {
+        public:
+          cursor() : r_(NULL), at_(0), from_(0), to_(0) {}
+
+          bool next(history_frame &out) {
+            while (r_ && at_ < r_->committed_) {
+              const frame_header *h = (const frame_header *) (r_->data_ + at_);
+              if (! plausible(*h, at_, r_->committed_) || h->time_ns > to_) break;
+              uint64_t here = at_;
+              at_ += h->bytes;
+              if (h->time_ns < from_) continue;
+              out = history_frame(r_->data_ + here);
+              return true;
+            }
+            r_ = NULL;
+            return false;
+          }
+
+        private:
+          friend class history_reader;
+          const history_reader *r_;
+          uint64_t at_, from_, to_;
+
+          cursor(const history_reader *r, uint64_t at, uint64_t from, uint64_t to) : r_(r), at_(at), from_(from), to_(to) {}
+      };
+
+      explicit history_reader(const std::string &path) {
+        init();
+        open(path).check();
+      }
+
+      //! Open without throwing.  \c st says why if it failed.
+      history_reader(const std::string &path, common::status &st) {
+        init();
+        st = open(path);
+      }
+
+      ~history_reader() {
+        unmap();
+        if (index_fd_ != -1) close(index_fd_);
+        if (fd_ != -1) close(fd_);
+      }
+
+      //! Map what a writer has appended since.  Invalidates frames and cursors.
+      common::status refresh() {
+        using common::status;
+        unmap();
+        struct stat sb;
+        if (fstat(fd_, &sb) == -1) return common::errno_status(common::recv_failed, "fstat() failed");
+        if ((uint64_t) sb.st_size < sizeof(file_header)) return status(common::protocol_violation, "not a history file");
+        mapped_ = (uint64_t) sb.st_size;
+        void *m = mmap(NULL, mapped_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) {
+          mapped_ = 0;
+          return common::errno_status(common::recv_failed, "mmap() of the history failed");
+        }
+        data_ = (const unsigned char *) m;
+
+        const file_header *h = (const file_header *) data_;
+        if (std::memcmp(h->magic, file_magic(), 8) != 0 || h->header_bytes != sizeof(file_header)) {
+          return status(common::protocol_violation, "not a history file");
+        }
+        if (h->byte_order != byte_order_mark) {
+          return status(common::protocol_violation, "the history was written with the other byte order");
+        }
+        // The writer stores this after the frame it covers.
+        committed_ = std::min<uint64_t>(__atomic_load_n(&h->committed, __ATOMIC_ACQUIRE), mapped_);
+
+        if (index_fd_ != -1 && fstat(index_fd_, &sb) == 0 && sb.st_size >= (off_t) sizeof(index_entry)) {
+          index_mapped_ = (uint64_t) sb.st_size;
+          m = mmap(NULL, index_mapped_, PROT_READ, MAP_SHARED, index_fd_, 0);
+          if (m != MAP_FAILED) {
+            index_ = (const index_entry *) m;
+            entries_ = index_mapped_ / sizeof(index_entry);
+          }
+          else {
+            index_mapped_ = 0;
+          }
+        }
+        return status();
+      }
+
+      //! The frames from \c from_ns to \c to_ns inclusive.
+      cursor range(uint64_t from_ns, uint64_t to_ns) const {
+        return cursor(this, start_for(from_ns), from_ns, to_ns);
+      }
+
+      //! Every frame.
+      cursor all() const { return range(0, ~uint64_t(0)); }
+
+      //! The newest frame, or false if there are none.
+      bool last(history_frame &out) const {
+        cursor c(this, start_for(~uint64_t(0)), 0, ~uint64_t(0));
+        bool any = false;
+        while (c.next(out)) any = true;
+        return any;
+      }
+
+      //! Bytes of whole frames, as of the last refresh().
+      uint64_t size() const { return committed_; }
+
+    private:
+      int fd_;
+      int index_fd_;
+      const unsigned char *data_;
+      uint64_t mapped_;
+      uint64_t committed_;
+      const index_entry *index_;
+      uint64_t index_mapped_;
+      uint64_t entries_;
+
+      void init() {
+        fd_ = index_fd_ = -1;
+        data_ = NULL;
+        index_ = NULL;
+        mapped_ = committed_ = index_mapped_ = entries_ = 0;
+      }
+
+      common::status open(const std::string &path) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ == -1) return common::errno_status(common::connection_failed, "cannot open the history");
+        // Without an index every range is read from the start.
+        index_fd_ = ::open(index_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+        return refresh();
+      }
+
+      void unmap() {
+        if (data_) munmap((void *) data_, mapped_);
+        if (index_) munmap((void *) index_, index_mapped_);
+        data_ = NULL;
+        index_ = NULL;
+        mapped_ = committed_ = index_mapped_ = entries_ = 0;
+      }
+
+      //! Where to start reading for frames from \c from_ns: the last indexed frame before it.
+      uint64_t start_for(uint64_t from_ns) const {
+        const index_entry *b = index_, *e = index_ + entries_;
+        const index_entry *i = std::lower_bound(b, e, from_ns,
+                                                [](const index_entry &x, uint64_t t) { return x.time_ns < t; });
+        // An entry being written, or one for frames cut off by a recovery, is passed over.
+        while (i != b) {
+          --i;
+          const frame_header *h = (const frame_header *) (data_ + i->offset);
+          if (i->offset >= sizeof(file_header) && i->offset % 8 == 0 && i->offset < committed_
+              && plausible(*h, i->offset, committed_) && h->time_ns == i->time_ns) {
+            return i->offset;
+          }
+        }
+        return sizeof(file_header);
+      }
+
+      history_reader(const history_reader &);
+      history_reader &operator=(const history_reader &);
+  };
+}
+
+#endif
@@ -0,0 +1,353 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Round trip statistics for ranking servers by latency.
+
+\code
+query::latency_probe p(query::host("10.0.0.5", "27015", true));
+std::cout << p.p50_ns() / 1000 << "us median, " << p.loss() * 100 << "% lost" << std::endl;
+\endcode
+*/
+
+#ifndef QUERY_LATENCY_HPP_m4c8w2rd
+#define QUERY_LATENCY_HPP_m4c8w2rd
+
+#include <lrcon/query.hpp>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief Several pings of one server, timed by the kernel where it can.
+
+  A2S replies carry nothing to tell which request they answer, so each probe goes
+  out on its own socket and the reply is matched by the socket it comes back on.
+  The probes are sent \c interval_us apart without waiting for the replies, so a
+  whole probe takes about probes * interval_us plus one round trip.
+
+  Where SO_TIMESTAMPING works the send and receive times are the kernel's, which
+  leaves out the time until this thread was scheduled.  Otherwise, or for a probe
+  whose kernel stamps did not both arrive, the monotonic clock is read around
+  send() and recv().
+
+  The probe is an info request by default, because plenty of servers no longer
+  answer A2S_PING.  Any reply counts, including a challenge.
+  */
+  class latency_probe {
+    public:
+      //! A probe which got no reply in samples().
+      static const uint64_t lost = ~uint64_t(0);
+
+      struct options {
+        //! How many probes to send.
+        unsigned probes;
+        //! Time between sending each probe.
+        int interval_us;
+        //! How long to wait for each reply after its probe went out.
+        int timeout_ms;
+        //! What to send; codec::ping_request or codec::info_request.
+        codec::packet_type_t request;
+        //! Try SO_TIMESTAMPING.
+        bool kernel_timestamps;
+
+        options() : probes(8), interval_us(10000), timeout_ms(1000),
+                    request(codec::info_request), kernel_timestamps(true) {}
+      };
+
+      latency_probe(const host &server, const options &o = options())
+      : opt_(o), sum_(0), jitter_(0), kernel_timed_(0) {
+        run(server).check();
+      }
+
+      //! Probe without throwing.  \c st says why if it failed.
+      latency_probe(const host &server, const options &o, common::status &st)
+      : opt_(o), sum_(0), jitter_(0), kernel_timed_(0) {
+        st = run(server);
+      }
+
+      //! Probe without throwing, giving up at \c limit.
+      latency_probe(const host &server, const options &o, const common::deadline &limit, common::status &st)
+      : opt_(o), sum_(0), jitter_(0), kernel_timed_(0) {
+        common::deadline_scope s(limit);
+        st = common::deadline_scope::check(common::metrics::now_ns());
+        if (st.ok()) st = run(server);
+      }
+
+      //! Each probe's round trip in nanoseconds, in the order sent, or \c lost.
+      const std::vector<uint64_t> &samples() const { return samples_; }
+
+      unsigned sent() const { return (unsigned) samples_.size(); }
+      unsigned received() const { return (unsigned) sorted_.size(); }
+
+      //! The fraction of probes with no reply, from 0 to 1.
+      double loss() const { return sent() ? 1.0 - (double) received() / sent() : 1.0; }
+
+      //! Summary of the replies, in nanoseconds.  All are \c lost if nothing came back.
+      uint64_t min_ns() const { return sorted_.empty() ? lost : sorted_.front(); }
+      uint64_t max_ns() const { return sorted_.empty() ? lost : sorted_.back(); }
+      uint64_t avg_ns() const { return sorted_.empty() ? lost : sum_ / sorted_.size(); }
+      uint64_t p50_ns() const { return percentile(50); }
+      uint64_t p99_ns() const { return percentile(99); }
+
+      //! \brief Nearest rank percentile of the replies, \c p from 0 to 100.
+      uint64_t percentile(unsigned p) const {
+        if (sorted_.empty()) return lost;
+        std::size_t rank = (sorted_.size() * p + 99) / 100;
+        return sorted_[(rank == 0) ? 0 : rank - 1];
+      }
+
+      /*!
+      \brief The mean difference between consecutive round trips, in nanoseconds.
+
+      Lost probes are skipped over.  0 with fewer than two replies.
+      */
+      uint64_t jitter_ns() const { return jitter_; }
+
+      //! How many samples were timed by the kernel rather than around the calls.
+      unsigned kernel_timed() const { return kernel_timed_; }
+
+    private:
+      struct probe {
+        std::unique_ptr<connection> conn;
+        int fd;
+        uint64_t sent_ns;
+        uint64_t done_ns;
+        uint64_t kernel_sent_ns;
+        uint64_t kernel_recv_ns;
+        bool replied;
+        //! The socket had an error, such as a refused port; the probe is lost.
+        bool failed;
+      };
+
+      options opt_;
+      std::vector<probe> probes_;
+      std::vector<uint64_t> samples_;
+      std::vector<uint64_t> sorted_;
+      uint64_t sum_;
+      uint64_t jitter_;
+      unsigned kernel_timed_;
+
+      common::status run(const host &server) {
+        using common::status;
+        if (opt_.probes == 0) return status();
+        probes_.resize(opt_.probes);
+        for (std::size_t i = 0; i < probes_.size(); ++i) {
+          probe &p = probes_[i];
+          status st;
+          p.conn.reset(new connection(server, st));
+          if (! st.ok()) return st;
+          p.fd = ((common::connection_base &) *p.conn).socket();
+          p.sent_ns = p.done_ns = p.kernel_sent_ns = p.kernel_recv_ns = 0;
+          p.replied = p.failed = false;
+          if (opt_.kernel_timestamps) enable_timestamps(p.fd);
+        }
+
+        unsigned char pkt[32];
+        std::size_t sz = (opt_.request == codec::ping_request) ? codec::encode_ping(pkt, sizeof(pkt))
+                                                               : codec::encode_info(pkt, sizeof(pkt));
+        const uint64_t interval = (uint64_t) opt_.interval_us * 1000;
+        const uint64_t timeout = (uint64_t) opt_.timeout_ms * 1000000;
+        const uint64_t start = common::metrics::now_ns();
+        std::size_t next = 0;
+        std::vector<struct pollfd> fds(probes_.size());
+
+        for (;;) {
+          uint64_t now = common::metrics::now_ns();
+          status st = common::deadline_scope::check(now);
+          if (! st.ok()) return st;
+
+          while (next < probes_.size() && start + next * interval <= now) {
+            probe &p = probes_[next++];
+            p.sent_ns = common::metrics::now_ns();
+            common::result<int> r = try_send_buffered_packet(p.fd, pkt, sz);
+            if (! r.ok()) return r.error();
+          }
+
+          // The earliest of the next send, the oldest wait running out and the deadline.
+          uint64_t wake = (next < probes_.size()) ? start + next * interval : common::deadline::never;
+          nfds_t n = 0;
+          bool waiting_any = false;
+          for (std::size_t i = 0; i < next; ++i) {
+            probe &p = probes_[i];
+            if (p.failed) continue;
+            bool waiting = ! p.replied && now < p.sent_ns + timeout;
+            bool stamping = p.kernel_sent_ns == 0 && opt_.kernel_timestamps;
+            if (! waiting && ! stamping) continue;
+            if (waiting) {
+              wake = std::min(wake, p.sent_ns + timeout);
+              waiting_any = true;
+            }
+            fds[n].fd = p.fd;
+            // POLLERR is always reported; it is how the send stamp comes back.
+            fds[n].events = waiting ? POLLIN : 0;
+            fds[n].revents = 0;
+            ++n;
+          }
+          if (next == probes_.size() && ! waiting_any) break;
+
+          uint64_t at = common::deadline_scope::at_ns();
+          if (common::deadline_scope::active()) wake = std::min(wake, now + common::deadline_scope::cancel_poll_ns);
+          wake = std::min(wake, at);
+          int wait_ms = (wake > now) ? (int) ((wake - now + 999999) / 1000000) : 0;
+          int ready = poll(fds.data(), n, wait_ms);
+          if (ready == -1) {
+            if (errno == EINTR) continue;
+            return common::errno_status(common::recv_failed, "poll failed while probing latency");
+          }
+          for (nfds_t i = 0; i < n && ready > 0; ++i) {
+            if (fds[i].revents == 0) continue;
+            --ready;
+            probe &p = probe_for(fds[i].fd);
+            if (fds[i].revents & POLLERR) {
+              read_send_stamp(p);
+              // An error stays pending, and keeps poll() returning, until it is read.
+              int err = 0;
+              socklen_t len = sizeof(err);
+              if (getsockopt(p.fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0) {
+                p.failed = true;
+                continue;
+              }
+            }
+            if (fds[i].revents & POLLIN) read_reply(p);
+          }
+        }
+
+        // A send stamp can trail the reply on a busy host; take whatever has come.
+        if (opt_.kernel_timestamps) {
+          for (std::size_t i = 0; i < probes_.size(); ++i) {
+            if (probes_[i].replied && probes_[i].kernel_sent_ns == 0) read_send_stamp(probes_[i]);
+          }
+        }
+        summarise();
+        probes_.clear();
+        return status();
+      }
+
+      probe &probe_for(int fd) {
+        for (std::size_t i = 0; i < probes_.size(); ++i) {
+          if (probes_[i].fd == fd) return probes_[i];
+        }
+        assert(false);
+        return probes_[0];
+      }
+
+      void summarise() {
+        samples_.clear();
+        sorted_.clear();
+        for (std::size_t i = 0; i < probes_.size(); ++i) {
+          const probe &p = probes_[i];
+          if (! p.replied) {
+            samples_.push_back(uint64_t(lost));
+            continue;
+          }
+          uint64_t rtt = p.done_ns - p.sent_ns;
+          // The kernel stamps are wall clock; use them only when they are sane.
+          if (p.kernel_sent_ns && p.kernel_recv_ns > p.kernel_sent_ns && p.kernel_recv_ns - p.kernel_sent_ns <= rtt) {
+            rtt = p.kernel_recv_ns - p.kernel_sent_ns;
+            ++kernel_timed_;
+          }
+          samples_.push_back(rtt);
+          sorted_.push_back(rtt);
+          sum_ += rtt;
+        }
+        std::sort(sorted_.begin(), sorted_.end());
+
+        uint64_t prev = lost, diffs = 0, total = 0;
+        for (std::size_t i = 0; i < samples_.size(); ++i) {
+          if (samples_[i] == lost) continue;
+          if (prev != lost) {
+            total += (samples_[i] > prev) ? samples_[i] - prev : prev - samples_[i];
+            ++diffs;
+          }
+          prev = samples_[i];
+        }
+        jitter_ = diffs ? total / diffs : 0;
+      }
+
+      static uint64_t timespec_ns(const struct timespec &t) {
+        return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+      }
+
+      void enable_timestamps(int fd) {
+#ifdef SO_TIMESTAMPING
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+                  | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) opt_.kernel_timestamps = false;
+#else
+        (void) fd;
+        opt_.kernel_timestamps = false;
+#endif
+      }
+
+      //! The kernel stamp from a control message, or 0.
+      static uint64_t stamp_of(struct msghdr &msg) {
+#ifdef SO_TIMESTAMPING
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+          if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return timespec_ns(ts.ts[0]);
+          }
+        }
+#else
+        (void) msg;
+#endif
+        return 0;
+      }
+
+      void read_send_stamp(probe &p) {
+#ifdef SO_TIMESTAMPING
+        char control[256];
+        for (;;) {
+          struct msghdr msg;
+          std::memset(&msg, 0, sizeof(msg));
+          msg.msg_control = control;
+          msg.msg_controllen = sizeof(control);
+          if (recvmsg(p.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) return;
+          uint64_t at = stamp_of(msg);
+          if (at && p.kernel_sent_ns == 0) p.kernel_sent_ns = at;
+        }
+#else
+        (void) p;
+#endif
+      }
+
+      void read_reply(probe &p) {
+        char buf[codec::max_packet_size];
+        char control[256];
+        struct iovec iov = {buf, sizeof(buf)};
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t got = recvmsg(p.fd, &msg, MSG_DONTWAIT);
+        uint64_t now = common::metrics::now_ns();
+        if (got < 5 || p.replied) return;
+        LRCON_TRACE(ev_query_recv, p.fd, 0, got, (uint8_t) buf[4]);
+        p.done_ns = now;
+        p.kernel_recv_ns = stamp_of(msg);
+        p.replied = true;
+      }
+
+      latency_probe(const latency_probe &);
+      latency_probe &operator=(const latency_probe &);
+  };
+}
+
+#endif
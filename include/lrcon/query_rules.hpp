@@ -0,0 +1,131 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Fetches a server's rules again only when its info says they may have changed.
+
+\code
+query::challenge_cache challenges;
+query::rules_watch watch;
+for (;;) {
+  query::info i(conn);
+  common::status st = watch.refresh(conn, challenges, i.data());
+  std::cout << watch.rules().get("mp_timelimit") << std::endl;
+  sleep(10);
+}
+\endcode
+*/
+
+#ifndef QUERY_RULES_HPP_z5k1p8vf
+#define QUERY_RULES_HPP_z5k1p8vf
+
+#include <lrcon/query.hpp>
+
+namespace query {
+  /*!
+  \brief The rules of one server, kept for as long as its info reply says they hold.
+
+  A rules reply is large and rarely changes, while an info reply is small and is
+  asked for anyway.  So each time there is a new info reply, refresh() compares a
+  hash of the info fields that go with a change of rules: the map, game, folder,
+  version, keywords, app id, player limit, password and VAC flags, and whether the
+  server is empty.  The rules are only fetched again when that hash changes, or
+  when they are older than \c max_age_ns as a backstop for changes the info does
+  not show.
+
+  A server which does not answer rules queries, which is common, is not asked
+  again until the same things happen; refresh() fails with timed_out the first
+  time and after that leaves rules() empty.
+  */
+  class rules_watch {
+    public:
+      static const uint64_t default_max_age_ns = 300 * 1000000000ULL;
+
+      explicit rules_watch(uint64_t max_age_ns = default_max_age_ns)
+      : max_age_ns_(max_age_ns), signature_(0), fetched_at_(0), have_(false), fetches_(0), skips_(0) {}
+
+      //! Whether the rules should be fetched again, given a new info reply.
+      bool stale(const codec::info_reader &info, uint64_t now_ns = common::metrics::now_ns()) const {
+        return ! have_ || signature(info) != signature_ || now_ns - fetched_at_ >= max_age_ns_;
+      }
+
+      /*!
+      \brief Fetch the rules if stale() says to.
+
+      \param fetched  if not NULL, set to whether a rules query went out.
+      */
+      common::status refresh(common::connection_base &conn, challenge_cache &cache, const codec::info_reader &info,
+                             bool *fetched = NULL) {
+        uint64_t now = common::metrics::now_ns();
+        bool go = stale(info, now);
+        if (fetched) *fetched = go;
+        if (! go) {
+          ++skips_;
+          return common::status();
+        }
+
+        ++fetches_;
+        common::status st;
+        query::rules r(conn, cache, st);
+        if (! st.ok() && st.code != common::timed_out) return st;
+        keep(info, r.map(), now);
+        return st;
+      }
+
+      //! Take rules fetched some other way, such as in a snapshot, along with the info they came with.
+      void keep(const codec::info_reader &info, rule_map &fresh, uint64_t now_ns = common::metrics::now_ns()) {
+        map_.swap(fresh);
+        signature_ = signature(info);
+        fetched_at_ = now_ns;
+        have_ = true;
+      }
+
+      //! Fetch on the next refresh() whatever the info says.
+      void invalidate() { have_ = false; }
+
+      const rule_map &rules() const { return map_; }
+
+      //! How many refresh() calls sent a query, and how many did not need to.
+      unsigned fetches() const { return fetches_; }
+      unsigned skips() const { return skips_; }
+
+      //! FNV-1a of the info fields which change along with the rules.
+      static uint64_t signature(const codec::info_reader &info) {
+        uint64_t h = 14695981039346656037ULL;
+        std::string_view text[] = {info.map(), info.game(), info.folder(), info.version(), info.keywords()};
+        for (std::size_t t = 0; t < sizeof(text) / sizeof(text[0]); ++t) {
+          h = mix(h, text[t].data(), text[t].size());
+          // Keep "ab" + "c" apart from "a" + "bc".
+          h = mix(h, "", 1);
+        }
+        unsigned char fixed[] = {
+          (unsigned char) (info.app_id() & 0xff), (unsigned char) (info.app_id() >> 8), info.max_players(),
+          (unsigned char) info.password(), (unsigned char) info.vac(), (unsigned char) (info.players() != 0)
+        };
+        return mix(h, fixed, sizeof(fixed));
+      }
+
+    private:
+      uint64_t max_age_ns_;
+      uint64_t signature_;
+      uint64_t fetched_at_;
+      bool have_;
+      unsigned fetches_;
+      unsigned skips_;
+      rule_map map_;
+
+      static uint64_t mix(uint64_t h, const void *data, std::size_t n) {
+        const unsigned char *c = (const unsigned char *) data;
+        for (std::size_t i = 0; i < n; ++i) {
+          h ^= c[i];
+          h *= 1099511628211ULL;
+        }
+        return h;
+      }
+
+      rules_watch(const rules_watch &);
+      rules_watch &operator=(const rules_watch &);
+  };
+}
+
+#endif
@@ -0,0 +1,542 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Queries the info of thousands of servers from one socket and one thread.  Linux only.
+
+\code
+query::scanner scan;
+for (std::size_t i = 0; i < servers.size(); ++i) scan.add(servers[i].ip, servers[i].port);
+common::status st = scan.run();
+for (std::size_t i = 0; i < scan.size(); ++i) {
+  if (scan.state(i) == query::scanner::target_replied) show(scan.info(i).name(), scan.info(i).players());
+}
+\endcode
+*/
+
+#ifndef QUERY_SCANNER_HPP_f3n8s2wd
+#define QUERY_SCANNER_HPP_f3n8s2wd
+
+#include <lrcon/common.hpp>
+#include <lrcon/query_codec.hpp>
+#include <lrcon/query_split.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief Maps an IPv4 address and port to a number.
+
+  Open addressing with linear probing over 16 byte slots, kept at most half full,
+  so a lookup usually touches one cache line.
+  */
+  class address_table {
+    public:
+      static const uint32_t npos = ~uint32_t(0);
+
+      address_table() : mask_(0), size_(0) {}
+
+      //! Never 0, which marks an empty slot.
+      static uint64_t key(const struct sockaddr_in &a) {
+        return (uint64_t(1) << 48) | ((uint64_t) a.sin_addr.s_addr << 16) | a.sin_port;
+      }
+
+      //! \returns the value \c k already had, or \c value if it is new.
+      uint32_t insert(uint64_t k, uint32_t value) {
+        if ((size_ + 1) * 2 > slots_.size()) rehash(slots_.empty() ? 16 : slots_.size() * 2);
+        slot &s = probe(k);
+        if (s.key == k) return s.value;
+        s.key = k;
+        s.value = value;
+        ++size_;
+        return value;
+      }
+
+      //! npos if it is not there.
+      uint32_t find(uint64_t k) const {
+        if (slots_.empty()) return npos;
+        const slot &s = const_cast<address_table *>(this)->probe(k);
+        return (s.key == k) ? s.value : npos;
+      }
+
+      //! Make room for \c n entries without rehashing.
+      void reserve(std::size_t n) {
+        std::size_t want = 16;
+        while (want < n * 2) want *= 2;
+        if (want > slots_.size()) rehash(want);
+      }
+
+      std::size_t size() const { return size_; }
+
+    private:
+      struct slot {
+        uint64_t key;
+        uint32_t value;
+      };
+
+      std::vector<slot> slots_;
+      std::size_t mask_;
+      std::size_t size_;
+
+      slot &probe(uint64_t k) {
+        // Fibonacci hashing spreads the mostly-equal ports and neighbouring addresses.
+        std::size_t i = (std::size_t) ((k * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+        while (slots_[i].key != 0 && slots_[i].key != k) i = (i + 1) & mask_;
+        return slots_[i];
+      }
+
+      void rehash(std::size_t capacity) {
+        std::vector<slot> old;
+        old.swap(slots_);
+        slots_.assign(capacity, slot());
+        mask_ = capacity - 1;
+        for (std::size_t i = 0; i < old.size(); ++i) {
+          if (old[i].key != 0) probe(old[i].key) = old[i];
+        }
+      }
+  };
+
+  /*!
+  \brief Sends an info query to every target and collects the replies.
+
+  One unconnected UDP socket is used for everything.  Requests go out with
+  sendmmsg() and replies come in with recvmmsg(), a batch per system call, and
+  replies are matched to targets by their source address in an address_table.  No
+  more than max_in_flight requests wait for replies at once, so the socket's
+  receive buffer does not overflow and drop them.
+
+  Targets which do not reply in time are asked again up to \c retries times.
+  Servers which want a challenge on info requests get it, without using up a
+  retry.  Split replies are put back together.
+
+  Only IPv4, which is all game servers and master servers use.  A run() inside a
+  common::deadline_scope stops at its deadline or when it is cancelled.
+  */
+  class scanner {
+    public:
+      struct options {
+        //! Datagrams per sendmmsg() or recvmmsg().
+        unsigned batch;
+        //! Requests waiting for a reply at once.
+        unsigned max_in_flight;
+        //! How long to wait for each reply.
+        int timeout_ms;
+        //! How many more times to ask a target which does not reply.
+        unsigned retries;
+        //! SO_RCVBUF to ask for.  The kernel may give less.
+        int receive_buffer;
+
+        options() : batch(64), max_in_flight(2048), timeout_ms(1000), retries(1), receive_buffer(4 << 20) {}
+      };
+
+      typedef enum {target_waiting, target_replied, target_timed_out, target_failed} target_state_t;
+
+      static const std::size_t npos = ~std::size_t(0);
+
+      explicit scanner(const options &o = options())
+      : options_(o), fd_(-1), in_flight_(0), next_(0), replied_(0), send_blocked_(false) {
+        if (options_.batch == 0) options_.batch = 1;
+        if (options_.max_in_flight == 0) options_.max_in_flight = 1;
+      }
+
+      ~scanner() {
+        if (fd_ != -1) close(fd_);
+      }
+
+      //! Add a server.  \returns its index, which is its first index if it was already added.
+      std::size_t add(const struct sockaddr_in &addr) {
+        uint32_t i = table_.insert(address_table::key(addr), (uint32_t) targets_.size());
+        if (i == targets_.size()) {
+          target t;
+          std::memset(&t, 0, sizeof(t));
+          t.addr = addr;
+          targets_.push_back(t);
+        }
+        return i;
+      }
+
+      //! Add a server by its dotted quad.  npos if \c ip is not one.
+      std::size_t add(const char *ip, uint16_t port) {
+        struct sockaddr_in a;
+        std::memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip, &a.sin_addr) != 1) return npos;
+        return add(a);
+      }
+
+      //! Make room for \c n servers.
+      void reserve(std::size_t n) {
+        targets_.reserve(n);
+        table_.reserve(n);
+      }
+
+      /*!
+      \brief Query every target once, waiting for their replies or timeouts.
+
+      Replies from an earlier run() are discarded first.  Fails only if the socket
+      cannot be used, or at a deadline_scope's deadline.
+      */
+      common::status run() {
+        common::status st = open();
+        if (! st.ok()) return st;
+        reset();
+
+        uint64_t timeout_ns = (uint64_t) options_.timeout_ms * 1000000;
+        while (true) {
+          uint64_t now = common::metrics::now_ns();
+          st = common::deadline_scope::check(now);
+          if (! st.ok()) return st;
+          expire(now, timeout_ns);
+
+          bool more = next_ < targets_.size() || ! queue_.empty();
+          if (! more && in_flight_ == 0) break;
+          bool can_send = more && in_flight_ < options_.max_in_flight;
+          if (can_send && ! send_blocked_) {
+            st = send_batch();
+            if (! st.ok()) return st;
+            can_send = (next_ < targets_.size() || ! queue_.empty()) && in_flight_ < options_.max_in_flight;
+          }
+
+          // Only block when there is nothing to send, or the socket is full.
+          uint64_t wait = 0;
+          if (! can_send || send_blocked_) {
+            now = common::metrics::now_ns();
+            wait = fifo_.empty() ? timeout_ns : fifo_.front().sent_ns + timeout_ns;
+            wait = (wait > now) ? wait - now : 0;
+            uint64_t limit = common::deadline_scope::at_ns();
+            if (limit - now < wait || limit < now) wait = (limit > now) ? limit - now : 0;
+            if (common::deadline_scope::active() && wait > common::deadline_scope::cancel_poll_ns) {
+              wait = common::deadline_scope::cancel_poll_ns;
+            }
+          }
+          st = wait_for_io(wait);
+          if (! st.ok()) return st;
+          receive_all();
+        }
+        return common::status();
+      }
+
+      std::size_t size() const { return targets_.size(); }
+
+      //! How many targets replied in the last run().
+      std::size_t replied() const { return replied_; }
+
+      const struct sockaddr_in &address(std::size_t i) const { return targets_[i].addr; }
+      target_state_t state(std::size_t i) const { return (target_state_t) targets_[i].state; }
+
+      //! Time from the request which was answered to its reply.
+      uint64_t rtt_ns(std::size_t i) const { return targets_[i].rtt_ns; }
+
+      //! The whole info reply; empty unless the target replied.
+      std::string_view reply(std::size_t i) const {
+        const target &t = targets_[i];
+        if (t.state != target_replied) return std::string_view();
+        return std::string_view(replies_.data() + t.reply_offset, t.reply_length);
+      }
+
+      //! The reply decoded as it is read; see codec::info_reader.
+      codec::info_reader info(std::size_t i) const {
+        codec::info_reader r;
+        std::string_view v = reply(i);
+        if (! v.empty()) r.open(v.data(), v.size());
+        return r;
+      }
+
+    private:
+      //! Room to notice datagrams longer than servers send.
+      static const std::size_t receive_size = 1500;
+      //! New challenges a target may answer with before it is given up on.
+      static const uint8_t max_challenges = 2;
+
+      struct target {
+        struct sockaddr_in addr;
+        //! When the request in flight went; 0 if none is.
+        uint64_t sent_ns;
+        uint64_t rtt_ns;
+        std::size_t reply_offset;
+        uint32_t reply_length;
+        int32_t challenge;
+        uint8_t tries;
+        uint8_t challenges;
+        uint8_t state;
+      };
+
+      //! A request sent, in the order they were sent and so the order they time out.
+      struct sent_entry {
+        uint32_t index;
+        uint64_t sent_ns;
+      };
+
+      options options_;
+      int fd_;
+      std::vector<target> targets_;
+      address_table table_;
+      //! Every reply, end to end.
+      std::string replies_;
+      std::unordered_map<uint32_t, std::unique_ptr<split_reassembler> > splits_;
+
+      std::deque<sent_entry> fifo_;
+      //! Targets to send to again, ahead of new ones.
+      std::deque<uint32_t> queue_;
+      unsigned in_flight_;
+      std::size_t next_;
+      std::size_t replied_;
+      bool send_blocked_;
+
+      //! Batch buffers, kept between runs.
+      std::vector<struct mmsghdr> send_msgs_;
+      std::vector<struct iovec> send_iov_;
+      std::vector<unsigned char> send_buf_;
+      std::vector<uint32_t> send_targets_;
+      std::vector<struct mmsghdr> recv_msgs_;
+      std::vector<struct iovec> recv_iov_;
+      std::vector<char> recv_buf_;
+      std::vector<struct sockaddr_in> recv_addr_;
+
+      common::status open() {
+        if (fd_ != -1) return common::status();
+        fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ == -1) return common::errno_status(common::connection_failed, "socket() failed");
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &options_.receive_buffer, sizeof(options_.receive_buffer));
+
+        std::size_t b = options_.batch;
+        send_msgs_.assign(b, mmsghdr());
+        send_iov_.assign(b, iovec());
+        send_buf_.assign(b * request_size, 0);
+        send_targets_.assign(b, 0);
+        recv_msgs_.assign(b, mmsghdr());
+        recv_iov_.assign(b, iovec());
+        recv_buf_.assign(b * receive_size, 0);
+        recv_addr_.assign(b, sockaddr_in());
+        return common::status();
+      }
+
+      static const std::size_t request_size = 32;
+
+      void reset() {
+        for (std::size_t i = 0; i < targets_.size(); ++i) {
+          target &t = targets_[i];
+          t.sent_ns = 0;
+          t.rtt_ns = 0;
+          t.reply_offset = 0;
+          t.reply_length = 0;
+          t.challenge = codec::no_challenge;
+          t.tries = 0;
+          t.challenges = 0;
+          t.state = target_waiting;
+        }
+        replies_.clear();
+        splits_.clear();
+        fifo_.clear();
+        queue_.clear();
+        in_flight_ = 0;
+        next_ = 0;
+        replied_ = 0;
+        send_blocked_ = false;
+        // Late replies to the last run would be mistaken for answers to this one.
+        char junk[receive_size];
+        while (recv(fd_, junk, sizeof(junk), MSG_DONTWAIT) >= 0) {}
+      }
+
+      //! Give up on or ask again the requests which have waited too long.
+      void expire(uint64_t now, uint64_t timeout_ns) {
+        while (! fifo_.empty()) {
+          sent_entry e = fifo_.front();
+          target &t = targets_[e.index];
+          if (t.sent_ns != e.sent_ns || t.state != target_waiting) {
+            // Answered, or sent again since.
+            fifo_.pop_front();
+            continue;
+          }
+          if (now - e.sent_ns < timeout_ns) break;
+          fifo_.pop_front();
+          t.sent_ns = 0;
+          --in_flight_;
+          if (t.tries <= options_.retries) queue_.push_back(e.index);
+          else t.state = target_timed_out;
+        }
+      }
+
+      common::status send_batch() {
+        unsigned n = 0;
+        while (n < options_.batch && in_flight_ + n < options_.max_in_flight) {
+          uint32_t i;
+          if (! queue_.empty()) {
+            i = queue_.front();
+            queue_.pop_front();
+          }
+          else if (next_ < targets_.size()) {
+            i = (uint32_t) next_++;
+          }
+          else {
+            break;
+          }
+          prepare(n++, i);
+        }
+
+        unsigned done = 0;
+        while (done < n) {
+          int r = sendmmsg(fd_, &send_msgs_[done], n - done, 0);
+          uint64_t now = common::metrics::now_ns();
+          if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+              // Full; the rest go first once it drains.
+              for (unsigned k = n; k-- > done; ) queue_.push_front(send_targets_[k]);
+              send_blocked_ = true;
+              break;
+            }
+            // Only this target is at fault, eg there is no route to it.
+            targets_[send_targets_[done]].state = target_failed;
+            ++done;
+            continue;
+          }
+          for (int k = 0; k < r; ++k) sent(send_targets_[done + k], now);
+          done += r;
+        }
+        return common::status();
+      }
+
+      void prepare(unsigned n, uint32_t i) {
+        target &t = targets_[i];
+        unsigned char *buf = &send_buf_[n * request_size];
+        std::size_t sz = (t.challenge == codec::no_challenge) ? codec::encode_info(buf, request_size)
+                                                             : codec::encode_info(buf, request_size, t.challenge);
+        send_iov_[n].iov_base = buf;
+        send_iov_[n].iov_len = sz;
+        struct msghdr &m = send_msgs_[n].msg_hdr;
+        std::memset(&m, 0, sizeof(m));
+        m.msg_name = &t.addr;
+        m.msg_namelen = sizeof(t.addr);
+        m.msg_iov = &send_iov_[n];
+        m.msg_iovlen = 1;
+        send_targets_[n] = i;
+      }
+
+      void sent(uint32_t i, uint64_t now) {
+        target &t = targets_[i];
+        t.sent_ns = now;
+        ++t.tries;
+        ++in_flight_;
+        sent_entry e;
+        e.index = i;
+        e.sent_ns = now;
+        fifo_.push_back(e);
+      }
+
+      common::status wait_for_io(uint64_t wait_ns) {
+        struct pollfd p;
+        p.fd = fd_;
+        p.events = POLLIN | (send_blocked_ ? POLLOUT : 0);
+        p.revents = 0;
+        struct timespec ts;
+        ts.tv_sec = wait_ns / 1000000000;
+        ts.tv_nsec = wait_ns % 1000000000;
+        int r = ppoll(&p, 1, &ts, NULL);
+        if (r == -1 && errno != EINTR) return common::errno_status(common::recv_failed, "ppoll() failed");
+        if (r > 0 && (p.revents & POLLOUT)) send_blocked_ = false;
+        return common::status();
+      }
+
+      void receive_all() {
+        unsigned b = options_.batch;
+        while (true) {
+          for (unsigned k = 0; k < b; ++k) {
+            recv_iov_[k].iov_base = &recv_buf_[k * receive_size];
+            recv_iov_[k].iov_len = receive_size;
+            struct msghdr &m = recv_msgs_[k].msg_hdr;
+            std::memset(&m, 0, sizeof(m));
+            m.msg_name = &recv_addr_[k];
+            m.msg_namelen = sizeof(recv_addr_[k]);
+            m.msg_iov = &recv_iov_[k];
+            m.msg_iovlen = 1;
+          }
+          int r = recvmmsg(fd_, &recv_msgs_[0], b, MSG_DONTWAIT, NULL);
+          if (r == -1) {
+            if (errno == EINTR) continue;
+            return;
+          }
+          uint64_t now = common::metrics::now_ns();
+          for (int k = 0; k < r; ++k) {
+            if (recv_msgs_[k].msg_hdr.msg_flags & MSG_TRUNC) continue;
+            received(recv_addr_[k], &recv_buf_[k * receive_size], recv_msgs_[k].msg_len, now);
+          }
+          if ((unsigned) r < b) return;
+        }
+      }
+
+      void received(const struct sockaddr_in &from, const char *data, std::size_t len, uint64_t now) {
+        uint32_t i = table_.find(address_table::key(from));
+        if (i == address_table::npos) return;
+        target &t = targets_[i];
+        // A duplicate, or the answer to a try which was given up on.
+        if (t.state != target_waiting || t.sent_ns == 0) return;
+
+        std::string_view reply(data, len);
+        if (len >= 4 && common::codec::load_le<int32_t>((const unsigned char *) data) == codec::split_multiple) {
+          std::unique_ptr<split_reassembler> &s = splits_[i];
+          if (! s) s.reset(new split_reassembler());
+          common::status st = s->add(data, len, now, reply);
+          if (! st.ok()) {
+            finish(i, target_failed);
+            return;
+          }
+          if (reply.empty()) return;
+        }
+
+        codec::header_view h;
+        if (codec::decode_header(reply.data(), reply.size(), h) != codec::decode_ok) return;
+        if (h.type == codec::challenge_reply) {
+          int32_t c;
+          if (codec::decode_challenge(reply.data(), reply.size(), c) != codec::decode_ok) return;
+          if (t.challenges == max_challenges) {
+            finish(i, target_failed);
+            return;
+          }
+          // Ask again straight away; it does not count as a retry.
+          ++t.challenges;
+          --t.tries;
+          t.challenge = c;
+          t.sent_ns = 0;
+          --in_flight_;
+          queue_.push_front(i);
+        }
+        else if (h.type == codec::info_reply) {
+          t.rtt_ns = now - t.sent_ns;
+          t.reply_offset = replies_.size();
+          t.reply_length = reply.size();
+          replies_.append(reply.data(), reply.size());
+          ++replied_;
+          finish(i, target_replied);
+        }
+      }
+
+      void finish(uint32_t i, target_state_t state) {
+        target &t = targets_[i];
+        t.state = state;
+        t.sent_ns = 0;
+        --in_flight_;
+        splits_.erase(i);
+      }
+
+      scanner(const scanner &);
+      scanner &operator=(const scanner &);
+  };
+}
+
+#endif
@@ -0,0 +1,216 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Everything a server will say about itself in about one round trip.
+
+\code
+query::challenge_cache challenges;
+query::connection conn(query::host("10.0.0.5", "27015", true));
+query::snapshot s(conn, challenges);
+std::cout << s.info().map() << std::endl;
+query::codec::player_cursor c = s.players();
+query::codec::player_view p;
+while (c.next(p)) std::cout << p.name << std::endl;
+\endcode
+*/
+
+#ifndef QUERY_SNAPSHOT_HPP_t9b2v6pk
+#define QUERY_SNAPSHOT_HPP_t9b2v6pk
+
+#include <lrcon/query.hpp>
+
+#include <string>
+
+namespace query {
+  /*!
+  \brief The info, players and rules replies of one server, asked for together.
+
+  All three requests go out at once on the one socket, carrying the challenge in
+  the cache, and the replies are told apart by their type byte as they come.  When
+  the cached challenge is good that is a single round trip, against five for
+  challenge, info, challenge, players, challenge, rules one after another.  If the
+  server answers with a challenge instead, it is cached and whatever is still
+  missing is asked for again.
+
+  If some reply never comes, which is normal for rules on servers which turn them
+  off, the query fails with timed_out but what did come can still be read.
+  */
+  class snapshot : public query_base {
+    public:
+      //! Time allowed for all the replies.
+      static const int timeout = 1000000;
+
+      snapshot(common::connection_base &conn, challenge_cache &cache) : rounds_(0) {
+        clear();
+        run(conn, cache).check();
+      }
+
+      //! Query without throwing.  \c st says why if it failed.
+      snapshot(common::connection_base &conn, challenge_cache &cache, common::status &st) : rounds_(0) {
+        clear();
+        st = run(conn, cache);
+      }
+
+      //! Query without throwing, giving up at \c limit.
+      snapshot(common::connection_base &conn, challenge_cache &cache, const common::deadline &limit,
+               common::status &st) : rounds_(0) {
+        clear();
+        common::deadline_scope s(limit);
+        st = may_start();
+        if (st.ok()) st = run(conn, cache);
+      }
+
+      //! Whether each reply came.
+      bool has_info() const { return have_[part_info]; }
+      bool has_players() const { return have_[part_players]; }
+      bool has_rules() const { return have_[part_rules]; }
+
+      //! The info reply.  Its status() is not decode_ok if it did not come.
+      const codec::info_reader &info() const { return info_; }
+
+      //! A new cursor over the players; it has none if they did not come.
+      codec::player_cursor players() const {
+        codec::player_cursor c;
+        if (have_[part_players]) codec::decode_players(replies_[part_players].data(), replies_[part_players].size(), c);
+        return c;
+      }
+
+      //! A new cursor over the rules; it has none if they did not come.
+      codec::rule_cursor rules() const {
+        codec::rule_cursor c;
+        if (have_[part_rules]) codec::decode_rules(replies_[part_rules].data(), replies_[part_rules].size(), c);
+        return c;
+      }
+
+      //! How many times the requests went out; 1 unless the server wanted a new challenge.
+      unsigned rounds() const { return rounds_; }
+
+    private:
+      enum {part_info, part_players, part_rules, parts};
+
+      //! A server which keeps changing its challenge is not worth asking any more.
+      static const unsigned max_rounds = 3;
+
+      std::string replies_[parts];
+      bool have_[parts];
+      codec::info_reader info_;
+      unsigned rounds_;
+
+      void clear() {
+        for (int i = 0; i < parts; ++i) have_[i] = false;
+      }
+
+      bool complete() const { return have_[part_info] && have_[part_players] && have_[part_rules]; }
+
+      common::status run(common::connection_base &conn, challenge_cache &cache) {
+        using common::status;
+        LRCON_METRIC(metrics_start(conn));
+        int socket = conn.socket();
+        std::string key = challenge_cache::key(socket);
+        int32_t challenge = cache.get(key);
+        status st = send_missing(socket, challenge);
+        if (! st.ok()) return st;
+
+        uint64_t until = common::metrics::now_ns() + (uint64_t) timeout * 1000;
+        char buf[max_packet_size];
+        split_reassembler split;
+        while (! complete()) {
+          uint64_t now = common::metrics::now_ns();
+          int left = (now < until) ? (int) ((until - now) / 1000) : 0;
+          if (left <= 0) return status(common::timed_out, "timed out waiting for part of a snapshot");
+
+          std::string_view reply;
+          st = try_read_reply(socket, buf, split, reply, "timed out waiting for part of a snapshot", left);
+          if (! st.ok()) return st;
+          // Too short to say what it is; like a late reply, it is no part of this.
+          if (reply.size() < 5) continue;
+
+          switch ((uint8_t) reply[4]) {
+            case codec::challenge_reply: {
+              int32_t fresh;
+              codec::decode_t d = codec::decode_challenge(reply.data(), reply.size(), fresh);
+              if (d != codec::decode_ok) return decode_error(d, "invalid challenge reply");
+              // Every request sent with the old one is answered like this; ask again once.
+              if (fresh == challenge) break;
+              challenge = fresh;
+              cache.put(key, challenge);
+              if (rounds_ == max_rounds) {
+                return status(common::protocol_violation, "the server would not accept its own challenge");
+              }
+              st = send_missing(socket, challenge);
+              if (! st.ok()) return st;
+              break;
+            }
+            case codec::info_reply: {
+              keep(part_info, reply);
+              codec::decode_t d = info_.open(replies_[part_info].data(), replies_[part_info].size());
+              if (d != codec::decode_ok) return decode_error(d, "invalid info reply");
+              break;
+            }
+            case codec::players_reply: {
+              keep(part_players, reply);
+              codec::player_cursor c;
+              codec::decode_t d = codec::decode_players(reply.data(), reply.size(), c);
+              if (d != codec::decode_ok) return decode_error(d, "invalid players reply");
+              break;
+            }
+            case codec::rules_reply: {
+              keep(part_rules, reply);
+              codec::rule_cursor c;
+              codec::decode_t d = codec::decode_rules(reply.data(), reply.size(), c);
+              if (d != codec::decode_ok) return decode_error(d, "invalid rules reply");
+              break;
+            }
+            default:
+              // Late replies to something else on this socket.
+              break;
+          }
+        }
+        LRCON_METRIC(metrics_finish());
+        return status();
+      }
+
+      void keep(int part, std::string_view reply) {
+        replies_[part].assign(reply.data(), reply.size());
+        have_[part] = true;
+      }
+
+      //! Ask for every reply not had yet.
+      common::status send_missing(int socket, int32_t challenge) {
+        ++rounds_;
+        unsigned char pkt[32];
+        std::size_t sz;
+        if (! have_[part_info]) {
+          // Servers which do not want a challenge on info ignore one.
+          sz = (challenge == codec::no_challenge) ? codec::encode_info(pkt, sizeof(pkt))
+                                                  : codec::encode_info(pkt, sizeof(pkt), challenge);
+          common::status st = send(socket, pkt, sz);
+          if (! st.ok()) return st;
+        }
+        if (! have_[part_players]) {
+          sz = codec::encode_challenged(pkt, sizeof(pkt), codec::players_request, challenge);
+          common::status st = send(socket, pkt, sz);
+          if (! st.ok()) return st;
+        }
+        if (! have_[part_rules]) {
+          sz = codec::encode_challenged(pkt, sizeof(pkt), codec::rules_request, challenge);
+          common::status st = send(socket, pkt, sz);
+          if (! st.ok()) return st;
+        }
+        return common::status();
+      }
+
+      common::status send(int socket, const unsigned char *pkt, std::size_t sz) {
+        common::result<int> sent = try_send_buffered_packet(socket, pkt, sz);
+        if (! sent.ok()) return sent.error();
+        LRCON_METRIC(common::metrics::record_sent(*stats_, sz));
+        return common::status();
+      }
+
+      snapshot(const snapshot &);
+      snapshot &operator=(const snapshot &);
+  };
+}
+
+#endif
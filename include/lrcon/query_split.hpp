@@ -0,0 +1,332 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Puts query replies which were split over several datagrams back together.
+
+A reply too big for one datagram is sent as fragments with a split_multiple
+header.  GoldSrc and Source servers use different headers, and Source servers may
+also compress the whole reply with bzip2.  Decompression needs libbz2: define
+LRCON_BZIP2 and link it, which the CMake build does when it finds it.  Without it
+compressed replies fail with protocol_violation.
+
+\code
+query::split_reassembler split;
+std::string_view reply;
+common::status st = split.add(dgram, n, common::metrics::now_ns(), reply);
+if (st.ok() && ! reply.empty()) use(reply);  // starts with the single packet header
+\endcode
+*/
+
+#ifndef QUERY_SPLIT_HPP_m4w8c1tz
+#define QUERY_SPLIT_HPP_m4w8c1tz
+
+#include <lrcon/common.hpp>
+#include <lrcon/query_codec.hpp>
+
+#ifdef LRCON_BZIP2
+#  include <bzlib.h>
+#endif
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace query {
+  /*!
+  \brief Collects split reply fragments by their reply id until each reply is whole.
+
+  Fragments may come in any order and more than once.  The header variant is
+  worked out from a set's first fragment, whose data starts with the single packet
+  header, unless the engine is given.  Each reply in progress is limited in bytes
+  and fragments, only a few may be in progress at once, and those left incomplete
+  for longer than the timeout are dropped.
+
+  Not thread-safe.
+  */
+  class split_reassembler {
+    public:
+      //! Which header the fragments have.
+      typedef enum {engine_auto, engine_source, engine_goldsrc} engine_t;
+
+      struct limits {
+        //! Raw bytes held for one reply, and the most it may decompress to.
+        std::size_t max_bytes;
+        //! Fragments in one reply.  GoldSrc can never send more than 15.
+        unsigned max_fragments;
+        //! Replies in progress.  The oldest is dropped to make room.
+        unsigned max_pending;
+        //! How long a reply may stay incomplete.
+        uint64_t timeout_ns;
+
+        limits()
+        : max_bytes(64 * 1024), max_fragments(32), max_pending(4), timeout_ns(3000000000ULL) {}
+      };
+
+      explicit split_reassembler(engine_t engine = engine_auto, const limits &l = limits())
+      : engine_(engine), limits_(l) {}
+
+      /*!
+      \brief Add one datagram.
+
+      \param reply  set to the whole reply, starting with its single packet header,
+                    once there is one.  It views either \c dgram or memory in here
+                    which is reused by the next add().  Empty while more is needed.
+      \returns protocol_violation if the datagram or its set is bad, in which case
+               the set is dropped.
+      */
+      common::status add(const void *dgram, std::size_t len, uint64_t now_ns, std::string_view &reply) {
+        reply = std::string_view();
+        expire(now_ns);
+
+        const unsigned char *p = (const unsigned char *) dgram;
+        codec::header_view h;
+        if (codec::decode_header(p, len, h) != codec::decode_ok) {
+          return common::status(common::protocol_violation, "a query reply had no valid header");
+        }
+        if (h.split_type == codec::split_single) {
+          reply = std::string_view((const char *) p, len);
+          return common::status();
+        }
+        if (len <= goldsrc_header) return common::status(common::protocol_violation, "a split fragment was truncated");
+
+        int32_t id = common::codec::load_le<int32_t>(p + 4);
+        std::size_t i = find(id, now_ns);
+        reply_set &s = pending_[i];
+        if (s.bytes + len > limits_.max_bytes || s.fragments.size() >= limits_.max_fragments) {
+          drop(i);
+          return common::status(common::protocol_violation, "a split reply was too big");
+        }
+
+        fragment f;
+        f.offset = s.data.size();
+        f.length = len;
+        f.number = unknown;
+        s.data.append((const char *) p, len);
+        s.bytes += len;
+        s.fragments.push_back(f);
+
+        if (s.engine == engine_auto) {
+          if (! recognise(s, s.fragments.size() - 1)) return common::status();
+          for (std::size_t k = 0; k < s.fragments.size(); ++k) number(s, k);
+        }
+        else {
+          number(s, s.fragments.size() - 1);
+        }
+        if (s.total == 0 || s.received < s.total || s.payload_offset == 0) return common::status();
+
+        common::status st = assemble(s);
+        drop(i);
+        if (st.ok()) reply = whole_;
+        return st;
+      }
+
+      //! Drop replies which have been incomplete for too long.  add() calls this itself.
+      void expire(uint64_t now_ns) {
+        for (std::size_t i = pending_.size(); i-- > 0; ) {
+          if (now_ns - pending_[i].first_ns >= limits_.timeout_ns) drop(i);
+        }
+      }
+
+      //! Replies in progress.
+      std::size_t pending() const { return pending_.size(); }
+
+      //! The engine worked out so far, or as given.
+      engine_t engine() const { return engine_; }
+
+    private:
+      static const uint8_t unknown = 0xFF;
+      //! Split type, id and the packet number byte.
+      static const std::size_t goldsrc_header = 9;
+      //! ... and the total, number and fragment size.
+      static const std::size_t source_header = 12;
+      //! Source without the fragment size, as sent by some early games.
+      static const std::size_t source_short_header = 10;
+      //! Decompressed size and CRC, in the first fragment only.
+      static const std::size_t compression_header = 8;
+      //! The top bit of the id.
+      static const uint32_t compressed_bit = 0x80000000u;
+
+      struct fragment {
+        std::size_t offset;
+        std::size_t length;
+        uint8_t number;
+      };
+
+      struct reply_set {
+        int32_t id;
+        uint64_t first_ns;
+        engine_t engine;
+        //! Where the data starts in fragments after the first; 0 until that one is seen.
+        std::size_t payload_offset;
+        uint8_t total;
+        unsigned received;
+        std::size_t bytes;
+        //! Every datagram as it came.
+        std::string data;
+        std::vector<fragment> fragments;
+        //! Which numbers have come, by number.
+        std::vector<bool> seen;
+      };
+
+      engine_t engine_;
+      limits limits_;
+      std::vector<reply_set> pending_;
+      std::string whole_;
+
+      std::size_t find(int32_t id, uint64_t now_ns) {
+        for (std::size_t i = 0; i < pending_.size(); ++i) {
+          if (pending_[i].id == id) return i;
+        }
+        if (pending_.size() >= limits_.max_pending) drop(oldest());
+        pending_.push_back(reply_set());
+        reply_set &s = pending_.back();
+        s.id = id;
+        s.first_ns = now_ns;
+        s.engine = engine_;
+        s.payload_offset = 0;
+        s.total = 0;
+        s.received = 0;
+        s.bytes = 0;
+        return pending_.size() - 1;
+      }
+
+      std::size_t oldest() const {
+        std::size_t o = 0;
+        for (std::size_t i = 1; i < pending_.size(); ++i) {
+          if (pending_[i].first_ns < pending_[o].first_ns) o = i;
+        }
+        return o;
+      }
+
+      void drop(std::size_t i) {
+        if (i + 1 != pending_.size()) std::swap(pending_[i], pending_.back());
+        pending_.pop_back();
+      }
+
+      static bool compressed(const reply_set &s) { return ((uint32_t) s.id & compressed_bit) != 0; }
+
+      //! Whether the reply itself starts at \c q.
+      static bool starts_reply(const unsigned char *q, std::size_t room, bool compressed) {
+        if (compressed) return room >= 3 && q[0] == 'B' && q[1] == 'Z' && q[2] == 'h';
+        return room >= 4 && common::codec::load_le<int32_t>(q) == codec::split_single;
+      }
+
+      /*!
+      \brief If fragment \c k is the first, learn the header variant from it.
+
+      Only the first fragment has something known in its data to find.
+      */
+      bool recognise(reply_set &s, std::size_t k) {
+        const fragment &f = s.fragments[k];
+        const unsigned char *p = (const unsigned char *) s.data.data() + f.offset;
+        std::size_t n = f.length;
+        bool z = compressed(s);
+        std::size_t extra = z ? compression_header : 0;
+
+        if (engine_ != engine_goldsrc && n > source_header + extra && p[9] == 0 &&
+            common::codec::load_le<uint16_t>(p + 10) <= codec::max_packet_size &&
+            starts_reply(p + source_header + extra, n - source_header - extra, z)) {
+          learn(s, engine_source, source_header);
+        }
+        else if (engine_ != engine_goldsrc && n > source_short_header + extra && p[9] == 0 &&
+                 starts_reply(p + source_short_header + extra, n - source_short_header - extra, z)) {
+          learn(s, engine_source, source_short_header);
+        }
+        else if (engine_ != engine_source && ! z && (p[8] >> 4) == 0 &&
+                 starts_reply(p + goldsrc_header, n - goldsrc_header, false)) {
+          learn(s, engine_goldsrc, goldsrc_header);
+        }
+        else if (s.engine != engine_auto) {
+          // The engine is known, so trust the header even though the data looked odd.
+          s.payload_offset = (s.engine == engine_goldsrc) ? goldsrc_header : source_header;
+        }
+        return s.engine != engine_auto;
+      }
+
+      void learn(reply_set &s, engine_t engine, std::size_t offset) {
+        s.engine = engine;
+        s.payload_offset = offset;
+        // A server does not change engine, so later sets needn't wait for their first fragment.
+        if (engine_ == engine_auto) engine_ = engine;
+      }
+
+      //! Read fragment \c k's number and the set's total, unless it is a duplicate.
+      void number(reply_set &s, std::size_t k) {
+        fragment &f = s.fragments[k];
+        const unsigned char *p = (const unsigned char *) s.data.data() + f.offset;
+        uint8_t total, num;
+        if (s.engine == engine_goldsrc) {
+          total = p[8] & 0x0F;
+          num = p[8] >> 4;
+        }
+        else {
+          if (f.length <= source_short_header) return;
+          total = p[8];
+          num = p[9];
+        }
+        if (total == 0 || num >= total || (s.total != 0 && total != s.total)) return;
+        if (s.total == 0) {
+          s.total = total;
+          s.seen.assign(total, false);
+        }
+        if (s.seen[num]) return;
+        s.seen[num] = true;
+        f.number = num;
+        ++s.received;
+        if (num == 0 && s.payload_offset == 0) recognise(s, k);
+      }
+
+      //! Join the fragments' data in order, then decompress it if need be.
+      common::status assemble(const reply_set &s) {
+        std::vector<const fragment *> order(s.total, NULL);
+        for (std::size_t k = 0; k < s.fragments.size(); ++k) {
+          if (s.fragments[k].number != unknown) order[s.fragments[k].number] = &s.fragments[k];
+        }
+        bool z = compressed(s);
+        std::string joined;
+        std::string &out = z ? joined : whole_;
+        out.clear();
+        uint32_t size = 0, crc = 0;
+        for (std::size_t n = 0; n < order.size(); ++n) {
+          const char *p = s.data.data() + order[n]->offset;
+          std::size_t skip = s.payload_offset + ((n == 0 && z) ? compression_header : 0);
+          if (order[n]->length < skip) return common::status(common::protocol_violation, "a split fragment was truncated");
+          if (n == 0 && z) {
+            size = common::codec::load_le<uint32_t>((const unsigned char *) p + s.payload_offset);
+            crc = common::codec::load_le<uint32_t>((const unsigned char *) p + s.payload_offset + 4);
+          }
+          out.append(p + skip, order[n]->length - skip);
+        }
+        if (! z) return common::status();
+        return decompress(joined, size, crc);
+      }
+
+      common::status decompress(const std::string &in, uint32_t size, uint32_t crc) {
+#ifdef LRCON_BZIP2
+        if (size > limits_.max_bytes) return common::status(common::protocol_violation, "a split reply was too big");
+        whole_.resize(size);
+        unsigned int got = size;
+        int r = BZ2_bzBuffToBuffDecompress(size ? &whole_[0] : NULL, &got, (char *) in.data(), in.size(), 0, 0);
+        if (r != BZ_OK || got != size) {
+          return common::status(common::protocol_violation, "a compressed split reply did not decompress");
+        }
+        if (common::codec::crc32(whole_.data(), whole_.size()) != crc) {
+          return common::status(common::protocol_violation, "a compressed split reply failed its CRC check");
+        }
+        return common::status();
+#else
+        (void) in;
+        (void) size;
+        (void) crc;
+        return common::status(common::protocol_violation, "compressed split replies need LRCON_BZIP2");
+#endif
+      }
+
+      split_reassembler(const split_reassembler &);
+      split_reassembler &operator=(const split_reassembler &);
+  };
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Token bucket and exponential backoff.
+
+Neither is thread-safe and neither reads the clock; the caller passes the time,
+normally from common::metrics::now_ns().
+*/
+
+#ifndef RATE_LIMIT_HPP_b8u4t1nc
+#define RATE_LIMIT_HPP_b8u4t1nc
+
+#include <stdint.h>
+
+namespace common {
+  /*!
+  \brief Allows \c burst operations at once and \c per_second on average.
+
+  A rate of 0 or less means no limit.
+  */
+  class token_bucket {
+    //! Tokens per nanosecond.
+    double rate_;
+    double burst_;
+    double tokens_;
+    uint64_t last_ns_;
+
+    public:
+      token_bucket(double per_second, double burst)
+      : rate_(per_second / 1e9), burst_(burst < 1 ? 1 : burst), tokens_(burst_), last_ns_(0) {}
+
+      //! Take a token.  \returns 0 if one was taken, otherwise the nanoseconds until one is due.
+      uint64_t take(uint64_t now_ns) {
+        if (rate_ <= 0) return 0;
+        if (last_ns_ != 0 && now_ns > last_ns_) {
+          tokens_ += (now_ns - last_ns_) * rate_;
+          if (tokens_ > burst_) tokens_ = burst_;
+        }
+        last_ns_ = now_ns;
+
+        if (tokens_ >= 1) {
+          tokens_ -= 1;
+          return 0;
+        }
+        return (uint64_t) ((1 - tokens_) / rate_) + 1;
+      }
+  };
+
+  /*!
+  \brief Exponential backoff with jitter.
+
+  Each failure doubles the delay from \c initial_ns up to \c max_ns, and the actual
+  wait is a random point in the upper half of that so clients which failed
+  together do not retry together.
+  */
+  class backoff {
+    uint64_t initial_ns_;
+    uint64_t max_ns_;
+    unsigned failures_;
+    uint64_t until_ns_;
+    uint64_t rng_;
+
+    public:
+      backoff(uint64_t initial_ns, uint64_t max_ns, uint64_t seed)
+      : initial_ns_(initial_ns), max_ns_(max_ns), failures_(0), until_ns_(0), rng_(seed) {}
+
+      //! Nanoseconds left to wait, or 0 if trying again is allowed.
+      uint64_t remaining(uint64_t now_ns) const {
+        return (until_ns_ > now_ns) ? until_ns_ - now_ns : 0;
+      }
+
+      unsigned failures() const { return failures_; }
+
+      void failed(uint64_t now_ns) {
+        uint64_t delay = initial_ns_;
+        for (unsigned i = 0; i < failures_ && delay < max_ns_; ++i) delay *= 2;
+        if (delay > max_ns_) delay = max_ns_;
+        ++failures_;
+
+        uint64_t half = delay / 2;
+        until_ns_ = now_ns + half + (half ? next_random() % (half + 1) : 0);
+      }
+
+      void succeeded() {
+        failures_ = 0;
+        until_ns_ = 0;
+      }
+
+    private:
+      //! splitmix64.
+      uint64_t next_random() {
+        uint64_t z = (rng_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+      }
+  };
+}
+
+#endif
@@ -20,6 +20,8 @@ See \ref p_RCON "RCON Protocol" for usage.
 #define RCON_HPP_58dx55q1
 
 #include <lrcon/common.hpp>
+#include <lrcon/rcon_codec.hpp>
+#include <lrcon/spool.hpp>
 
 #include <cassert>
 #include <cstring>
@@ -87,6 +89,7 @@ namespace rcon {
   typedef common::recv_error recv_error;
   typedef common::send_error send_error;
   typedef common::timeout_error timeout_error;
+  typedef common::cancelled_error cancelled_error;
   //@}
 
   //! Convenience wrapper class
@@ -94,6 +97,14 @@ namespace rcon {
     //! \param is_ip  means no lookup will be done if true
     host(const char *host, const char *port, bool is_ip = false) 
     : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::tcp) : common::host::tcp)) {}
+
+    //! Resolve without throwing.  On failure \c st says why and valid() is false.
+    host(const char *host, const char *port, bool is_ip, common::status &st)
+    : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::tcp) : common::host::tcp), st) {}
+
+    //! Resolve without throwing, giving up at \c limit.
+    host(const char *host, const char *port, bool is_ip, const common::deadline &limit, common::status &st)
+    : common::host(host, port, ((is_ip) ? (common::host::is_ip|common::host::tcp) : common::host::tcp), limit, st) {}
   };
   
 
@@ -107,29 +118,49 @@ namespace rcon {
     protected:
       //! Values sent in the packet and returned by the server as the command id.
       typedef enum {
-        auth_request = 3, 
-        auth_response = 2, 
-        exec_request = 1, 
-        exec_response = 0
+        auth_request = codec::auth_request, 
+        auth_response = codec::auth_response, 
+        exec_request = codec::exec_request, 
+        exec_response = codec::exec_response
       } command_id_t;
       
       int32_t send_request_id_;
       int32_t recvd_request_id_;
       int32_t command_id_;
       std::string payload_;
+      //! Where the reply goes instead of payload_, if set.
+      common::response_sink *sink_;
+
+#ifdef LRCON_METRICS
+      common::metrics::connection_stats *stats_;
+      uint64_t sent_ns_;
+      uint64_t first_packet_ns_;
+      uint64_t last_packet_ns_;
+      unsigned packets_read_;
+#endif
     
     public:
       //! Maximum length of one of the string fields.
-      static const size_t max_string_length = 4096;
+      static const size_t max_string_length = codec::max_string_length;
       
-      //! The complete string payload read in the response.
+      //! The complete string payload read in the response.  Empty if it went to a response_sink.
       const std::string &data() const { return payload_; }
+
+#ifdef LRCON_METRICS
+      //! \name Timings of this command.  Only exist when LRCON_METRICS is defined.
+      //@{
+      //! Nanoseconds from sending to the first packet of the reply being readable.
+      uint64_t first_byte_ns() const { return packets_read_ ? first_packet_ns_ - sent_ns_ : 0; }
+      //! Nanoseconds from sending to the last packet of the reply being readable.
+      uint64_t elapsed_ns() const { return packets_read_ ? last_packet_ns_ - sent_ns_ : 0; }
+      //! Number of packets read in the reply.
+      unsigned packets_read() const { return packets_read_; }
+      //@}
+#endif
     
     protected:
-      // Three ints, two strings.
-      static const size_t max_packet_size = sizeof(int32_t) * 3 + command_base::max_string_length * 2;
-      // Three ints, two nulls.
-      static const size_t min_packet_size = sizeof(int32_t) * 3 + 1 + 1;
+      static const size_t max_packet_size = codec::max_packet_size;
+      static const size_t min_packet_size = codec::min_packet_size;
 
       
       //! \pre this->command_id_ is one of command_id_t
@@ -143,9 +174,27 @@ namespace rcon {
       \throws send_error 
       */
       command_base(common::connection_base &c, int32_t send_id, command_id_t command_id, const std::string &payload)
-      : send_request_id_(send_id), command_id_((int32_t) command_id), payload_(payload) {
+      : send_request_id_(send_id), recvd_request_id_(0), command_id_((int32_t) command_id), payload_(payload), sink_(NULL) {
+        init_metrics(c);
         write(c.socket());
       }
+
+      //! \brief Send the packet without throwing.  \c st is the result of the send.
+      command_base(common::connection_base &c, int32_t send_id, command_id_t command_id, const std::string &payload,
+                   common::status &st)
+      : send_request_id_(send_id), recvd_request_id_(0), command_id_((int32_t) command_id), payload_(payload), sink_(NULL) {
+        init_metrics(c);
+        st = try_write(c.socket());
+      }
+
+      //! \brief As above, but nothing is sent if \c limit has already passed or been cancelled.
+      command_base(common::connection_base &c, int32_t send_id, command_id_t command_id, const std::string &payload,
+                   const common::deadline &limit, common::status &st)
+      : send_request_id_(send_id), recvd_request_id_(0), command_id_((int32_t) command_id), payload_(payload), sink_(NULL) {
+        init_metrics(c);
+        st = limit.check(common::metrics::now_ns());
+        if (st.ok()) st = try_write(c.socket());
+      }
       
       //! \brief Result of the read operation.
       typedef enum {
@@ -180,13 +229,33 @@ namespace rcon {
                assumption read until read_timeout, instead of (read_finished & read_timeout)
       */
       read_result read(int socket, bool error_on_timeout = true) {
+        common::status st;
+        read_result r = try_read(socket, error_on_timeout, st);
+        st.check();
+        return r;
+      }
+
+      /*!
+      \brief Non-throwing implementation of read().
+
+      Errors are stored in \c st instead of thrown and read_finished is returned.
+      */
+      read_result try_read(int socket, bool error_on_timeout, common::status &st) {
+        using common::status;
         RCON_DEBUG_MESSAGE("Reading a packet.");
         
-        int timeleft = common::wait_for_select(socket, common::wait_readable);
-        if (timeleft == common::wait_for_select_timeout) {
+        common::result<int> timeleft = common::try_wait_for_select(socket, common::wait_readable);
+        if (! timeleft.ok()) {
+          st = timeleft.error();
+          return read_finished;
+        }
+        else if (timeleft.value() == common::wait_for_select_timeout) {
           RCON_DEBUG_MESSAGE("Timeout.");
+          LRCON_TRACE(ev_rcon_timeout, socket, send_request_id_, 0, error_on_timeout);
           if (error_on_timeout) {
-            throw timeout_error("timed out before any data was read.");
+            LRCON_METRIC(common::metrics::record_timeout(*stats_));
+            st = status(common::timed_out, "timed out before any data was read.");
+            return read_finished;
           }
           else {
             return read_timeout;
@@ -203,83 +272,57 @@ namespace rcon {
               work: it trims it...maybe a really long echo and an exec somefile?
         */
 
-        using common::read_to_buffer;
-        using common::endian_memcpy;
-        
+        LRCON_METRIC(last_packet_ns_ = common::metrics::now_ns());
+        LRCON_METRIC(if (packets_read_++ == 0) first_packet_ns_ = last_packet_ns_);
+
+        // The size field says how much more to read, so packets which arrive
+        // together or in pieces are framed correctly.
         char buffer[max_packet_size];
-        std::size_t bytes = read_to_buffer(socket, &buffer, max_packet_size);
-        buffer[max_packet_size - 1] = '\0';
-        if (bytes < min_packet_size) {
-          throw response_error("too little data was sent");
+        st = recv_exact(socket, buffer, codec::size_field_length);
+        if (! st.ok()) return read_finished;
+
+        std::size_t bytes = codec::frame_length(buffer, codec::size_field_length);
+        if (bytes == 0) {
+          st = status(common::bad_response, "received an invalid packet size");
+          return read_finished;
         }
-        else if (bytes > max_packet_size) {
-          std::cerr << "warning: too much data was sent." << std::endl;
+        st = recv_exact(socket, buffer + codec::size_field_length, bytes - codec::size_field_length);
+        if (! st.ok()) return read_finished;
+        LRCON_METRIC(common::metrics::record_received(*stats_, bytes));
+
+        codec::packet_view packet;
+        std::size_t need;
+        if (codec::decode(buffer, bytes, packet, need) != codec::decode_ok) {
+          LRCON_TRACE(ev_rcon_unterminated, socket, send_request_id_, bytes, 0);
+          st = status(common::bad_response, "a string in the packet was not terminated");
+          return read_finished;
         }
-        
-        std::size_t idx = 0;
-        
-        /// \todo Use var_from_buffer here (when it's written)
-        std::size_t data_size = 0;
-        endian_memcpy(data_size, &buffer[idx]);
-        idx += sizeof(data_size);
-        endian_memcpy(recvd_request_id_, &buffer[idx]);
-        idx += sizeof(recvd_request_id_);
-        endian_memcpy(command_id_, &buffer[idx]);
-        idx += sizeof(command_id_);
+        recvd_request_id_ = packet.request_id;
+        command_id_ = packet.command_id;
         
         RCON_DEBUG_MESSAGE("* Properties of read: ");
         RCON_DEBUG_MESSAGE("* Actual Bytes:  " << bytes << "/" << max_packet_size);
-        RCON_DEBUG_MESSAGE("* Reported size: " << data_size << "/" << max_packet_size - sizeof(int32_t));
         RCON_DEBUG_MESSAGE("* Request id:    " << recvd_request_id_);
         RCON_DEBUG_MESSAGE("* Command id:    " << command_id_);
+        LRCON_TRACE(ev_rcon_recv, socket, recvd_request_id_, bytes, command_id_);
         
         if (command_id_ != command_base::auth_request && 
             command_id_ != command_base::auth_response &&
             command_id_ != command_base::exec_request && 
             command_id_ != command_base::exec_response) {
-          throw response_error("received an invalid command id.");
-        }
-          
-        // size DOESN'T include the size of data_size itself!
-        if (data_size > (max_packet_size - sizeof(int32_t)) || 
-            data_size < (min_packet_size - sizeof(int32_t))) {
-          throw response_error("received an invalid packet size");
-        }
-        
-        // Includes the nulls.
-        std::size_t strings_part_length = bytes - min_packet_size;
-        std::size_t old_size = payload_.length();
-//         payload_.resize(payload_.length() + strings_part_length);
-        
-        // First string
-        std::size_t buffered_string_length = std::strlen(&buffer[idx]);
-        payload_ += &buffer[idx];
-        
-        RCON_DEBUG_MESSAGE("* First string (" << buffered_string_length << "):\n'" << &payload_[old_size] << "'");
-        
-        assert(buffer[idx + buffered_string_length] == '\0'); 
-        
-        // Seccond string
-        idx += buffered_string_length + 1;
-        // Could happen if for some reason there was only one null at the end of 
-        // the packet (I put one there manually already)
-        if (idx >= max_packet_size-1) {
-          std::cerr << "warning: the data was not null-terminated." << std::endl;
+          st = status(common::bad_response, "received an invalid command id.");
+          return read_finished;
         }
-        else if (idx >= max_packet_size - max_string_length) {
-          std::cerr << "warning: a string was too long." << std::endl;
+
+        if (packet.body.length() > max_string_length || packet.trailer.length() > max_string_length) {
+          LRCON_TRACE(ev_rcon_string_too_long, socket, recvd_request_id_, bytes, 0);
         }
-        
-        old_size += buffered_string_length;
-        buffered_string_length = std::strlen(&buffer[idx]);
-        payload_ += &buffer[idx];
-        
-        assert(payload_[old_size + buffered_string_length] == '\0');
-        
-        RCON_DEBUG_MESSAGE("* Second string (" << buffered_string_length << "):\n'" << &payload_[old_size] << "'");
-        
-        // +1 for the null at the end of str2
-        assert(bytes == idx + buffered_string_length + 1);
+
+        RCON_DEBUG_MESSAGE("* First string (" << packet.body.length() << "):\n'" << packet.body << "'");
+        RCON_DEBUG_MESSAGE("* Second string (" << packet.trailer.length() << "):\n'" << packet.trailer << "'");
+        st = store(packet.body);
+        if (st.ok()) st = store(packet.trailer);
+        if (! st.ok()) return read_finished;
 
         /// \todo This needs to be tested.  If this is not a ccorrect way of 
         ///       determining the end of data, then I should have an option 
@@ -288,38 +331,90 @@ namespace rcon {
 
         return (bytes == max_packet_size) ? read_again : read_finished ;
       }
+
+      //! Add to the reply.
+      common::status store(std::string_view s) {
+        if (sink_) return sink_->append(s);
+        payload_.append(s);
+        return common::status();
+      }
+
+      //! Bytes of reply so far.
+      std::size_t reply_size() const { return sink_ ? sink_->size() : payload_.length(); }
+
+      /*!
+      \brief Read exactly \c len bytes of a packet which has started arriving.
+
+      A timeout here is always an error because the packet is incomplete.
+      */
+      common::status recv_exact(int socket, char *buf, std::size_t len) {
+        std::size_t got = 0;
+        while (got < len) {
+          common::result<int> received = common::try_read_to_buffer(socket, buf + got, len - got);
+          if (! received.ok()) return received.error();
+          if (received.value() == 0) {
+            return common::status(common::recv_failed, "the server closed the connection");
+          }
+          got += received.value();
+          if (got == len) break;
+
+          common::result<int> timeleft = common::try_wait_for_select(socket, common::wait_readable);
+          if (! timeleft.ok()) return timeleft.error();
+          if (timeleft.value() == common::wait_for_select_timeout) {
+            LRCON_TRACE(ev_rcon_timeout, socket, send_request_id_, got, 1);
+            LRCON_METRIC(common::metrics::record_timeout(*stats_));
+            return common::status(common::timed_out, "timed out in the middle of a packet.");
+          }
+        }
+        return common::status();
+      }
       
       //! \brief Send *this as an RCON packet.
       void write(int socket) {
-        // Size is NOT including the size we are currently summing up report.
-        int32_t size = sizeof(int32_t) * 2 + payload_.length() + sizeof(char) + sizeof(char);
-        
-        /// \todo Use send_to_buffer and var_to_buffer
-        
-        RCON_DEBUG_MESSAGE("Data sending properties: ");
-        RCON_DEBUG_MESSAGE("  Packet: " << size);
-        if (common::send_type(socket, size) == common::send_type_error) {
-          common::errno_throw<send_error>("error sending size");
+        try_write(socket).check();
+      }
+
+      //! \brief Non-throwing implementation of write().  Nothing is sent if a deadline_scope says to stop.
+      common::status try_write(int socket) {
+        if (common::deadline_scope::active()) {
+          common::status stop = common::deadline_scope::check(common::metrics::now_ns());
+          if (! stop.ok()) return stop;
         }
-        
+
+        RCON_DEBUG_MESSAGE("Data sending properties: ");
         RCON_DEBUG_MESSAGE("  Request id: " << send_request_id_);
-        if (common::send_type(socket, send_request_id_) == common::send_type_error) {
-          common::errno_throw<send_error>("error sending request_id");
-        }
-        
         RCON_DEBUG_MESSAGE("  Command id: " << command_id_);
-        if (common::send_type(socket, command_id_) == common::send_type_error) {
-          common::errno_throw<send_error>("error sending command_id");
-        }
-        
         RCON_DEBUG_MESSAGE("  Payload: '" << payload_ << "'");
-        if (send(socket, payload_.c_str(), payload_.length() + 1, 0) == -1) {
-          common::errno_throw<send_error>("error sending payload");
+
+        // One send() for the whole packet; separate sends for each field interact
+        // badly with Nagle's algorithm and delayed acks.
+        char buffer[max_packet_size];
+        std::size_t size = codec::encode(buffer, sizeof(buffer), send_request_id_, command_id_, payload_);
+        if (size == 0) {
+          return common::status(common::send_failed, "the payload is too long to send");
         }
+        RCON_DEBUG_MESSAGE("  Packet: " << size);
 
-        if (common::send_type<char>(socket, '\0') ==  common::send_type_error) {
-          common::errno_throw<send_error>("error sending terminating null");
+        std::size_t sent = 0;
+        while (sent < size) {
+          common::result<int> r = common::try_send_from_buffer(socket, buffer + sent, size - sent, "error sending packet");
+          if (! r.ok()) return r.error();
+          sent += r.value();
         }
+
+        LRCON_METRIC(common::metrics::record_sent(*stats_, size));
+        LRCON_TRACE(ev_rcon_send, socket, send_request_id_, size, command_id_);
+        return common::status();
+      }
+
+    private:
+      void init_metrics(common::connection_base &c) {
+        // Only used with LRCON_METRICS.
+        (void) c;
+        LRCON_METRIC(stats_ = &c.stats());
+        LRCON_METRIC(first_packet_ns_ = last_packet_ns_ = 0);
+        LRCON_METRIC(packets_read_ = 0);
+        LRCON_METRIC(sent_ns_ = common::metrics::now_ns());
       }
   };  
 
@@ -363,6 +458,7 @@ namespace rcon {
         assert(request_id != auth_denied_req_id);
         assert(password.length() < 4096);
         get_reply(conn);
+        LRCON_METRIC(record_auth());
         
         if (auth() == failed) {
           throw bad_password("authentication denied.");
@@ -389,6 +485,41 @@ namespace rcon {
         assert(request_id != auth_denied_req_id);
         assert(password.length() < 4096);
         get_reply(conn);
+        LRCON_METRIC(record_auth());
+      }
+
+      /*!
+      \brief Authenticate without throwing.
+
+      \c st is password_rejected or auth_failed in the cases where the checking
+      constructor would throw bad_password or auth_error.
+
+      \pre strlen(password) < 4096.
+      \pre request_id != auth_denied_req_id
+      */
+      auth_command(common::connection_base &conn, const std::string &password,
+                   common::status &st, int32_t request_id = auth_send_req_id)
+      : command_base(conn, request_id, command_base::auth_request, password, st) {
+        RCON_DEBUG_MESSAGE("Initialising an RCON auth request (non-throwing): '" << password << "'");
+        assert(request_id != auth_denied_req_id);
+        assert(password.length() < 4096);
+        if (st.ok()) st = check_reply(conn);
+      }
+
+      /*!
+      \brief Authenticate without throwing, giving up at \c limit.
+
+      \pre strlen(password) < 4096.
+      \pre request_id != auth_denied_req_id
+      */
+      auth_command(common::connection_base &conn, const std::string &password,
+                   const common::deadline &limit, common::status &st, int32_t request_id = auth_send_req_id)
+      : command_base(conn, request_id, command_base::auth_request, password, limit, st) {
+        RCON_DEBUG_MESSAGE("Initialising an RCON auth request (deadline): '" << password << "'");
+        assert(request_id != auth_denied_req_id);
+        assert(password.length() < 4096);
+        common::deadline_scope s(limit);
+        if (st.ok()) st = check_reply(conn);
       }
       
       //! \brief Check the request ids match.
@@ -405,6 +536,30 @@ namespace rcon {
       }
       
     private:
+      //! Read the reply and map a refusal onto the status.
+      common::status check_reply(common::connection_base &conn) {
+        common::status st = try_get_reply(conn);
+        if (! st.ok()) return st;
+        LRCON_METRIC(record_auth());
+
+        if (auth() == failed) {
+          return common::status(common::password_rejected, "authentication denied.");
+        }
+        else if (auth() == error) {
+          return common::status(common::auth_failed, "the server returned an unexpected value.");
+        }
+        return st;
+      }
+
+#ifdef LRCON_METRICS
+      void record_auth() {
+        common::metrics::registry &m = common::metrics::global();
+        m.auths.add();
+        m.auth_latency.record(elapsed_ns());
+        if (auth() != success) m.auth_failures.add();
+      }
+#endif
+
       /*!
       I make the following undocumented assumption:
       - authing returns a 'mirror' packet followed by the actual auth accepted/denied packet.  
@@ -419,11 +574,19 @@ namespace rcon {
       \throw proto_error  if my assumptions were wrong.
       */
       void get_reply(common::connection_base &conn) {
+        try_get_reply(conn).check();
+      }
+
+      //! Non-throwing implementation of get_reply().
+      common::status try_get_reply(common::connection_base &conn) {
         payload_ = "";
         const bool error_on_timeout = true;
-        read(conn.socket(), error_on_timeout);
+        common::status st;
+        try_read(conn.socket(), error_on_timeout, st);
+        if (! st.ok()) return st;
         if (receive_id() != send_id() || command_id() != command_base::exec_response) {
-          throw proto_error("request ID was not returned by the server."); /// \todo should it be revc_error?
+          /// \todo should it be revc_error?
+          return common::status(common::protocol_violation, "request ID was not returned by the server.");
         } 
         
 #ifdef RCON_DEBUG_MESSAGE
@@ -433,10 +596,12 @@ namespace rcon {
         }
 #endif 
         
-        read(conn.socket(), error_on_timeout);
+        try_read(conn.socket(), error_on_timeout, st);
+        if (! st.ok()) return st;
         if (command_id() != command_base::auth_response) {
-          throw proto_error("the server did not return an authorisation response.");
+          return common::status(common::protocol_violation, "the server did not return an authorisation response.");
         }       
+        LRCON_TRACE(ev_rcon_auth, conn.socket(), receive_id(), 0, auth());
         
 #ifdef RCON_DEBUG_MESSAGE
         if (payload_ != "") {
@@ -444,6 +609,7 @@ namespace rcon {
               << payload_ << "' (" << payload_.length() << " bytes)");
         }
 #endif 
+        return st;
       }
   };
 
@@ -501,7 +667,49 @@ namespace rcon {
         assert(send_id != auth_command::auth_denied_req_id);
         get_reply(conn, false);
       }
+
+      /*!
+      \brief Initialise and check for validity without throwing.
+
+      \c st gets the error which the checking constructor would have thrown.
+      */
+      command(common::connection_base &conn, const std::string &command, common::status &st,
+              int32_t send_id = default_request_id)
+      : command_base(conn, send_id, command_base::exec_request, command, st) {
+        RCON_DEBUG_MESSAGE("Initialising an RCON command (non-throwing): '" << command << "'");
+        if (st.ok()) st = try_get_reply(conn, true);
+      }
+
+      /*!
+      \brief Initialise and check without throwing, giving up at \c limit.
+
+      If the deadline passes or the token is cancelled part way through a reply of
+      several packets then \c st says so and data() has the packets which came.  The
+      rest of the reply is left unread, so do not reuse the connection after that.
+      */
+      command(common::connection_base &conn, const std::string &command, const common::deadline &limit,
+              common::status &st, int32_t send_id = default_request_id)
+      : command_base(conn, send_id, command_base::exec_request, command, limit, st) {
+        RCON_DEBUG_MESSAGE("Initialising an RCON command (deadline): '" << command << "'");
+        common::deadline_scope s(limit);
+        if (st.ok()) st = try_get_reply(conn, true);
+      }
       
+      /*!
+      \brief As the non-throwing constructor, but the reply goes to \c out.
+
+      \c out is cleared first.  Use this for replies which may be megabytes, eg
+      cvarlist; see common::response_sink.  data() stays empty.
+      */
+      command(common::connection_base &conn, const std::string &command, common::response_sink &out,
+              common::status &st, int32_t send_id = default_request_id)
+      : command_base(conn, send_id, command_base::exec_request, command, st) {
+        RCON_DEBUG_MESSAGE("Initialising an RCON command (to a sink): '" << command << "'");
+        out.clear();
+        sink_ = &out;
+        if (st.ok()) st = try_get_reply(conn, true);
+      }
+
       //! \brief Checks the request id was mirrored back correctly.
       bool valid() const { return send_id() == receive_id(); }
       
@@ -514,27 +722,46 @@ namespace rcon {
     private:
       //! \brief Reads all incoming packets into the data store.
       void get_reply(common::connection_base &conn, bool check_validity = false) {
+        try_get_reply(conn, check_validity).check();
+      }
+
+      //! Non-throwing implementation of get_reply().
+      common::status try_get_reply(common::connection_base &conn, bool check_validity) {
         payload_ = "";
         // Timeout is an error on the first read
         bool is_first_read = true;
         read_result r;
+        common::status st;
         do {
-          r = read(conn.socket(), is_first_read);
+          r = try_read(conn.socket(), is_first_read, st);
+          if (! st.ok()) return st;
           
           // Timeout added no more data so no need to check again.
           if (r == read_timeout) break;
           
           if (check_validity) {
             if (auth_lost()) {
-              throw auth_error("authentication was lost.");
+              return common::status(common::auth_failed, "authentication was lost.");
             }
             else if (! valid()) {
-              throw response_error("request ids did not match.");
+              return common::status(common::bad_response, "request ids did not match.");
             }
           }
           
           is_first_read = false;
         } while (r == read_again);
+        LRCON_TRACE(ev_rcon_command_done, conn.socket(), send_id(), reply_size(), 0);
+
+#ifdef LRCON_METRICS
+        // Tail wait includes the timeout which ended the reply, if there was one.
+        uint64_t end = common::metrics::now_ns();
+        common::metrics::registry &m = common::metrics::global();
+        m.commands.add();
+        m.first_byte_latency.record(first_byte_ns());
+        m.command_latency.record(end - sent_ns_);
+        if (packets_read_ > 1 || r == read_timeout) m.tail_wait_latency.record(end - first_packet_ns_);
+#endif
+        return st;
       }
   };
   
@@ -564,6 +791,34 @@ namespace rcon {
       connection(const host &server) : common::connection_base(server) {
         RCON_DEBUG_MESSAGE("Initialising connection with no authing.");
       }
+
+      /*!
+      \brief Connects and auths without throwing.
+
+      On failure \c st says why.  If the connect itself failed then connected() is
+      false; otherwise the connection is usable but not authorised.
+      */
+      connection(const host &server, const char *password, common::status &st)
+      : common::connection_base(server, st) {
+        RCON_DEBUG_MESSAGE("Initialising authed connection (non-throwing) with password '" << password << "'.");
+        if (st.ok()) {
+          auth_command a(*this, password, st);
+        }
+      }
+
+      //! \brief Connects and auths without throwing, giving up at \c limit.
+      connection(const host &server, const char *password, const common::deadline &limit, common::status &st)
+      : common::connection_base(server, limit, st) {
+        RCON_DEBUG_MESSAGE("Initialising authed connection (deadline) with password '" << password << "'.");
+        if (st.ok()) {
+          auth_command a(*this, password, limit, st);
+        }
+      }
+
+      //! \brief Connects without authing or throwing.
+      connection(const host &server, common::status &st) : common::connection_base(server, st) {
+        RCON_DEBUG_MESSAGE("Initialising connection (non-throwing) with no authing.");
+      }
       
     protected:
       //! override the access.
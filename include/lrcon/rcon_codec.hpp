@@ -0,0 +1,131 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Encoding and decoding of RCON packets without any I/O.
+
+\code
+char buf[rcon::codec::max_packet_size];
+std::size_t n = rcon::codec::encode(buf, sizeof(buf), 42, 2, "status");
+
+rcon::codec::packet_view p;
+std::size_t need;
+switch (rcon::codec::decode(received, received_len, p, need)) {
+  case common::codec::decode_ok:        // p.body is valid; p.wire_size bytes were used
+  case common::codec::decode_need_more: // read until there are need bytes
+  case common::codec::decode_invalid:   // drop the connection
+}
+\endcode
+*/
+
+#ifndef RCON_CODEC_HPP_t6wq1pkd
+#define RCON_CODEC_HPP_t6wq1pkd
+
+#include <lrcon/codec.hpp>
+
+namespace rcon {
+  //! I/O free RCON packet codec; see \link rcon_codec.hpp \endlink.
+  namespace codec {
+    using common::codec::decode_t;
+    using common::codec::decode_ok;
+    using common::codec::decode_need_more;
+    using common::codec::decode_invalid;
+
+    //! Maximum length of one of the string fields.
+    const std::size_t max_string_length = 4096;
+    //! The leading size field, which does not count itself.
+    const std::size_t size_field_length = sizeof(int32_t);
+    //! Size, request id and command id.
+    const std::size_t header_length = sizeof(int32_t) * 3;
+    //! Three ints, two nulls.
+    const std::size_t min_packet_size = header_length + 1 + 1;
+    //! Three ints, two strings.
+    const std::size_t max_packet_size = header_length + max_string_length * 2;
+
+    //! Values of the command id field.
+    typedef enum {
+      auth_request = 3,
+      auth_response = 2,
+      exec_request = 1,
+      exec_response = 0
+    } command_id_t;
+
+    //! A decoded packet.  The strings point into the buffer given to decode().
+    struct packet_view {
+      int32_t request_id;
+      int32_t command_id;
+      //! The first string.
+      std::string_view body;
+      //! The second string, which is normally empty.
+      std::string_view trailer;
+      //! Bytes of the buffer which made up this packet.
+      std::size_t wire_size;
+    };
+
+    //! Everything after the size field.
+    typedef common::codec::layout<
+      common::codec::field<&packet_view::request_id>,
+      common::codec::field<&packet_view::command_id>,
+      common::codec::field<&packet_view::body>,
+      common::codec::field<&packet_view::trailer> > packet_layout;
+
+    //! Bytes needed to encode a packet with the given body.
+    inline std::size_t encoded_size(std::size_t body_length) {
+      return size_field_length + packet_layout::min_size + body_length;
+    }
+
+    /*!
+    \brief Encode a packet with an empty second string.
+
+    \returns bytes written, or 0 if \c cap is smaller than encoded_size().
+    */
+    inline std::size_t encode(void *buf, std::size_t cap, int32_t request_id, int32_t command_id, std::string_view body) {
+      std::size_t sz = encoded_size(body.length());
+      if (cap < sz) return 0;
+
+      packet_view v;
+      v.request_id = request_id;
+      v.command_id = command_id;
+      v.body = body;
+      v.trailer = std::string_view();
+      unsigned char *p = (unsigned char *) buf;
+      common::codec::store_le<int32_t>(p, (int32_t) (sz - size_field_length));
+      packet_layout::encode_unchecked(p + size_field_length, v);
+      return sz;
+    }
+
+    /*!
+    \brief Bytes needed before decode() can succeed.
+
+    With fewer than size_field_length bytes this is size_field_length; otherwise the
+    whole packet as given by its size field.  0 if the size field is invalid.
+    */
+    inline std::size_t frame_length(const void *buf, std::size_t len) {
+      if (len < size_field_length) return size_field_length;
+      int32_t size = common::codec::load_le<int32_t>((const unsigned char *) buf);
+      if (size < (int32_t) (min_packet_size - size_field_length)
+          || size > (int32_t) (max_packet_size - size_field_length)) {
+        return 0;
+      }
+      return size + size_field_length;
+    }
+
+    /*!
+    \brief Decode the packet at the start of \c buf.
+
+    \param need  set to the number of bytes required when decode_need_more is returned.
+    */
+    inline decode_t decode(const void *buf, std::size_t len, packet_view &out, std::size_t &need) {
+      need = frame_length(buf, len);
+      if (need == 0) return decode_invalid;
+      if (len < need) return decode_need_more;
+
+      out.wire_size = need;
+      const unsigned char *p = (const unsigned char *) buf + size_field_length;
+      // The size field said the packet was complete, so running out means a missing null.
+      return (packet_layout::decode(p, need - size_field_length, out) == decode_ok) ? decode_ok : decode_invalid;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,579 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Non-blocking RCON connection state for event loops.
+
+A session does no waiting of its own.  Its owner polls fd() for events(), calls
+handle() with what happened and expire() when next_deadline() passes.  Everything
+must be called from the one thread.
+
+Loops which do the socket I/O themselves, such as with io_uring, instead give
+the session what they received with received() and send what take_output()
+gives them.  handle() is still used while connecting.
+*/
+
+#ifndef RCON_SESSION_HPP_m3z8q1wd
+#define RCON_SESSION_HPP_m3z8q1wd
+
+#include <lrcon/rcon.hpp>
+#include <lrcon/work_pool.hpp>
+
+#include <poll.h>
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+namespace rcon {
+  /*!
+  \brief One RCON connection with any number of commands in flight.
+
+  Commands are given their own request id and sent once the connection is
+  authorised; the reply packets are routed back by that id.  At most
+  max_in_flight commands are sent ahead of their replies.  The rest wait in the
+  session, where interactive commands go ahead of bulk ones (but see
+  common::interactive_per_bulk), so an operator's command is not stuck behind a
+  mass operation in the socket buffers or the server.  A reply ends with the
+  first packet which is not full, or when no more packets arrive within the timeout
+  after a full one, as in rcon::command.
+
+  Each command is finished with either a std::promise or a completion.  Errors
+  carry the same status which the blocking classes would turn into exceptions.
+  Once the session fails it closes its socket and fails every later command with
+  the same status.
+  */
+  class session {
+    public:
+      //! Called once with the reply or the reason there isn't one.
+      typedef std::function<void (common::result<std::string> &)> completion;
+
+      //! Commands sent ahead of their replies by default.
+      static const std::size_t default_max_in_flight = 16;
+
+      //! A command to send.
+      struct request {
+        std::string text;
+        common::priority_t priority;
+        //! Used instead of reply when set.
+        completion done;
+        std::promise<std::string> reply;
+
+        request() : priority(common::priority_interactive) {}
+      };
+
+      typedef enum {idle, connecting, authing, ready, failed} state_t;
+
+      /*!
+      \param timeout_ns  for the connect, the auth and each packet of a reply.
+      \param pool  where completions run, or NULL to run them inline.
+      \param max_in_flight  commands sent ahead of their replies; 0 for no limit.
+      */
+      explicit session(uint64_t timeout_ns, common::work_pool *pool = NULL,
+                       std::size_t max_in_flight = default_max_in_flight)
+      : timeout_ns_(timeout_ns), pool_(pool), max_in_flight_(max_in_flight), fd_(-1), owns_fd_(false),
+        state_(idle), state_deadline_ns_(0), next_id_(0), interactive_run_(0), out_sent_(0),
+        in_(codec::max_packet_size * 2), in_len_(0) {}
+
+      //! Fails anything outstanding with connection_failed.
+      ~session() {
+        fail(common::status(common::connection_failed, "the session was closed"));
+      }
+
+      /*!
+      \brief Use a socket which is already connected and authorised.
+
+      The socket stays owned by the caller.
+      */
+      void adopt(int fd) {
+        assert(state_ == idle);
+        fd_ = fd;
+        state_ = ready;
+      }
+
+      /*!
+      \brief Start connecting and authorising without waiting for either.
+
+      Commands can be added straight away; they are sent once the server accepts
+      the password.
+
+      \pre password.length() < codec::max_string_length
+      */
+      common::status open(const common::host &server, const std::string &password) {
+        assert(state_ == idle);
+        if (! server.valid()) return fail(common::status(common::resolve_failed, "the host was not resolved"));
+
+        fd_ = ::socket(server.family(), server.type(), 0);
+        if (fd_ == -1) return fail(common::errno_status(common::connection_failed, "socket() failed"));
+        owns_fd_ = true;
+        LRCON_TRACE(ev_connect_begin, fd_, 0, 0, 0);
+        LRCON_METRIC(connect_start_ns_ = common::metrics::now_ns());
+
+        int flags = fcntl(fd_, F_GETFL, 0);
+        if (flags == -1 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) == -1) {
+          return fail(common::errno_status(common::connection_failed, "could not make the socket non-blocking"));
+        }
+
+        password_ = password;
+        state_deadline_ns_ = common::metrics::now_ns() + timeout_ns_;
+        if (connect(fd_, server.address(), server.address_len()) == 0) {
+          start_auth();
+        }
+        else if (errno == EINPROGRESS) {
+          state_ = connecting;
+        }
+        else {
+          LRCON_TRACE(ev_connect_failed, fd_, 0, 0, errno);
+          return fail(common::errno_status(common::connection_failed, "connect() failed"));
+        }
+        return common::status();
+      }
+
+      int fd() const { return fd_; }
+      state_t state() const { return state_; }
+
+      //! Why the session failed.  Only meaningful when state() == failed.
+      const common::status &error() const { return error_; }
+
+#ifdef LRCON_METRICS
+      //! Traffic recorded on this session.  Only exists when LRCON_METRICS is defined.
+      common::metrics::connection_stats &stats() { return stats_; }
+#endif
+
+      //! Number of commands which have not finished.
+      std::size_t outstanding() const {
+        return queued_[common::priority_interactive].size() + queued_[common::priority_bulk].size() + pending_.size();
+      }
+
+      //! poll() events to wait for on fd().
+      short events() const {
+        if (state_ == connecting) return POLLOUT;
+        if (state_ == failed || state_ == idle) return 0;
+        return POLLIN | ((out_sent_ < out_.size()) ? POLLOUT : 0);
+      }
+
+      //! Queue a command.  It fails straight away if the session has.
+      void add(request &r) {
+        if (state_ == failed) {
+          finish(r.done, r.reply, error_);
+        }
+        else {
+          queued_[r.priority == common::priority_bulk].push_back(std::move(r));
+          if (state_ == ready) pump();
+        }
+      }
+
+      //! Act on what poll() said about fd().
+      void handle(short revents) {
+        if (state_ == connecting) {
+          if (revents & (POLLOUT | POLLERR | POLLHUP)) connected();
+          return;
+        }
+        if (revents & (POLLIN | POLLERR | POLLHUP)) receive();
+        // Replies free pipeline slots, so there may be new commands to send too.
+        if (state_ == ready || state_ == authing) flush();
+      }
+
+      //! Send as much of the queued output as the socket will take.
+      void flush() {
+        while (out_sent_ < out_.size()) {
+          ssize_t n = send(fd_, &out_[out_sent_], out_.size() - out_sent_, MSG_DONTWAIT | MSG_NOSIGNAL);
+          if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail(common::errno_status(common::send_failed, "error sending packet"));
+            return;
+          }
+          out_sent_ += n;
+        }
+        out_.clear();
+        out_sent_ = 0;
+      }
+
+      /*!
+      \brief Take bytes which the owner received on fd().
+
+      Packets wholly inside \c data are routed from there; only a partial packet at
+      the end is copied.  \c len == 0 means the server closed the connection.
+      */
+      void received(const char *data, std::size_t len) {
+        if (state_ != authing && state_ != ready) return;
+        if (len == 0) {
+          fail(common::status(common::recv_failed, "the server closed the connection"));
+          return;
+        }
+        if (in_len_ == 0) {
+          std::size_t used = route_all(data, len);
+          if (state_ == failed) return;
+          data += used;
+          len -= used;
+        }
+        while (len > 0) {
+          std::size_t n = std::min(len, in_.size() - in_len_);
+          std::memcpy(&in_[in_len_], data, n);
+          in_len_ += n;
+          data += n;
+          len -= n;
+          if (! consume()) return;
+        }
+      }
+
+      /*!
+      \brief Move the output waiting to be sent into \c buf for the owner to send.
+
+      The old contents of \c buf are discarded.  Send it all, in order, before taking
+      more.
+
+      \returns false if there was nothing to send.
+      */
+      bool take_output(std::string &buf) {
+        if (out_sent_ == out_.size()) return false;
+        if (out_sent_) out_.erase(0, out_sent_);
+        buf.swap(out_);
+        out_.clear();
+        out_sent_ = 0;
+        return true;
+      }
+
+      //! Time out whatever is due at \c now_ns.
+      void expire(uint64_t now_ns) {
+        if (state_ == connecting || state_ == authing) {
+          if (state_deadline_ns_ > now_ns) return;
+          LRCON_METRIC(common::metrics::record_timeout(stats_));
+          if (state_ == connecting) {
+            LRCON_TRACE(ev_connect_timeout, fd_, 0, 0, 0);
+            fail(common::status(common::timed_out, "timeout when connecting to host."));
+          }
+          else {
+            LRCON_TRACE(ev_rcon_timeout, fd_, auth_request_id, 0, 1);
+            fail(common::status(common::timed_out, "timed out waiting for the auth response."));
+          }
+          return;
+        }
+
+        std::unordered_map<int32_t, pending>::iterator i = pending_.begin();
+        while (i != pending_.end()) {
+          std::unordered_map<int32_t, pending>::iterator cur = i++;
+          if (cur->second.deadline_ns > now_ns) continue;
+
+          LRCON_TRACE(ev_rcon_timeout, fd_, cur->first, 0, cur->second.packets == 0);
+          if (cur->second.packets > 0) {
+            complete(cur);
+          }
+          else {
+            LRCON_METRIC(common::metrics::record_timeout(stats_));
+            finish(cur->second.done, cur->second.reply,
+                   common::status(common::timed_out, "timed out before any data was read."));
+            pending_.erase(cur);
+          }
+        }
+        // Not inside the loop: sending adds to pending_, which would invalidate i.
+        pump();
+      }
+
+      //! When expire() next has something to do, or ~0 if never.
+      uint64_t next_deadline() const {
+        if (state_ == connecting || state_ == authing) return state_deadline_ns_;
+        uint64_t next = ~uint64_t(0);
+        for (std::unordered_map<int32_t, pending>::const_iterator i = pending_.begin(); i != pending_.end(); ++i) {
+          if (i->second.deadline_ns < next) next = i->second.deadline_ns;
+        }
+        return next;
+      }
+
+      /*!
+      \brief Fail everything outstanding and every later command with \c st.
+
+      \returns the status the session failed with, which is the first one given.
+      */
+      common::status fail(const common::status &st) {
+        if (state_ != failed) {
+          error_ = st;
+          state_ = failed;
+          if (owns_fd_ && fd_ != -1) close(fd_);
+          if (owns_fd_) fd_ = -1;
+        }
+
+        std::unordered_map<int32_t, pending> p;
+        p.swap(pending_);
+        for (std::unordered_map<int32_t, pending>::iterator i = p.begin(); i != p.end(); ++i) {
+          finish(i->second.done, i->second.reply, error_);
+        }
+        for (int q = 0; q < 2; ++q) {
+          std::deque<request> w;
+          w.swap(queued_[q]);
+          for (std::size_t i = 0; i < w.size(); ++i) finish(w[i].done, w[i].reply, error_);
+        }
+
+        out_.clear();
+        out_sent_ = 0;
+        in_len_ = 0;
+        return error_;
+      }
+
+    private:
+      //! Request id of the auth packet.  Commands use 0x100 and up.
+      static const int32_t auth_request_id = 1;
+
+      //! A sent command waiting for its reply.
+      struct pending {
+        completion done;
+        std::promise<std::string> reply;
+        std::string data;
+        uint64_t deadline_ns;
+        unsigned packets;
+        LRCON_METRIC(uint64_t sent_ns;)
+      };
+
+      uint64_t timeout_ns_;
+      common::work_pool *pool_;
+      std::size_t max_in_flight_;
+      int fd_;
+      bool owns_fd_;
+      state_t state_;
+      common::status error_;
+      //! Deadline of the connect or auth.
+      uint64_t state_deadline_ns_;
+      std::string password_;
+      uint32_t next_id_;
+
+      //! Commands not sent yet, indexed by priority_t.
+      std::deque<request> queued_[2];
+      //! Interactive commands sent since the last bulk one.
+      unsigned interactive_run_;
+      std::unordered_map<int32_t, pending> pending_;
+      std::string out_;
+      std::size_t out_sent_;
+      std::vector<char> in_;
+      std::size_t in_len_;
+
+#ifdef LRCON_METRICS
+      common::metrics::connection_stats stats_;
+      uint64_t connect_start_ns_;
+#endif
+
+      //! Hand a reply or error to whoever is waiting for it.
+      void finish(completion &done, std::promise<std::string> &reply, common::result<std::string> r) {
+        if (done) {
+          if (pool_) {
+            // std::function needs a copyable task.
+            std::shared_ptr<common::result<std::string> > shared(new common::result<std::string>(std::move(r)));
+            completion d(std::move(done));
+            pool_->post([d, shared]() { d(*shared); });
+          }
+          else {
+            // As on the pool, a throwing completion must not take the caller's loop with it.
+            try {
+              done(r);
+            }
+            catch (...) {
+            }
+          }
+        }
+        else if (r.ok()) {
+          reply.set_value(std::move(r.value()));
+        }
+        else {
+          try {
+            r.error().check();
+          }
+          catch (...) {
+            reply.set_exception(std::current_exception());
+          }
+        }
+      }
+
+      //! Append a packet to the output.  False if the body is too long.
+      bool queue_packet(int32_t id, int32_t command_id, const std::string &body) {
+        std::size_t at = out_.size();
+        out_.resize(at + codec::encoded_size(body.length()));
+        if (codec::encode(&out_[at], out_.size() - at, id, command_id, body) == 0) {
+          out_.resize(at);
+          return false;
+        }
+        LRCON_METRIC(common::metrics::record_sent(stats_, out_.size() - at));
+        LRCON_TRACE(ev_rcon_send, fd_, id, out_.size() - at, command_id);
+        return true;
+      }
+
+      //! Send queued commands while there is room in the pipeline.
+      void pump() {
+        if (state_ != ready) return;
+        std::deque<request> &interactive = queued_[common::priority_interactive];
+        std::deque<request> &bulk = queued_[common::priority_bulk];
+        while (! (interactive.empty() && bulk.empty()) && (max_in_flight_ == 0 || pending_.size() < max_in_flight_)) {
+          bool take_bulk = interactive.empty()
+                        || (! bulk.empty() && interactive_run_ >= common::interactive_per_bulk);
+          std::deque<request> &q = take_bulk ? bulk : interactive;
+          interactive_run_ = take_bulk ? 0 : interactive_run_ + 1;
+          request r = std::move(q.front());
+          q.pop_front();
+          send_request(r);
+          if (state_ == failed) return;
+        }
+      }
+
+      void send_request(request &r) {
+        int32_t id = (int32_t) (next_id_++ % 0x3FFFFF00) + 0x100;
+        if (! queue_packet(id, codec::exec_request, r.text)) {
+          finish(r.done, r.reply, common::status(common::send_failed, "the payload is too long to send"));
+          return;
+        }
+
+        pending &p = pending_[id];
+        p.done = std::move(r.done);
+        p.reply = std::move(r.reply);
+        p.deadline_ns = common::metrics::now_ns() + timeout_ns_;
+        p.packets = 0;
+        LRCON_METRIC(p.sent_ns = common::metrics::now_ns());
+      }
+
+      //! The non-blocking connect finished one way or the other.
+      void connected() {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+          fail(common::errno_status(common::connection_failed, "checking for socket error with getsockopt() failed"));
+          return;
+        }
+        if (err != 0) {
+          LRCON_TRACE(ev_connect_failed, fd_, 0, 0, err);
+          fail(common::status(common::connection_failed, "delayed connection failed", err));
+          return;
+        }
+        start_auth();
+      }
+
+      void start_auth() {
+        LRCON_TRACE(ev_connect_end, fd_, 0, 0, 0);
+#ifdef LRCON_METRICS
+        stats_.connect_ns = common::metrics::now_ns() - connect_start_ns_;
+        common::metrics::global().connect_latency.record(stats_.connect_ns);
+        common::metrics::global().connects.add();
+#endif
+        state_ = authing;
+        state_deadline_ns_ = common::metrics::now_ns() + timeout_ns_;
+        if (! queue_packet(auth_request_id, codec::auth_request, password_)) {
+          fail(common::status(common::auth_failed, "the password is too long to send"));
+          return;
+        }
+        flush();
+      }
+
+      //! Read what is available and route every complete packet.
+      void receive() {
+        while (state_ == authing || state_ == ready) {
+          ssize_t n = recv(fd_, &in_[in_len_], in_.size() - in_len_, MSG_DONTWAIT);
+          if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail(common::errno_status(common::recv_failed, "recv() failed"));
+            return;
+          }
+          else if (n == 0) {
+            fail(common::status(common::recv_failed, "the server closed the connection"));
+            return;
+          }
+          in_len_ += n;
+          if (! consume()) return;
+        }
+      }
+
+      //! Route the complete packets in in_ and keep the rest.  False if the session failed.
+      bool consume() {
+        std::size_t used = route_all(&in_[0], in_len_);
+        if (state_ == failed) return false;
+        std::memmove(&in_[0], &in_[used], in_len_ - used);
+        in_len_ -= used;
+        return true;
+      }
+
+      //! Route every complete packet at the start of \c data.  \returns the bytes they took.
+      std::size_t route_all(const char *data, std::size_t len) {
+        std::size_t used = 0;
+        while (state_ == authing || state_ == ready) {
+          codec::packet_view p;
+          std::size_t need;
+          codec::decode_t d = codec::decode(data + used, len - used, p, need);
+          if (d == codec::decode_need_more) break;
+          if (d == codec::decode_invalid) {
+            fail(common::status(common::bad_response, "received an invalid packet"));
+            break;
+          }
+          route(p);
+          used += p.wire_size;
+        }
+        return used;
+      }
+
+      void route(const codec::packet_view &p) {
+        LRCON_METRIC(common::metrics::record_received(stats_, p.wire_size));
+        LRCON_TRACE(ev_rcon_recv, fd_, p.request_id, p.wire_size, p.command_id);
+
+        if (state_ == authing) {
+          // The mirror packet in front of the auth response is ignored.
+          if (p.command_id != codec::auth_response) return;
+          LRCON_TRACE(ev_rcon_auth, fd_, p.request_id, 0, p.request_id == auth_request_id);
+          if (p.request_id == auth_command::auth_denied_req_id) {
+            fail(common::status(common::password_rejected, "authentication denied."));
+          }
+          else if (p.request_id != auth_request_id) {
+            fail(common::status(common::auth_failed, "the server returned an unexpected value."));
+          }
+          else {
+            state_ = ready;
+            pump();
+          }
+          return;
+        }
+
+        if (p.request_id == auth_command::auth_denied_req_id || p.command_id == codec::auth_response) {
+          fail(common::status(common::auth_failed, "authentication was lost."));
+          return;
+        }
+
+        std::unordered_map<int32_t, pending>::iterator i = pending_.find(p.request_id);
+        if (i == pending_.end()) return;
+
+        pending &c = i->second;
+        c.data.append(p.body);
+        c.data.append(p.trailer);
+        ++c.packets;
+        if (p.wire_size == codec::max_packet_size) {
+          // More packets should follow.
+          c.deadline_ns = common::metrics::now_ns() + timeout_ns_;
+        }
+        else {
+          complete(i);
+          pump();
+        }
+      }
+
+      void complete(std::unordered_map<int32_t, pending>::iterator i) {
+        pending &c = i->second;
+        LRCON_TRACE(ev_rcon_command_done, fd_, i->first, c.data.length(), 0);
+#ifdef LRCON_METRICS
+        common::metrics::registry &m = common::metrics::global();
+        m.commands.add();
+        m.command_latency.record(common::metrics::now_ns() - c.sent_ns);
+#endif
+        finish(c.done, c.reply, std::move(c.data));
+        pending_.erase(i);
+      }
+
+      session(const session &);
+      session &operator=(const session &);
+  };
+}
+
+#endif
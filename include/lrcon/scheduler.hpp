@@ -0,0 +1,282 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Keeps bursts of RCON traffic under the servers' flood and ban limits.
+
+\code
+rcon::scheduler sched;
+
+// From any thread.  Waits for the server's rate and the global cap, and backs
+// off the server if the password is rejected.
+std::string out = sched.run("10.0.0.5:27015", [&]() {
+  rcon::connection conn(rcon::host("10.0.0.5", "27015", true), password);
+  return rcon::command(conn, "status").data();
+});
+\endcode
+*/
+
+#ifndef SCHEDULER_HPP_w2h6d9ja
+#define SCHEDULER_HPP_w2h6d9ja
+
+#include <lrcon/common.hpp>
+#include <lrcon/rate_limit.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rcon {
+  /*!
+  \brief Admits work on each server at a limited rate and a limited concurrency.
+
+  Every server, named by any string the caller likes, gets a token bucket.  A
+  server which rejects the password or drops the authorisation is left alone for
+  an exponentially growing, jittered time, because Source servers ban addresses
+  after a few failed auths.  Across all servers no more than max_concurrent pieces
+  of work run at once.
+
+  Work is admitted with a ticket, which holds one of the concurrent places until it
+  is destroyed.  Report what happened on the ticket, or use run() which does both.
+
+  When callers are waiting for a place, interactive ones get it ahead of bulk ones.
+  To stop bulk work starving, each bulk waiter is let in after
+  common::interactive_per_bulk interactive ones.
+  */
+  class scheduler {
+    public:
+      struct limits {
+        //! Sustained rate for each server.  0 for no limit.
+        double per_server_per_second;
+        //! How many can go at once before the rate applies.
+        double per_server_burst;
+        //! Across every server.  0 for no limit.
+        unsigned max_concurrent;
+        //! Backoff after the first auth failure.  It doubles with each further one.
+        int backoff_initial_ms;
+        int backoff_max_ms;
+
+        limits()
+        : per_server_per_second(5), per_server_burst(10), max_concurrent(64),
+          backoff_initial_ms(1000), backoff_max_ms(5 * 60 * 1000) {}
+      };
+
+      //! Permission to do one piece of work.  Movable, not copyable.
+      class ticket {
+        friend class scheduler;
+
+        scheduler *owner_;
+        std::string server_;
+
+        ticket(scheduler *owner, const std::string &server) : owner_(owner), server_(server) {}
+
+        public:
+          ticket() : owner_(NULL) {}
+          ticket(ticket &&o) : owner_(o.owner_), server_(std::move(o.server_)) { o.owner_ = NULL; }
+          ticket &operator=(ticket &&o) {
+            release();
+            owner_ = o.owner_;
+            server_ = std::move(o.server_);
+            o.owner_ = NULL;
+            return *this;
+          }
+          ~ticket() { release(); }
+
+          //! False if try_enter() refused.
+          bool valid() const { return owner_ != NULL; }
+
+          /*!
+          \brief Say how the work went.
+
+          Auth failures back the server off and success ends any backoff.  Other
+          errors are not the server's protection so change nothing.
+          */
+          void report(const common::status &st) {
+            if (owner_) owner_->report(server_, st);
+          }
+
+          //! Give up the concurrent place early.
+          void release() {
+            if (owner_) owner_->leave();
+            owner_ = NULL;
+          }
+
+        private:
+          ticket(const ticket &);
+          ticket &operator=(const ticket &);
+      };
+
+      explicit scheduler(const limits &l = limits()) : limits_(l), running_(0), interactive_run_(0) {
+        place_waiters_[0] = place_waiters_[1] = 0;
+      }
+
+      //! Wait until work on \c server is allowed.
+      ticket enter(const std::string &server, common::priority_t priority = common::priority_interactive) {
+        std::unique_lock<std::mutex> l(mutex_);
+        while (true) {
+          uint64_t wait = admit(server, common::metrics::now_ns(), priority);
+          if (wait == 0) return ticket(this, server);
+          if (wait == wait_for_release) {
+            ++place_waiters_[priority];
+            released_.wait(l);
+            --place_waiters_[priority];
+          }
+          else {
+            released_.wait_for(l, std::chrono::nanoseconds(wait));
+          }
+        }
+      }
+
+      /*!
+      \brief Enter without waiting.
+
+      \param retry_after_ns  when refused, a time worth trying again after.  It is
+                             0 if the refusal was for the concurrency cap, since that
+                             depends on other work finishing.
+      \returns a ticket which is not valid() if refused.
+      */
+      ticket try_enter(const std::string &server, uint64_t &retry_after_ns,
+                       common::priority_t priority = common::priority_interactive) {
+        std::lock_guard<std::mutex> l(mutex_);
+        uint64_t wait = admit(server, common::metrics::now_ns(), priority);
+        if (wait == 0) {
+          retry_after_ns = 0;
+          return ticket(this, server);
+        }
+        retry_after_ns = (wait == wait_for_release) ? 0 : wait;
+        return ticket();
+      }
+
+      /*!
+      \brief Enter, call \c f and report how it went.
+
+      bad_password and auth_error from \c f back the server off and are rethrown.
+      \returns what \c f returns.
+      */
+      template <typename F>
+      auto run(const std::string &server, F f, common::priority_t priority = common::priority_interactive)
+          -> decltype(f()) {
+        ticket t = enter(server, priority);
+        success_guard g(t);
+        try {
+          return f();
+        }
+        catch (common::bad_password &) {
+          t.report(common::status(common::password_rejected, "authentication denied."));
+          throw;
+        }
+        catch (common::auth_error &) {
+          t.report(common::status(common::auth_failed, "authorisation failed."));
+          throw;
+        }
+      }
+
+      //! How many auth failures in a row \c server has had.
+      unsigned failures(const std::string &server) {
+        std::lock_guard<std::mutex> l(mutex_);
+        server_map::iterator i = servers_.find(server);
+        return (i == servers_.end()) ? 0 : i->second.back.failures();
+      }
+
+    private:
+      static const uint64_t wait_for_release = ~uint64_t(0);
+
+      struct server_state {
+        common::token_bucket bucket;
+        common::backoff back;
+
+        server_state(const limits &l, uint64_t seed)
+        : bucket(l.per_server_per_second, l.per_server_burst),
+          back((uint64_t) l.backoff_initial_ms * 1000000, (uint64_t) l.backoff_max_ms * 1000000, seed) {}
+      };
+
+      typedef std::unordered_map<std::string, server_state> server_map;
+
+      //! Reports success when the scope is left other than by an exception.
+      struct success_guard {
+        ticket &t;
+        int exceptions;
+
+        explicit success_guard(ticket &t) : t(t), exceptions(std::uncaught_exceptions()) {}
+        ~success_guard() {
+          if (std::uncaught_exceptions() == exceptions) t.report(common::status());
+        }
+      };
+
+      limits limits_;
+      std::mutex mutex_;
+      //! Signalled when a place becomes free or a server's backoff changes.
+      std::condition_variable released_;
+      server_map servers_;
+      unsigned running_;
+      //! Callers blocked for a place, by priority_t.
+      unsigned place_waiters_[2];
+      //! Interactive admissions since the last bulk one while bulk was waiting.
+      unsigned interactive_run_;
+
+      server_state &state(const std::string &server) {
+        server_map::iterator i = servers_.find(server);
+        if (i != servers_.end()) return i->second;
+        // Different seeds so that servers which failed together retry apart.
+        uint64_t seed = common::metrics::now_ns() ^ (uint64_t) std::hash<std::string>()(server);
+        return servers_.emplace(server, server_state(limits_, seed)).first->second;
+      }
+
+      //! Caller holds mutex_.  \returns 0 if admitted, else how long to wait.
+      uint64_t admit(const std::string &server, uint64_t now, common::priority_t priority) {
+        server_state &s = state(server);
+        uint64_t wait = s.back.remaining(now);
+        if (wait) return wait;
+        if (limits_.max_concurrent && running_ >= limits_.max_concurrent) return wait_for_release;
+        if (! my_turn(priority)) return wait_for_release;
+        wait = s.bucket.take(now);
+        if (wait) return wait;
+        ++running_;
+        if (priority == common::priority_bulk) interactive_run_ = 0;
+        else if (place_waiters_[common::priority_bulk]) ++interactive_run_;
+        return 0;
+      }
+
+      //! Whether a free place should go to this class rather than the other's waiters.
+      bool my_turn(common::priority_t priority) const {
+        bool bulk_due = interactive_run_ >= common::interactive_per_bulk;
+        if (priority == common::priority_bulk) {
+          return place_waiters_[common::priority_interactive] == 0 || bulk_due;
+        }
+        return place_waiters_[common::priority_bulk] == 0 || ! bulk_due;
+      }
+
+      void leave() {
+        {
+          std::lock_guard<std::mutex> l(mutex_);
+          --running_;
+        }
+        released_.notify_all();
+      }
+
+      void report(const std::string &server, const common::status &st) {
+        bool cleared = false;
+        {
+          std::lock_guard<std::mutex> l(mutex_);
+          server_state &s = state(server);
+          if (st.code == common::password_rejected || st.code == common::auth_failed) {
+            s.back.failed(common::metrics::now_ns());
+          }
+          else if (st.ok()) {
+            cleared = s.back.failures() != 0;
+            s.back.succeeded();
+          }
+        }
+        // Callers waiting out the old backoff can go now.
+        if (cleared) released_.notify_all();
+      }
+
+      scheduler(const scheduler &);
+      scheduler &operator=(const scheduler &);
+  };
+}
+
+#endif
@@ -0,0 +1,632 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief RCON to many servers from one event loop per core.  Linux only.
+
+\code
+rcon::sharded_engine engine;
+rcon::endpoint server("10.0.0.5", "27015", "password", true);
+
+std::future<std::string> status = engine.submit(server, "status");
+engine.submit(server, "sv_cheats", [](common::result<std::string> &r) { ... });
+
+// The same, with the loops doing their I/O through io_uring where the kernel can.
+rcon::sharded_engine uring_engine(0, 1000, NULL, rcon::sharded_engine::backend_io_uring);
+\endcode
+*/
+
+#ifndef SHARDED_ENGINE_HPP_f7k2r9xb
+#define SHARDED_ENGINE_HPP_f7k2r9xb
+
+#include <lrcon/rcon_session.hpp>
+#include <lrcon/mpsc_queue.hpp>
+#include <lrcon/uring.hpp>
+#include <lrcon/work_pool.hpp>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rcon {
+  //! A server and the password to authorise with.
+  struct endpoint {
+    std::string address;
+    std::string port;
+    std::string password;
+    //! No lookup is done when true, as for rcon::host.
+    bool is_ip;
+
+    endpoint(const std::string &address, const std::string &port, const std::string &password, bool is_ip = false)
+    : address(address), port(port), password(password), is_ip(is_ip) {}
+  };
+
+  /*!
+  \brief Sessions with many servers spread over one event loop per core.
+
+  Each endpoint belongs to one loop, picked by a stable hash of its address and
+  port, and that loop alone owns the endpoint's rcon::session.  Submitting threads
+  push onto the loop's lock-free queue and wake it only if it is not already
+  awake, so the hot path takes no locks and the session state never leaves its
+  core.  The loop threads are pinned to a core each where the system allows.
+
+  A session is opened by the first command for its endpoint and kept for later
+  ones; if it fails then the commands already in it fail and the next command
+  opens a new one.  Replies, errors and completions behave as for
+  rcon::shared_connection.
+
+  The loops either wait for readiness with epoll and do their own recv() and
+  send() calls, or with backend_io_uring hand all of a round's receives and sends
+  to the kernel in one io_uring_enter().  The io_uring loops keep a multishot
+  receive on each socket, which fills buffers from a ring shared by the loop.
+  Kernels which cannot do that get epoll.
+
+  \warning Host names are looked up on the loop thread and block it.  Give IP
+           addresses with is_ip set for a large fleet.
+  */
+  class sharded_engine {
+    public:
+      static const int default_timeout_ms = 1000;
+
+      typedef session::completion completion;
+
+      //! How the loops do their I/O.
+      typedef enum {backend_epoll, backend_io_uring} backend_t;
+
+      /*!
+      \param loops  number of event loops; 0 means one per core.
+      \param pool  where completions run; it must outlive the engine.
+      \param backend  backend_io_uring falls back to backend_epoll if the kernel
+                      cannot do it; see backend().
+      */
+      explicit sharded_engine(unsigned loops = 0, int timeout_ms = default_timeout_ms,
+                              common::work_pool *pool = NULL, backend_t backend = backend_epoll) {
+        if (loops == 0) loops = std::thread::hardware_concurrency();
+        if (loops == 0) loops = 1;
+        if (backend == backend_io_uring && ! common::uring::supported()) backend = backend_epoll;
+        for (unsigned i = 0; i < loops; ++i) {
+          loops_.push_back(std::unique_ptr<loop>(new loop(i, (uint64_t) timeout_ms * 1000000, pool, backend)));
+        }
+      }
+
+      //! Outstanding commands fail with connection_error.
+      ~sharded_engine() {}
+
+      //! Send a command.  Safe from any thread.
+      std::future<std::string> submit(const endpoint &to, const std::string &command,
+                                      common::priority_t priority = common::priority_interactive) {
+        job j(to);
+        j.request.text = command;
+        j.request.priority = priority;
+        std::future<std::string> f = j.request.reply.get_future();
+        loops_[shard_of(to.address, to.port)]->post(j);
+        return f;
+      }
+
+      //! Send a command and call \c done with the outcome.  Safe from any thread.
+      void submit(const endpoint &to, const std::string &command, completion done,
+                  common::priority_t priority = common::priority_interactive) {
+        job j(to);
+        j.request.text = command;
+        j.request.priority = priority;
+        j.request.done = std::move(done);
+        loops_[shard_of(to.address, to.port)]->post(j);
+      }
+
+      unsigned size() const { return loops_.size(); }
+
+      //! backend_io_uring only if every loop got a ring.
+      backend_t backend() const {
+        for (std::size_t i = 0; i < loops_.size(); ++i) {
+          if (! loops_[i]->uses_uring()) return backend_epoll;
+        }
+        return backend_io_uring;
+      }
+
+      //! The loop which serves an endpoint.
+      unsigned shard_of(const std::string &address, const std::string &port) const {
+        return endpoint_hash(address, port) % loops_.size();
+      }
+
+      //! FNV-1a of "address:port", which unlike std::hash is the same in every process.
+      static uint64_t endpoint_hash(const std::string &address, const std::string &port) {
+        uint64_t h = 14695981039346656037ULL;
+        const std::string *parts[] = {&address, NULL, &port};
+        for (int p = 0; p < 3; ++p) {
+          const char *c = parts[p] ? parts[p]->data() : ":";
+          std::size_t n = parts[p] ? parts[p]->length() : 1;
+          for (std::size_t i = 0; i < n; ++i) {
+            h ^= (unsigned char) c[i];
+            h *= 1099511628211ULL;
+          }
+        }
+        return h;
+      }
+
+    private:
+      struct job {
+        endpoint to;
+        session::request request;
+
+        job() : to("", "", "") {}
+        explicit job(const endpoint &e) : to(e) {}
+      };
+
+      //! One event loop and the sessions it owns.
+      class loop {
+        struct entry {
+          session s;
+          std::string key;
+          //! Events registered with epoll.
+          short registered;
+          //! Already listed in dead_.
+          bool dead;
+
+          //! \name io_uring state
+          //@{
+          //! Operations the kernel has not finished; the entry must live until they have.
+          unsigned ops;
+          bool poll_armed;
+          bool recv_armed;
+          bool sending;
+          //! Its operations have been cancelled because the session failed.
+          bool cancelled;
+          //! Output taken from the session, kept still while the kernel sends it.
+          std::string send_buf;
+          std::size_t send_off;
+          //@}
+
+          entry(const std::string &k, uint64_t timeout_ns, common::work_pool *pool)
+          : s(timeout_ns, pool), key(k), registered(0), dead(false), ops(0), poll_armed(false),
+            recv_armed(false), sending(false), cancelled(false), send_off(0) {}
+        };
+
+        typedef std::unordered_map<std::string, std::unique_ptr<entry> > session_map;
+
+        //! io_uring user_data is an entry's address with one of these in the low bits.
+        typedef enum {op_wake = 0, op_poll = 1, op_recv = 2, op_send = 3, op_cancel = 4} op_t;
+
+        static const unsigned ring_entries = 256;
+        static const unsigned ring_buffers = 256;
+        static const unsigned ring_buffer_size = 8192;
+
+        unsigned index_;
+        uint64_t timeout_ns_;
+        common::work_pool *pool_;
+        common::mpsc_queue<job> queue_;
+        std::atomic<bool> wake_pending_;
+        std::atomic<bool> stop_;
+        int wake_fd_;
+        int epoll_fd_;
+        //! NULL for the epoll backend.
+        std::unique_ptr<common::uring> ring_;
+
+        //! \name Owned by the loop thread
+        //@{
+        session_map sessions_;
+        //! Sessions given commands in this round, to flush once each.
+        std::vector<entry *> touched_;
+        //! Failed sessions replaced in this round, kept until touched_ is done with.
+        std::vector<std::unique_ptr<entry> > retired_;
+        //! Keys of failed sessions.
+        std::vector<std::string> dead_;
+        //! Failed sessions waiting for the kernel to finish their io_uring operations.
+        std::vector<std::unique_ptr<entry> > draining_;
+        //! Nothing can time out before this.
+        uint64_t next_expiry_ns_;
+        //! Where the io_uring read of wake_fd_ goes.
+        uint64_t wake_count_;
+        bool wake_armed_;
+        //@}
+
+        std::thread thread_;
+
+        public:
+          loop(unsigned index, uint64_t timeout_ns, common::work_pool *pool, backend_t backend)
+          : index_(index), timeout_ns_(timeout_ns), pool_(pool), wake_pending_(false), stop_(false),
+            epoll_fd_(-1), next_expiry_ns_(~uint64_t(0)), wake_count_(0), wake_armed_(false) {
+            wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (wake_fd_ == -1) common::errno_throw<common::connection_error>("eventfd() failed");
+
+            if (backend == backend_io_uring) {
+              common::status st;
+              ring_.reset(new common::uring(ring_entries, ring_buffers, ring_buffer_size, st));
+              // Eg. locked memory limits; this loop uses epoll instead.
+              if (! st.ok()) ring_.reset();
+            }
+
+            if (! ring_) {
+              epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+              if (epoll_fd_ == -1) {
+                close(wake_fd_);
+                common::errno_throw<common::connection_error>("epoll_create1() failed");
+              }
+              struct epoll_event ev;
+              ev.events = EPOLLIN;
+              ev.data.ptr = NULL;
+              epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+            }
+            thread_ = std::thread(&loop::run, this);
+          }
+
+          ~loop() {
+            stop_.store(true);
+            wake();
+            thread_.join();
+            if (epoll_fd_ != -1) close(epoll_fd_);
+            close(wake_fd_);
+          }
+
+          //! Safe from any thread.
+          void post(job &j) {
+            queue_.push(std::move(j));
+            wake();
+          }
+
+          bool uses_uring() const { return ring_ != NULL; }
+
+        private:
+          void wake() {
+            if (! wake_pending_.exchange(true)) {
+              uint64_t one = 1;
+              while (write(wake_fd_, &one, sizeof(one)) == -1 && errno == EINTR) {}
+            }
+          }
+
+          void pin() {
+            unsigned cores = std::thread::hardware_concurrency();
+            if (cores == 0) return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index_ % cores, &set);
+            // Only a hint; the loop works wherever it runs.
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+          }
+
+          void run() {
+            pin();
+            if (ring_) run_uring();
+            else run_epoll();
+
+            // The sessions fail their commands as they are destroyed.
+            sessions_.clear();
+          }
+
+          void run_epoll() {
+            struct epoll_event events[64];
+            while (true) {
+              bool stopping = stop_.load();
+              take_jobs();
+              if (stopping) break;
+
+              uint64_t wait = wait_ns();
+              int n = epoll_wait(epoll_fd_, events, 64, (wait == ~uint64_t(0)) ? -1 : (int) ((wait + 999999) / 1000000));
+              for (int i = 0; i < n; ++i) {
+                entry *e = (entry *) events[i].data.ptr;
+                if (e == NULL) continue;
+                e->s.handle(to_poll(events[i].events));
+                update(*e);
+              }
+
+              uint64_t now = common::metrics::now_ns();
+              if (now >= next_expiry_ns_) expire(now);
+              reap();
+            }
+          }
+
+          void run_uring() {
+            arm_wake();
+            while (true) {
+              bool stopping = stop_.load();
+              take_jobs();
+              if (stopping) break;
+
+              // Everything queued since the last wait goes to the kernel in this one call.
+              ring_->submit_and_wait(wait_ns());
+              ring_->drain([this](const struct io_uring_cqe &c) { completed(c); });
+
+              uint64_t now = common::metrics::now_ns();
+              if (now >= next_expiry_ns_) expire(now);
+              reap();
+            }
+
+            // The kernel must be done with the entries and buffers before they go.
+            for (session_map::iterator i = sessions_.begin(); i != sessions_.end(); ++i) {
+              i->second->s.fail(common::status(common::connection_failed, "the session was closed"));
+              cancel(*i->second);
+            }
+            if (wake_armed_) {
+              struct io_uring_sqe *e = ring_->sqe();
+              e->opcode = IORING_OP_ASYNC_CANCEL;
+              e->addr = op_wake;
+              e->user_data = op_cancel;
+            }
+            uint64_t give_up = common::metrics::now_ns() + 1000000000;
+            while ((wake_armed_ || in_flight()) && common::metrics::now_ns() < give_up) {
+              ring_->submit_and_wait(10000000);
+              ring_->drain([this](const struct io_uring_cqe &c) { completed(c); });
+            }
+          }
+
+          void take_jobs() {
+            // Cleared before popping so a push we miss is followed by another wake().
+            wake_pending_.store(false);
+            uint64_t count;
+            while (read(wake_fd_, &count, sizeof(count)) > 0) {}
+
+            job j;
+            while (queue_.pop(j)) {
+              entry &e = find(j.to);
+              e.s.add(j.request);
+              touched_.push_back(&e);
+            }
+
+            for (std::size_t i = 0; i < touched_.size(); ++i) {
+              entry &e = *touched_[i];
+              if (! ring_ && e.s.state() == session::ready) e.s.flush();
+              update(e);
+              uint64_t d = e.s.next_deadline();
+              if (d < next_expiry_ns_) next_expiry_ns_ = d;
+            }
+            touched_.clear();
+            for (std::size_t i = 0; i < retired_.size(); ++i) discard(retired_[i]);
+            retired_.clear();
+          }
+
+          //! The session for an endpoint, opening one if needed.
+          entry &find(const endpoint &to) {
+            // The password is part of the key so that each one gets its own authorisation.
+            std::string key = to.address + ':' + to.port + '\n' + to.password;
+            std::unique_ptr<entry> &slot = sessions_[key];
+            if (slot && slot->s.state() != session::failed) return *slot;
+
+            if (slot) retired_.push_back(std::move(slot));
+            slot.reset(new entry(key, timeout_ns_, pool_));
+            common::status st;
+            host h(to.address.c_str(), to.port.c_str(), to.is_ip, st);
+            if (st.ok()) st = slot->s.open(h, to.password);
+            if (! st.ok()) slot->s.fail(st);
+            if (! ring_ && slot->s.fd() != -1) {
+              struct epoll_event ev;
+              ev.events = 0;
+              ev.data.ptr = slot.get();
+              epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, slot->s.fd(), &ev);
+            }
+            return *slot;
+          }
+
+          //! Make epoll watch for, or io_uring do, what the session now wants.
+          void update(entry &e) {
+            if (e.s.state() == session::failed) {
+              if (! e.dead) dead_.push_back(e.key);
+              e.dead = true;
+              if (ring_) cancel(e);
+              return;
+            }
+            if (ring_) {
+              arm(e);
+              return;
+            }
+            short want = e.s.events();
+            if (want == e.registered) return;
+            struct epoll_event ev;
+            ev.events = ((want & POLLIN) ? (uint32_t) EPOLLIN : 0u) | ((want & POLLOUT) ? (uint32_t) EPOLLOUT : 0u);
+            ev.data.ptr = &e;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, e.s.fd(), &ev);
+            e.registered = want;
+          }
+
+          void expire(uint64_t now) {
+            next_expiry_ns_ = ~uint64_t(0);
+            for (session_map::iterator i = sessions_.begin(); i != sessions_.end(); ++i) {
+              session &s = i->second->s;
+              if (s.state() == session::failed) continue;
+              s.expire(now);
+              update(*i->second);
+              uint64_t d = s.next_deadline();
+              if (d < next_expiry_ns_) next_expiry_ns_ = d;
+            }
+          }
+
+          //! Drop failed sessions.  Their sockets are already closed, which took them out of epoll.
+          void reap() {
+            for (std::size_t i = 0; i < dead_.size(); ++i) {
+              session_map::iterator s = sessions_.find(dead_[i]);
+              // It may have been replaced by a working session since.
+              if (s != sessions_.end() && s->second->s.state() == session::failed) {
+                discard(s->second);
+                sessions_.erase(s);
+              }
+            }
+            dead_.clear();
+
+            for (std::size_t i = 0; i < draining_.size(); ) {
+              if (draining_[i]->ops == 0) {
+                draining_[i].swap(draining_.back());
+                draining_.pop_back();
+              }
+              else {
+                ++i;
+              }
+            }
+          }
+
+          //! Free a failed entry, or keep it until the kernel is done with it.
+          void discard(std::unique_ptr<entry> &e) {
+            if (e && e->ops > 0) draining_.push_back(std::move(e));
+            e.reset();
+          }
+
+          uint64_t wait_ns() const {
+            if (next_expiry_ns_ == ~uint64_t(0)) return ~uint64_t(0);
+            uint64_t now = common::metrics::now_ns();
+            return (next_expiry_ns_ > now) ? next_expiry_ns_ - now : 0;
+          }
+
+          static short to_poll(uint32_t e) {
+            return ((e & EPOLLIN) ? POLLIN : 0) | ((e & EPOLLOUT) ? POLLOUT : 0)
+                 | ((e & EPOLLERR) ? POLLERR : 0) | ((e & EPOLLHUP) ? POLLHUP : 0);
+          }
+
+          //! \name io_uring backend
+          //@{
+          static uint64_t tag(entry &e, op_t op) { return (uint64_t) (uintptr_t) &e | op; }
+
+          void arm_wake() {
+            struct io_uring_sqe *s = ring_->sqe();
+            s->opcode = IORING_OP_READ;
+            s->fd = wake_fd_;
+            s->addr = (uint64_t) (uintptr_t) &wake_count_;
+            s->len = sizeof(wake_count_);
+            s->user_data = op_wake;
+            wake_armed_ = true;
+          }
+
+          //! Queue whatever the session needs: a poll while connecting, else a receive and its output.
+          void arm(entry &e) {
+            if (e.s.state() == session::connecting) {
+              if (e.poll_armed) return;
+              struct io_uring_sqe *s = ring_->sqe();
+              s->opcode = IORING_OP_POLL_ADD;
+              s->fd = e.s.fd();
+              s->poll32_events = POLLOUT;
+              s->user_data = tag(e, op_poll);
+              e.poll_armed = true;
+              ++e.ops;
+              return;
+            }
+
+            if (! e.recv_armed) {
+              struct io_uring_sqe *s = ring_->sqe();
+              s->opcode = IORING_OP_RECV;
+              s->fd = e.s.fd();
+              s->ioprio = IORING_RECV_MULTISHOT;
+              s->flags = IOSQE_BUFFER_SELECT;
+              s->buf_group = common::uring::buffer_group;
+              s->user_data = tag(e, op_recv);
+              e.recv_armed = true;
+              ++e.ops;
+            }
+            if (! e.sending && e.s.take_output(e.send_buf)) {
+              e.send_off = 0;
+              send(e);
+            }
+          }
+
+          void send(entry &e) {
+            struct io_uring_sqe *s = ring_->sqe();
+            s->opcode = IORING_OP_SEND;
+            s->fd = e.s.fd();
+            s->addr = (uint64_t) (uintptr_t) (e.send_buf.data() + e.send_off);
+            s->len = e.send_buf.size() - e.send_off;
+            s->msg_flags = MSG_NOSIGNAL;
+            s->user_data = tag(e, op_send);
+            e.sending = true;
+            ++e.ops;
+          }
+
+          //! Stop the kernel working for a failed session.  Its socket stays open until this is done.
+          void cancel(entry &e) {
+            if (e.cancelled) return;
+            e.cancelled = true;
+            const op_t armed[] = {op_poll, op_recv, op_send};
+            const bool is_armed[] = {e.poll_armed, e.recv_armed, e.sending};
+            for (int i = 0; i < 3; ++i) {
+              if (! is_armed[i]) continue;
+              struct io_uring_sqe *s = ring_->sqe();
+              s->opcode = IORING_OP_ASYNC_CANCEL;
+              s->addr = tag(e, armed[i]);
+              s->user_data = tag(e, op_cancel);
+              ++e.ops;
+            }
+          }
+
+          void completed(const struct io_uring_cqe &c) {
+            entry *e = (entry *) (uintptr_t) (c.user_data & ~uint64_t(7));
+            op_t op = (op_t) (c.user_data & 7);
+            if (e == NULL) {
+              if (op == op_wake) {
+                wake_armed_ = false;
+                if (! stop_.load()) arm_wake();
+              }
+              return;
+            }
+
+            switch (op) {
+              case op_poll:
+                --e->ops;
+                e->poll_armed = false;
+                if (! e->cancelled) e->s.handle((c.res < 0) ? POLLERR : (short) c.res);
+                break;
+              case op_recv:
+                if (! (c.flags & IORING_CQE_F_MORE)) {
+                  --e->ops;
+                  e->recv_armed = false;
+                }
+                if (c.flags & IORING_CQE_F_BUFFER) {
+                  uint16_t id = c.flags >> IORING_CQE_BUFFER_SHIFT;
+                  if (! e->cancelled) e->s.received(ring_->buffer(id), c.res);
+                  ring_->recycle(id);
+                }
+                else if (e->cancelled || c.res == -ENOBUFS || c.res == -ECANCELED) {
+                  // Out of buffers ends the multishot receive; it is armed again below.
+                }
+                else if (c.res == 0) {
+                  e->s.received(NULL, 0);
+                }
+                else if (c.res < 0) {
+                  e->s.fail(common::status(common::recv_failed, "recv() failed", -c.res));
+                }
+                break;
+              case op_send:
+                --e->ops;
+                e->sending = false;
+                if (e->cancelled) break;
+                if (c.res < 0) {
+                  e->s.fail(common::status(common::send_failed, "error sending packet", -c.res));
+                }
+                else {
+                  e->send_off += c.res;
+                  if (e->send_off < e->send_buf.size()) send(*e);
+                }
+                break;
+              case op_cancel:
+              case op_wake:
+                --e->ops;
+                break;
+            }
+            if (e->cancelled) return;
+            update(*e);
+            uint64_t d = e->s.next_deadline();
+            if (d < next_expiry_ns_) next_expiry_ns_ = d;
+          }
+
+          bool in_flight() const {
+            for (session_map::const_iterator i = sessions_.begin(); i != sessions_.end(); ++i) {
+              if (i->second->ops) return true;
+            }
+            for (std::size_t i = 0; i < draining_.size(); ++i) {
+              if (draining_[i]->ops) return true;
+            }
+            return false;
+          }
+          //@}
+      };
+
+      std::vector<std::unique_ptr<loop> > loops_;
+
+      sharded_engine(const sharded_engine &);
+      sharded_engine &operator=(const sharded_engine &);
+  };
+}
+
+#endif
@@ -0,0 +1,184 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief An RCON connection which many threads can use at once.
+
+\code
+rcon::shared_connection conn(rcon::host("127.0.0.1", "27015", true), "password");
+
+// From any number of threads:
+std::future<std::string> status = conn.submit("status");
+std::cout << status.get();
+
+// Or have a pool parse big replies so the I/O thread is never held up:
+common::work_pool pool;
+rcon::shared_connection conn2(server, "password", rcon::shared_connection::default_timeout_ms, &pool);
+conn2.submit("cvarlist", [](common::result<std::string> &r) {
+  if (r.ok()) parse_cvarlist(r.value());
+});
+\endcode
+*/
+
+#ifndef SHARED_CONNECTION_HPP_x8n2fj4v
+#define SHARED_CONNECTION_HPP_x8n2fj4v
+
+#include <lrcon/rcon.hpp>
+#include <lrcon/rcon_session.hpp>
+#include <lrcon/mpsc_queue.hpp>
+#include <lrcon/work_pool.hpp>
+
+#include <poll.h>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+
+namespace rcon {
+  /*!
+  \brief An authenticated connection which is safe to share between threads.
+
+  Commands are pushed onto a lock-free queue by the submitting threads.  One I/O
+  thread owns the socket and drives an rcon::session with it, so commands from
+  different threads are pipelined on the one connection rather than needing a
+  connection each.
+
+  Replies are gathered and interactive commands put ahead of bulk ones as described
+  for rcon::session.  A future gets an
+  exception of the same type that rcon::command would throw: timeout_error if no
+  reply arrived, auth_error if the server dropped the authorisation and
+  connection_error, send_error or recv_error if the connection failed.  After the
+  connection fails every later command fails in the same way.
+
+  Commands can instead be given a completion which is called with the reply or the
+  error.  Completions run on the work_pool given to the constructor, or on the I/O
+  thread if there is none, in which case they must be quick.
+  */
+  class shared_connection : private connection {
+    public:
+      //! How long to wait for each packet of a reply.
+      static const int default_timeout_ms = 1000;
+
+      //! Called once with the reply or the reason there isn't one.
+      typedef session::completion completion;
+
+      /*!
+      \brief Connect, authenticate and start the I/O thread.
+
+      \param pool  where completions run; it must outlive this connection.
+      \throws the same as rcon::connection.
+      */
+      shared_connection(const host &server, const char *password, int timeout_ms = default_timeout_ms,
+                        common::work_pool *pool = NULL)
+      : connection(server, password), wake_pending_(false), stop_(false),
+        session_((uint64_t) timeout_ms * 1000000, pool) {
+        if (pipe(wake_pipe_) == -1) {
+          common::errno_throw<connection_error>("pipe() failed");
+        }
+        session_.adopt(socket());
+        fcntl(wake_pipe_[0], F_SETFL, fcntl(wake_pipe_[0], F_GETFL, 0) | O_NONBLOCK);
+        io_ = std::thread(&shared_connection::run, this);
+      }
+
+      //! Outstanding commands fail with connection_error.  Completions may still be
+      //! running on the pool afterwards.
+      ~shared_connection() {
+        stop_.store(true);
+        wake();
+        io_.join();
+        close(wake_pipe_[0]);
+        close(wake_pipe_[1]);
+      }
+
+      //! Send a command.  Safe from any thread.
+      std::future<std::string> submit(const std::string &command,
+                                      common::priority_t priority = common::priority_interactive) {
+        request r;
+        r.text = command;
+        r.priority = priority;
+        std::future<std::string> f = r.reply.get_future();
+        enqueue(r);
+        return f;
+      }
+
+      //! Send a command and call \c done with the outcome.  Safe from any thread.
+      void submit(const std::string &command, completion done,
+                  common::priority_t priority = common::priority_interactive) {
+        request r;
+        r.text = command;
+        r.priority = priority;
+        r.done = std::move(done);
+        enqueue(r);
+      }
+
+    private:
+      typedef session::request request;
+
+      common::mpsc_queue<request> queue_;
+      //! True from a wake() until the I/O thread next looks at the queue.
+      std::atomic<bool> wake_pending_;
+      std::atomic<bool> stop_;
+      int wake_pipe_[2];
+      //! Only touched by the I/O thread.
+      session session_;
+      std::thread io_;
+
+      //! Make the I/O thread look at the queue.  Only the first wake() since it last
+      //! looked costs a syscall.
+      void wake() {
+        if (! wake_pending_.exchange(true)) {
+          char c = 0;
+          while (write(wake_pipe_[1], &c, 1) == -1 && errno == EINTR) {}
+        }
+      }
+
+      void enqueue(request &r) {
+        queue_.push(std::move(r));
+        wake();
+      }
+
+      void run() {
+        while (true) {
+          bool stopping = stop_.load();
+          take_submissions();
+          if (stopping) break;
+          session_.flush();
+
+          struct pollfd fds[2];
+          // Once failed only the wake pipe matters; poll() skips negative fds.
+          fds[0].fd = (session_.state() == session::failed) ? -1 : socket();
+          fds[0].events = session_.events();
+          fds[0].revents = 0;
+          fds[1].fd = wake_pipe_[0];
+          fds[1].events = POLLIN;
+          int n = poll(fds, 2, poll_timeout_ms());
+          if (n > 0 && fds[0].revents) session_.handle(fds[0].revents);
+          session_.expire(common::metrics::now_ns());
+        }
+
+        session_.fail(common::status(common::connection_failed, "the shared connection was closed"));
+      }
+
+      //! Hand everything on the queue to the session.
+      void take_submissions() {
+        // Cleared before popping so a push we miss is followed by another wake().
+        wake_pending_.store(false);
+        char buf[64];
+        while (read(wake_pipe_[0], buf, sizeof(buf)) > 0) {}
+
+        request r;
+        while (queue_.pop(r)) session_.add(r);
+      }
+
+      int poll_timeout_ms() const {
+        uint64_t next = session_.next_deadline();
+        if (next == ~uint64_t(0)) return -1;
+        uint64_t now = common::metrics::now_ns();
+        if (next <= now) return 0;
+        return (int) ((next - now + 999999) / 1000000);
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Collects a response in memory, or in a temporary file once it is big.
+
+\code
+common::response_sink out;
+common::status st;
+rcon::command c(conn, "cvarlist", out, st);
+std::string_view text = out.view();
+\endcode
+*/
+
+#ifndef SPOOL_HPP_r6d2k9vm
+#define SPOOL_HPP_r6d2k9vm
+
+#include <lrcon/common.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace common {
+  /*!
+  \brief Somewhere to put a response which might be megabytes long.
+
+  Up to the threshold the data is kept in memory.  Past it, everything is moved to
+  an unlinked temporary file and later data is written straight there, so each
+  response holds at most the threshold in the heap however long it gets.  view()
+  then maps the file read-only.  Its pages are the file's, which the kernel can drop
+  and read back, rather than anonymous memory.
+
+  The file is made in \c dir, or else $TMPDIR or /tmp.  A tmpfs directory is still
+  memory, so point it at a disk for the full effect.  If no file can be made the
+  data stays in memory.
+  */
+  class response_sink {
+    public:
+      static const std::size_t default_threshold = 1 << 20;
+
+      explicit response_sink(std::size_t threshold = default_threshold, const char *dir = NULL)
+      : threshold_(threshold), dir_(dir ? dir : ""), fd_(-1), size_(0), map_(NULL), mapped_(0) {}
+
+      ~response_sink() {
+        unmap();
+        if (fd_ != -1) close(fd_);
+      }
+
+      //! Add to the end.  Invalidates view().  Fails only if the spool file cannot be written.
+      status append(std::string_view data) {
+        if (data.empty()) return status();
+        unmap();
+        if (fd_ == -1 && (memory_.size() + data.size() <= threshold_ || ! spill())) {
+          memory_.append(data.data(), data.size());
+          size_ = memory_.size();
+          return status();
+        }
+        if (! write_all(data.data(), data.size())) {
+          return errno_status(recv_failed, "writing to the spool file failed");
+        }
+        size_ += data.size();
+        return status();
+      }
+
+      //! Empty it so it can be used again.  Invalidates view().
+      void clear() {
+        unmap();
+        if (fd_ != -1) close(fd_);
+        fd_ = -1;
+        std::string().swap(memory_);
+        size_ = 0;
+      }
+
+      std::size_t size() const { return size_; }
+
+      //! Whether the data went to a file.
+      bool spooled() const { return fd_ != -1; }
+
+      /*!
+      \brief Everything appended so far.
+
+      Valid until the next append() or clear().  An empty view if the file could not
+      be mapped.
+      */
+      std::string_view view() {
+        if (fd_ == -1) return memory_;
+        if (size_ == 0) return std::string_view();
+        if (map_ == NULL) {
+          void *m = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+          if (m == MAP_FAILED) return std::string_view();
+          madvise(m, size_, MADV_SEQUENTIAL);
+          map_ = (const char *) m;
+          mapped_ = size_;
+        }
+        return std::string_view(map_, mapped_);
+      }
+
+      //! A copy in a string, for small responses or callers which need one.
+      std::string str() {
+        std::string_view v = view();
+        return std::string(v.data(), v.size());
+      }
+
+    private:
+      std::size_t threshold_;
+      std::string dir_;
+      int fd_;
+      std::size_t size_;
+      std::string memory_;
+      const char *map_;
+      std::size_t mapped_;
+
+      //! Move what is in memory to a new file.  False if it stays in memory.
+      bool spill() {
+        fd_ = open_temporary();
+        if (fd_ == -1) return false;
+        if (! write_all(memory_.data(), memory_.size())) {
+          close(fd_);
+          fd_ = -1;
+          return false;
+        }
+        std::string().swap(memory_);
+        return true;
+      }
+
+      int open_temporary() const {
+        int fd;
+        std::string dir = dir_;
+        if (dir.empty()) {
+          const char *t = std::getenv("TMPDIR");
+          dir = (t && *t) ? t : "/tmp";
+        }
+#ifdef O_TMPFILE
+        // Never has a name, so nothing is left behind after a crash.
+        fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd != -1) return fd;
+#endif
+        std::string path = dir + "/lrcon-spool-XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd == -1) return -1;
+        unlink(path.c_str());
+        return fd;
+      }
+
+      bool write_all(const char *p, std::size_t n) {
+        while (n > 0) {
+          ssize_t w = ::write(fd_, p, n);
+          if (w == -1) {
+            if (errno == EINTR) continue;
+            return false;
+          }
+          p += w;
+          n -= w;
+        }
+        return true;
+      }
+
+      void unmap() {
+        if (map_ != NULL) munmap((void *) map_, mapped_);
+        map_ = NULL;
+        mapped_ = 0;
+      }
+
+      response_sink(const response_sink &);
+      response_sink &operator=(const response_sink &);
+  };
+}
+
+#endif
@@ -0,0 +1,347 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Binary event trace which can be switched on at runtime.
+
+Each thread records fixed size \link common::trace::event events \endlink into its
+own ring buffer; when a ring is full the oldest events are overwritten.  Tracing
+is off by default and a disabled \link LRCON_TRACE \endlink costs one relaxed load
+and a branch.  Events are collected with drain() or appended to a file with
+drain_to_file(), which the \c lrcon_trace program decodes.
+
+\code
+common::trace::enable();
+// ... use the library ...
+common::trace::drain_to_file("lrcon.trace");
+\endcode
+
+Defining \c LRCON_NO_TRACE removes the trace points completely.
+
+\par File format
+A \link common::trace::file_header file_header \endlink followed by events, both
+in host byte order.  Later drains append more events without another header.
+*/
+
+#ifndef TRACE_HPP_p3xv8ajd
+#define TRACE_HPP_p3xv8ajd
+
+#include <lrcon/metrics.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*!
+\def LRCON_TRACE
+
+Record a trace event if tracing is enabled.  \c type__ is a member of
+common::trace::event_type_t without the namespace.
+*/
+#ifdef LRCON_NO_TRACE
+#  define LRCON_TRACE(type__, socket__, request_id__, size__, extra__)
+#else
+#  define LRCON_TRACE(type__, socket__, request_id__, size__, extra__)\
+   do {\
+     if (common::trace::enabled()) {\
+       common::trace::record(common::trace::type__, (socket__), (request_id__), (size__), (extra__));\
+     }\
+   } while (0)
+#endif
+
+namespace common {
+  //! Runtime event tracing; see \link trace.hpp \endlink.
+  namespace trace {
+    /*!
+    \brief What an event records.
+
+    The meaning of the event's size and extra fields is given for each.  Values
+    are never renumbered because they are stored in trace files.
+    */
+    typedef enum {
+      //! connect() started.
+      ev_connect_begin = 1,
+      //! Connected.  The time taken is the difference from ev_connect_begin.
+      ev_connect_end = 2,
+      //! Gave up waiting for connect().
+      ev_connect_timeout = 3,
+      //! connect() failed.  extra = errno.
+      ev_connect_failed = 4,
+      //! Could not make the socket non-blocking while connecting.  extra = errno.
+      ev_nonblock_failed = 5,
+
+      //! RCON packet sent.  size = packet bytes, extra = command id.
+      ev_rcon_send = 16,
+      //! RCON packet received.  size = bytes read, extra = command id.
+      ev_rcon_recv = 17,
+      //! Timeout waiting for an RCON packet.
+      ev_rcon_timeout = 18,
+      //! recv() returned more than a packet can hold.  size = bytes.
+      ev_rcon_too_much_data = 19,
+      //! The first string in a packet was not null-terminated.
+      ev_rcon_unterminated = 20,
+      //! A string field was longer than the protocol allows.
+      ev_rcon_string_too_long = 21,
+      //! Auth response read.  extra = auth_command::auth_t.
+      ev_rcon_auth = 22,
+      //! Command reply complete.  size = payload bytes.
+      ev_rcon_command_done = 23,
+
+      //! Query packet sent.  size = bytes, extra = request type byte.
+      ev_query_send = 32,
+      //! Query packet received.  size = bytes, extra = reply type byte.
+      ev_query_recv = 33,
+      //! Timeout waiting for a query reply.
+      ev_query_timeout = 34,
+      //! A ping reply was not recognised.  extra = reply type byte.
+      ev_query_bad_ping = 35,
+      //! A ping reply had extra data.  size = bytes.
+      ev_query_ping_extra_data = 36,
+      //! The number of rules did not match the header.  size = rules read, extra = expected.
+      ev_query_rules_mismatch = 37,
+      //! Gave up on a split reply with fragments missing.  size = replies incomplete.
+      ev_query_split_incomplete = 38
+    } event_type_t;
+
+    //! Printable name of an event type.
+    inline const char *event_name(uint16_t type) {
+      switch (type) {
+        case ev_connect_begin: return "connect_begin";
+        case ev_connect_end: return "connect_end";
+        case ev_connect_timeout: return "connect_timeout";
+        case ev_connect_failed: return "connect_failed";
+        case ev_nonblock_failed: return "nonblock_failed";
+        case ev_rcon_send: return "rcon_send";
+        case ev_rcon_recv: return "rcon_recv";
+        case ev_rcon_timeout: return "rcon_timeout";
+        case ev_rcon_too_much_data: return "rcon_too_much_data";
+        case ev_rcon_unterminated: return "rcon_unterminated";
+        case ev_rcon_string_too_long: return "rcon_string_too_long";
+        case ev_rcon_auth: return "rcon_auth";
+        case ev_rcon_command_done: return "rcon_command_done";
+        case ev_query_send: return "query_send";
+        case ev_query_recv: return "query_recv";
+        case ev_query_timeout: return "query_timeout";
+        case ev_query_bad_ping: return "query_bad_ping";
+        case ev_query_ping_extra_data: return "query_ping_extra_data";
+        case ev_query_rules_mismatch: return "query_rules_mismatch";
+        case ev_query_split_incomplete: return "query_split_incomplete";
+        default: return "unknown";
+      }
+    }
+
+    //! One trace record.  Exactly 32 bytes.
+    struct event {
+      //! Monotonic clock; only comparable within one run.
+      uint64_t time_ns;
+      //! Small number identifying the recording thread.
+      uint32_t thread;
+      uint16_t type;
+      uint16_t reserved;
+      int32_t socket;
+      int32_t request_id;
+      uint32_t size;
+      uint32_t extra;
+    };
+
+    //! Start of a trace file.
+    struct file_header {
+      char magic[4];
+      uint32_t version;
+      uint32_t event_size;
+      uint32_t reserved;
+    };
+
+    const char file_magic[4] = {'L', 'R', 'C', 'T'};
+    const uint32_t file_version = 1;
+
+    inline std::atomic<bool> enabled_flag(false);
+
+    //! Is tracing on?
+    inline bool enabled() { return enabled_flag.load(std::memory_order_relaxed); }
+
+    //! Switch tracing on or off for all threads.
+    inline void enable(bool on = true) { enabled_flag.store(on, std::memory_order_relaxed); }
+
+    /*!
+    \brief Single producer ring of events.
+
+    Only the owning thread writes.  A drain which races with the writer discards the
+    events the writer may have overwritten while it was copying.
+
+    The copy itself is not synchronised with the writer, so a slot being written
+    can be copied half old and half new.  Such a slot is always one of those
+    discarded, so a torn event is never returned, but race detectors such as TSan
+    will report the copy.
+    */
+    class ring {
+      public:
+        static const std::size_t capacity = 4096;
+
+      private:
+        event events_[capacity];
+        std::atomic<uint64_t> head_;
+        uint64_t drained_;
+        uint32_t thread_;
+
+      public:
+        //! Set false when the owning thread exits.
+        std::atomic<bool> alive;
+
+        explicit ring(uint32_t thread) : head_(0), drained_(0), thread_(thread), alive(true) {}
+
+        uint32_t thread() const { return thread_; }
+
+        void push(const event &e) {
+          uint64_t h = head_.load(std::memory_order_relaxed);
+          events_[h & (capacity - 1)] = e;
+          head_.store(h + 1, std::memory_order_release);
+        }
+
+        //! Append undrained events to out.  Returns the number of events lost by overwriting.
+        //! \pre only one drain at once (the registry lock ensures this).
+        uint64_t drain(std::vector<event> &out) {
+          uint64_t head = head_.load(std::memory_order_acquire);
+          uint64_t start = drained_;
+          if (head - start > capacity) start = head - capacity;
+
+          std::size_t first = out.size();
+          for (uint64_t i = start; i < head; ++i) out.push_back(events_[i & (capacity - 1)]);
+
+          // Anything the writer reached in the meantime might have been overwritten,
+          // and so might the slot of its next push, which it writes before moving head_.
+          uint64_t after = head_.load(std::memory_order_acquire);
+          uint64_t valid_from = (after + 1 > capacity) ? after + 1 - capacity : 0;
+          uint64_t lost = start - drained_;
+          if (valid_from > start) {
+            uint64_t bad = valid_from - start;
+            if (bad > head - start) bad = head - start;
+            out.erase(out.begin() + first, out.begin() + first + bad);
+            lost += bad;
+          }
+
+          drained_ = head;
+          return lost;
+        }
+    };
+
+    //! All the rings which have been created.
+    class registry {
+      std::mutex mutex_;
+      std::vector<std::shared_ptr<ring> > rings_;
+      uint32_t next_thread_;
+      uint64_t lost_;
+
+      public:
+        registry() : next_thread_(0), lost_(0) {}
+
+        std::shared_ptr<ring> create() {
+          std::lock_guard<std::mutex> l(mutex_);
+          std::shared_ptr<ring> r(new ring(next_thread_++));
+          rings_.push_back(r);
+          return r;
+        }
+
+        //! Collect events from every thread, oldest first within each thread.
+        void drain(std::vector<event> &out) {
+          std::lock_guard<std::mutex> l(mutex_);
+          std::size_t i = 0;
+          while (i < rings_.size()) {
+            lost_ += rings_[i]->drain(out);
+            if (! rings_[i]->alive.load(std::memory_order_acquire)) {
+              rings_.erase(rings_.begin() + i);
+            }
+            else {
+              ++i;
+            }
+          }
+        }
+
+        //! Total events overwritten before they could be drained.
+        uint64_t lost() {
+          std::lock_guard<std::mutex> l(mutex_);
+          return lost_;
+        }
+    };
+
+    inline registry &rings() {
+      static registry r;
+      return r;
+    }
+
+    //! Owns the calling thread's ring and marks it finished at thread exit.
+    class local_ring_holder {
+      std::shared_ptr<ring> ring_;
+
+      public:
+        local_ring_holder() : ring_(rings().create()) {}
+        ~local_ring_holder() { ring_->alive.store(false, std::memory_order_release); }
+        ring &get() { return *ring_; }
+    };
+
+    inline ring &local_ring() {
+      thread_local local_ring_holder holder;
+      return holder.get();
+    }
+
+    //! Record an event unconditionally.  Normally use \link LRCON_TRACE \endlink.
+    inline void record(event_type_t type, int32_t socket, int32_t request_id, uint32_t size, uint32_t extra) {
+      ring &r = local_ring();
+      event e;
+      e.time_ns = metrics::now_ns();
+      e.thread = r.thread();
+      e.type = (uint16_t) type;
+      e.reserved = 0;
+      e.socket = socket;
+      e.request_id = request_id;
+      e.size = size;
+      e.extra = extra;
+      r.push(e);
+    }
+
+    //! Move all recorded events into out.
+    inline void drain(std::vector<event> &out) { rings().drain(out); }
+
+    /*!
+    \brief Append all recorded events to a trace file, creating it if necessary.
+
+    \returns the number of events written or -1 with errno set.
+    */
+    inline long drain_to_file(const char *path) {
+      std::vector<event> events;
+      drain(events);
+
+      std::FILE *f = std::fopen(path, "ab");
+      if (f == NULL) return -1;
+
+      bool ok = std::fseek(f, 0, SEEK_END) == 0;
+      if (ok && std::ftell(f) == 0) {
+        file_header h;
+        std::memcpy(h.magic, file_magic, sizeof(h.magic));
+        h.version = file_version;
+        h.event_size = sizeof(event);
+        h.reserved = 0;
+        ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+      }
+
+      if (ok && ! events.empty()) {
+        ok = std::fwrite(&events[0], sizeof(event), events.size(), f) == events.size();
+      }
+
+      int saved_errno = errno;
+      if (std::fclose(f) != 0) ok = false;
+      if (! ok) {
+        errno = saved_errno;
+        return -1;
+      }
+      return (long) events.size();
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,272 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief A minimal io_uring on the raw system calls.  Linux only.
+
+Only what the event loops need is here: one submission and completion queue, a
+timed wait, and one ring of provided receive buffers.  There is no dependency
+on liburing.
+*/
+
+#ifndef URING_HPP_c5t1w8qe
+#define URING_HPP_c5t1w8qe
+
+#include <lrcon/common.hpp>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace common {
+  /*!
+  \brief An io_uring instance with a ring of provided receive buffers.
+
+  Get entries with sqe(), fill them in, and submit_and_wait() sends every queued
+  entry in one system call.  Completions are then read with drain().  Receives
+  which ask for IOSQE_BUFFER_SELECT from buffer_group are given one of the
+  provided buffers; hand it back with recycle() once the data is used.
+
+  Not thread-safe.  Check supported() before use: it needs the multishot receive,
+  provided buffer rings and timed waits of Linux 6.0 or later.
+  */
+  class uring {
+    public:
+      //! Buffer group id for IOSQE_BUFFER_SELECT.
+      static const uint16_t buffer_group = 1;
+
+      /*!
+      \param entries  submission queue size; the completion queue is twice that.
+      \param buffers  provided receive buffers, a power of two.
+      \param buffer_size  bytes in each.
+      */
+      uring(unsigned entries, unsigned buffers, unsigned buffer_size, status &st)
+      : fd_(-1), ring_(MAP_FAILED), ring_size_(0), sqes_(MAP_FAILED), sqes_size_(0),
+        bufs_((struct io_uring_buf_ring *) MAP_FAILED), bufs_size_(0), buffers_(buffers), buffer_size_(buffer_size), buffer_memory_(NULL) {
+        st = setup(entries);
+        if (st.ok()) st = provide_buffers();
+      }
+
+      //! Cancel and drain what is in flight first; the kernel may finish it after the memory has gone.
+      ~uring() {
+        if (fd_ != -1) close(fd_);
+        if (bufs_ != MAP_FAILED) munmap(bufs_, bufs_size_);
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (ring_ != MAP_FAILED) munmap(ring_, ring_size_);
+        delete [] buffer_memory_;
+      }
+
+      /*!
+      \brief Whether this kernel can run a uring.  Checked once, by trying it.
+
+      A multishot receive is made on a socket pair, because kernels before 6.0
+      accept the ring but fail that receive.
+      */
+      static bool supported() {
+        static const bool s = probe();
+        return s;
+      }
+
+      //! A zeroed submission entry, submitting the queue first if it is full.
+      struct io_uring_sqe *sqe() {
+        if (sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) submit();
+        unsigned index = sq_tail_ & sq_mask_;
+        struct io_uring_sqe *e = &sqe_array_[index];
+        std::memset(e, 0, sizeof(*e));
+        sq_index_[index] = index;
+        ++sq_tail_;
+        return e;
+      }
+
+      //! Submit the queued entries without waiting.
+      status submit() {
+        return enter(0, 0, NULL);
+      }
+
+      /*!
+      \brief Submit the queued entries and wait for a completion.
+
+      \param timeout_ns  longest to wait; ~0 for no limit.  Running out of time is
+                         not an error.
+      */
+      status submit_and_wait(uint64_t timeout_ns) {
+        if (timeout_ns == ~uint64_t(0)) return enter(1, IORING_ENTER_GETEVENTS, NULL);
+
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        return enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+      }
+
+      //! Call \c f with each completion which is ready.  \returns how many there were.
+      template <typename F>
+      unsigned drain(F f) {
+        unsigned head = *cq_head_;
+        unsigned n = 0;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+          // Copied so that f can submit more without the slot being reused under it.
+          struct io_uring_cqe c = cqes_[head & cq_mask_];
+          ++head;
+          __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+          f(c);
+          ++n;
+        }
+        return n;
+      }
+
+      //! The provided buffer a completion with IORING_CQE_F_BUFFER used.
+      char *buffer(uint16_t id) { return buffer_memory_ + (std::size_t) id * buffer_size_; }
+
+      unsigned buffer_size() const { return buffer_size_; }
+
+      //! Give a provided buffer back to the kernel.
+      void recycle(uint16_t id) {
+        // Not bufs_->bufs: in C++ the header's flexible array member lands 8 bytes late.
+        struct io_uring_buf *b = (struct io_uring_buf *) bufs_ + (buf_tail_ & (buffers_ - 1));
+        b->addr = (uint64_t) (uintptr_t) buffer(id);
+        b->len = buffer_size_;
+        b->bid = id;
+        ++buf_tail_;
+        __atomic_store_n(&bufs_->tail, buf_tail_, __ATOMIC_RELEASE);
+      }
+
+    private:
+      int fd_;
+      void *ring_;
+      std::size_t ring_size_;
+      void *sqes_;
+      std::size_t sqes_size_;
+
+      unsigned *sq_head_;
+      unsigned *sq_tail_ptr_;
+      unsigned *sq_index_;
+      unsigned sq_mask_;
+      unsigned sq_entries_;
+      //! Entries are queued here and published to the kernel by enter().
+      unsigned sq_tail_;
+      struct io_uring_sqe *sqe_array_;
+
+      unsigned *cq_head_;
+      unsigned *cq_tail_;
+      unsigned cq_mask_;
+      struct io_uring_cqe *cqes_;
+
+      struct io_uring_buf_ring *bufs_;
+      std::size_t bufs_size_;
+      uint16_t buf_tail_;
+      unsigned buffers_;
+      unsigned buffer_size_;
+      char *buffer_memory_;
+
+      status setup(unsigned entries) {
+        struct io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        // The loop owns its thread, so the kernel need not interrupt it for completions.
+        p.flags = IORING_SETUP_COOP_TASKRUN;
+        fd_ = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (fd_ == -1 && errno == EINVAL) {
+          std::memset(&p, 0, sizeof(p));
+          fd_ = (int) syscall(__NR_io_uring_setup, entries, &p);
+        }
+        if (fd_ == -1) return errno_status(connection_failed, "io_uring_setup() failed");
+        if (! (p.features & IORING_FEAT_SINGLE_MMAP) || ! (p.features & IORING_FEAT_EXT_ARG)) {
+          return status(connection_failed, "the kernel's io_uring is too old");
+        }
+
+        std::size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        std::size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        ring_size_ = (sq_size > cq_size) ? sq_size : cq_size;
+        ring_ = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (ring_ == MAP_FAILED) return errno_status(connection_failed, "mmap() of the io_uring failed");
+        sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) return errno_status(connection_failed, "mmap() of the io_uring entries failed");
+
+        char *r = (char *) ring_;
+        sq_head_ = (unsigned *) (r + p.sq_off.head);
+        sq_tail_ptr_ = (unsigned *) (r + p.sq_off.tail);
+        sq_index_ = (unsigned *) (r + p.sq_off.array);
+        sq_mask_ = *(unsigned *) (r + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        sq_tail_ = *sq_tail_ptr_;
+        sqe_array_ = (struct io_uring_sqe *) sqes_;
+        cq_head_ = (unsigned *) (r + p.cq_off.head);
+        cq_tail_ = (unsigned *) (r + p.cq_off.tail);
+        cq_mask_ = *(unsigned *) (r + p.cq_off.ring_mask);
+        cqes_ = (struct io_uring_cqe *) (r + p.cq_off.cqes);
+        return status();
+      }
+
+      status provide_buffers() {
+        assert(buffers_ != 0 && (buffers_ & (buffers_ - 1)) == 0 && buffers_ <= 32768);
+        bufs_size_ = buffers_ * sizeof(struct io_uring_buf);
+        bufs_ = (struct io_uring_buf_ring *) mmap(NULL, bufs_size_, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufs_ == MAP_FAILED) return errno_status(connection_failed, "mmap() of the buffer ring failed");
+
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t) (uintptr_t) bufs_;
+        reg.ring_entries = buffers_;
+        reg.bgid = buffer_group;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+          return errno_status(connection_failed, "registering the buffer ring failed");
+        }
+
+        buffer_memory_ = new char[(std::size_t) buffers_ * buffer_size_];
+        buf_tail_ = 0;
+        for (unsigned i = 0; i < buffers_; ++i) recycle((uint16_t) i);
+        return status();
+      }
+
+      status enter(unsigned min_complete, unsigned flags, struct io_uring_getevents_arg *arg) {
+        unsigned to_submit = sq_tail_ - *sq_tail_ptr_;
+        __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+        long r = syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, arg,
+                         arg ? sizeof(*arg) : (std::size_t) _NSIG / 8);
+        if (r >= 0) return status();
+        // A timeout or signal ends the wait; anything submitted stays submitted.  A
+        // full completion queue is drained by the caller before it calls again.
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) return status();
+        return errno_status(connection_failed, "io_uring_enter() failed");
+      }
+
+      static bool probe() {
+        status st;
+        uring r(4, 1, 64, st);
+        if (! st.ok()) return false;
+
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) return false;
+        struct io_uring_sqe *e = r.sqe();
+        e->opcode = IORING_OP_RECV;
+        e->fd = pair[0];
+        e->ioprio = IORING_RECV_MULTISHOT;
+        e->flags = IOSQE_BUFFER_SELECT;
+        e->buf_group = buffer_group;
+        char c = 'x';
+        bool ok = write(pair[1], &c, 1) == 1 && r.submit_and_wait(1000000000).ok();
+        int result = -1;
+        unsigned flags = 0;
+        r.drain([&](const struct io_uring_cqe &cqe) { result = cqe.res; flags = cqe.flags; });
+        close(pair[0]);
+        close(pair[1]);
+        return ok && result == 1 && (flags & IORING_CQE_F_MORE);
+      }
+
+      uring(const uring &);
+      uring &operator=(const uring &);
+  };
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright (C) 2008 James Weber
+// Under the LGPL3, see COPYING
+/*!
+\file
+\brief Work-stealing thread pool for parsing replies away from the I/O threads.
+
+\code
+common::work_pool pool;
+pool.post([reply]() { parse(reply); });
+\endcode
+*/
+
+#ifndef WORK_POOL_HPP_q5v9c2hs
+#define WORK_POOL_HPP_q5v9c2hs
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common {
+  /*!
+  \brief A fixed set of worker threads which steal work from each other.
+
+  Each worker has its own queue which it runs in order.  Tasks posted from outside
+  the pool are dealt to the queues in turn, and tasks posted by a task go on its
+  own worker's queue where their data is still warm in its cache.  A worker with
+  nothing to do steals the newest task from another queue before it sleeps, so one
+  slow parse does not hold up the tasks queued behind it.
+
+  Tasks should deal with their own errors; an exception escaping a task is
+  discarded so that the worker survives.
+
+  The destructor runs every task already posted before it returns.
+  */
+  class work_pool {
+    public:
+      typedef std::function<void ()> task;
+
+      //! \param threads  number of workers; 0 means one per core.
+      explicit work_pool(unsigned threads = 0)
+      : stop_(false), queued_(0), sleepers_(0), next_queue_(0) {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        size_ = threads;
+        queues_.reset(new worker_queue[size_]);
+        for (unsigned i = 0; i < size_; ++i) {
+          workers_.push_back(std::thread(&work_pool::work, this, i));
+        }
+      }
+
+      ~work_pool() {
+        {
+          std::lock_guard<std::mutex> l(sleep_mutex_);
+          stop_.store(true);
+        }
+        wake_.notify_all();
+        for (std::size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+      }
+
+      //! Safe from any thread, including the pool's own.
+      void post(task t) {
+        const current_worker &me = current();
+        unsigned q;
+        if (me.pool == this) {
+          q = me.index;
+        }
+        else {
+          q = next_queue_.fetch_add(1, std::memory_order_relaxed) % size_;
+        }
+
+        // Counted first so that a worker never sees more tasks than queued_.
+        queued_.fetch_add(1);
+        {
+          std::lock_guard<std::mutex> l(queues_[q].lock);
+          queues_[q].tasks.push_back(std::move(t));
+        }
+        // Pairs with the sleepers_ increment in work() so one of us sees the other.
+        if (sleepers_.load() > 0) {
+          std::lock_guard<std::mutex> l(sleep_mutex_);
+          wake_.notify_one();
+        }
+      }
+
+      unsigned size() const { return size_; }
+
+    private:
+      //! The owner takes from the front and thieves from the back.
+      struct alignas(64) worker_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+      };
+
+      struct current_worker {
+        work_pool *pool;
+        unsigned index;
+      };
+
+      static current_worker &current() {
+        static thread_local current_worker w = {NULL, 0};
+        return w;
+      }
+
+      unsigned size_;
+      std::unique_ptr<worker_queue[]> queues_;
+      std::vector<std::thread> workers_;
+      std::atomic<bool> stop_;
+      //! Tasks posted and not yet taken.
+      std::atomic<std::size_t> queued_;
+      std::atomic<unsigned> sleepers_;
+      std::atomic<unsigned> next_queue_;
+      std::mutex sleep_mutex_;
+      std::condition_variable wake_;
+
+      bool take(unsigned index, task &out) {
+        // Our own oldest first...
+        {
+          worker_queue &q = queues_[index];
+          std::lock_guard<std::mutex> l(q.lock);
+          if (! q.tasks.empty()) {
+            out = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+          }
+        }
+        // ...then the newest of anyone else's, which its owner is furthest from.
+        for (unsigned i = 1; i < size_; ++i) {
+          worker_queue &q = queues_[(index + i) % size_];
+          std::lock_guard<std::mutex> l(q.lock);
+          if (! q.tasks.empty()) {
+            out = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+          }
+        }
+        return false;
+      }
+
+      void work(unsigned index) {
+        current().pool = this;
+        current().index = index;
+
+        task t;
+        while (true) {
+          if (take(index, t)) {
+            queued_.fetch_sub(1);
+            try {
+              t();
+            }
+            catch (...) {
+            }
+            t = NULL;
+            continue;
+          }
+
+          std::unique_lock<std::mutex> l(sleep_mutex_);
+          sleepers_.fetch_add(1);
+          while (queued_.load() == 0 && ! stop_.load()) wake_.wait(l);
+          sleepers_.fetch_sub(1);
+          if (queued_.load() == 0 && stop_.load()) return;
+        }
+      }
+
+      work_pool(const work_pool &);
+      work_pool &operator=(const work_pool &);
+  };
+}
+
+#endif
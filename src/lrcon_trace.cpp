@@ -0,0 +1,69 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief Prints the events in a trace file written by common::trace::drain_to_file().
+
+Times are printed in microseconds relative to the first event in the file.
+*/
+
+#include <lrcon/trace.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void print_usage(const char *pname) {
+  std::cout
+      << pname << " tracefile\n"
+      "Print the events recorded in an lrcon trace file, one per line:\n\n"
+      "  time_us thread event socket request_id size extra\n"
+      << std::flush;
+}
+
+int main(int argc, const char *const argv[]) {
+  using common::trace::event;
+  using common::trace::file_header;
+
+  if (argc != 2 || strcmp(argv[1], "-h") == 0) {
+    print_usage(argv[0]);
+    return (argc == 2) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  std::FILE *f = std::fopen(argv[1], "rb");
+  if (f == NULL) {
+    std::perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  file_header h;
+  if (std::fread(&h, sizeof(h), 1, f) != 1
+      || std::memcmp(h.magic, common::trace::file_magic, sizeof(h.magic)) != 0) {
+    std::cerr << "Error: " << argv[1] << " is not an lrcon trace file." << std::endl;
+    std::fclose(f);
+    return EXIT_FAILURE;
+  }
+
+  if (h.version != common::trace::file_version || h.event_size != sizeof(event)) {
+    std::cerr << "Error: unsupported trace file version " << h.version << "." << std::endl;
+    std::fclose(f);
+    return EXIT_FAILURE;
+  }
+
+  event e;
+  bool first = true;
+  uint64_t start = 0;
+  while (std::fread(&e, sizeof(e), 1, f) == 1) {
+    if (first) {
+      start = e.time_ns;
+      first = false;
+    }
+    double t = (e.time_ns >= start) ? (e.time_ns - start) / 1000.0 : -((start - e.time_ns) / 1000.0);
+    std::printf("%14.3f %3u %-22s %5d %11d %8u %u\n", t, e.thread,
+                common::trace::event_name(e.type), e.socket, e.request_id, e.size, e.extra);
+  }
+
+  std::fclose(f);
+  return EXIT_SUCCESS;
+}
@@ -4,8 +4,11 @@
 \file
 \brief On getting stuff from the main server.
 
-Unlikely I'll ever develop this, but meh.
+The client is master::client in include/lrcon/master.hpp, and tests/master_server.cpp
+is a stand-in master server to try it against.
 
 http://developer.valvesoftware.com/wiki/Master_Server_Query_Protocol
 
 */
+
+#include <lrcon/master.hpp>
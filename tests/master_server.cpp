@@ -0,0 +1,114 @@
+// Copyright (C) 2008 James Weber
+// Under the GPL3, see COPYING
+/*!
+\file
+\brief A stand-in master server, for trying master::client without hitting Valve's.
+
+It serves a made up list of servers, 10.0.0.1:27015 onwards, in pages of 231
+like the real one, and answers the seed of each request with the page after it.
+Every \c drop th request can be ignored, to see the client send it again.
+
+Build and run:
+  $ g++ -std=c++17 -Iinclude tests/master_server.cpp -o master_server
+  $ ./master_server 27011 20000 0
+*/
+
+#include <lrcon/master.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+  //! As many addresses as fit in a datagram after the header.
+  const std::size_t page_entries = 231;
+
+  struct server {
+    unsigned char bytes[master::codec::entry_size];
+  };
+
+  server make_server(uint32_t i) {
+    // 10.0.0.1 onwards, with the port varying so that it is checked too.
+    uint32_t ip = htonl((10u << 24) + 1 + i);
+    uint16_t port = htons(27015 + (i % 4));
+    server s;
+    std::memcpy(s.bytes, &ip, 4);
+    std::memcpy(s.bytes + 4, &port, 2);
+    return s;
+  }
+
+  std::string to_text(const server &s) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, s.bytes, ip, sizeof(ip));
+    uint16_t port;
+    std::memcpy(&port, s.bytes + 4, 2);
+    return std::string(ip) + ":" + std::to_string(ntohs(port));
+  }
+}
+
+int main(int argc, char **argv) {
+  int port = (argc > 1) ? std::atoi(argv[1]) : 27011;
+  uint32_t count = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : 10000;
+  unsigned drop = (argc > 3) ? (unsigned) std::atoi(argv[3]) : 0;
+
+  std::vector<server> servers;
+  std::map<std::string, std::size_t> index;
+  for (uint32_t i = 0; i < count; ++i) {
+    servers.push_back(make_server(i));
+    index[to_text(servers.back())] = i;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in me;
+  std::memset(&me, 0, sizeof(me));
+  me.sin_family = AF_INET;
+  me.sin_port = htons(port);
+  me.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1 || bind(fd, (struct sockaddr *) &me, sizeof(me)) == -1) {
+    perror("bind()");
+    return 1;
+  }
+  std::cerr << "serving " << count << " servers on 127.0.0.1:" << port << std::endl;
+
+  unsigned requests = 0;
+  unsigned char buf[2048];
+  while (true) {
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t got = recvfrom(fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *) &from, &from_len);
+    if (got < 3 || buf[0] != master::codec::list_request) continue;
+    buf[got] = '\0';
+    if (drop && ++requests % drop == 0) continue;
+
+    std::string seed((const char *) buf + 2);
+    std::size_t first = 0;
+    if (seed != "0.0.0.0:0") {
+      std::map<std::string, std::size_t>::const_iterator i = index.find(seed);
+      if (i == index.end()) continue;
+      first = i->second + 1;
+    }
+
+    unsigned char reply[master::codec::reply_header_size + page_entries * master::codec::entry_size];
+    const unsigned char header[] = {0xff, 0xff, 0xff, 0xff, master::codec::list_reply, '\n'};
+    std::memcpy(reply, header, sizeof(header));
+    std::size_t n = 0;
+    for (std::size_t i = first; i < servers.size() && n < page_entries; ++i, ++n) {
+      std::memcpy(reply + sizeof(header) + n * master::codec::entry_size, servers[i].bytes, master::codec::entry_size);
+    }
+    // The list ends with 0.0.0.0:0, on a page of its own if this one is full.
+    if (first + n == servers.size() && n < page_entries) {
+      std::memset(reply + sizeof(header) + n * master::codec::entry_size, 0, master::codec::entry_size);
+      ++n;
+    }
+    sendto(fd, reply, sizeof(header) + n * master::codec::entry_size, 0, (struct sockaddr *) &from, from_len);
+  }
+}